@@ -7,6 +7,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "y.tab.h"
 #include "sym.h"
 
@@ -14,8 +15,27 @@
 
 static void Ast_printAux( Ast* ast, int ntab );
 static Ast* newAstNode();
+static int internString( char* svalue );
+static unsigned int hashString( const char* s );
+static void compactChildren( Ast** oldChunks, Ast* node, AstIndex oldFirstChild );
 static char* typeTable( AstType type );
 
+#define AST_CHUNK_SIZE ( 1 << AST_CHUNK_BITS )
+#define AST_INITIAL_STRINGS 1024
+
+Ast** Ast_chunks = NULL;
+char** Ast_strings = NULL;
+
+// A posicao 0 da arena nao e usada, para que 0 indique nenhum no
+static AstIndex nNodes = 1;
+static int nChunks = 0;
+
+// Tabela de hash das strings internadas, com o indice em Ast_strings
+static int* stringBuckets = NULL;
+static int nStringBuckets = 0;
+static int nStrings = 0;
+static int stringCapacity = 0;
+
 
 
 /*** Public ***/
@@ -43,7 +63,7 @@ Ast* Ast_newFromTokenIv( AstType type, int ivalue, unsigned int line )
 Ast* Ast_newFromTokenSv( AstType type, char* svalue, unsigned int line )
 {
    Ast* node = Ast_new( type, line );
-   node->sval = svalue;
+   node->ival = internString( svalue );
    return node;
 }
 
@@ -51,18 +71,7 @@ Ast* Ast_newFromTokenSv( AstType type, char* svalue, unsigned int line )
 
 void Ast_addChild( Ast* parentNode, Ast* childNode )
 {
-   if ( parentNode == NULL || childNode == NULL ) return;
-
-   childNode->parent = parentNode;
-   childNode->prevSibling = parentNode->lastChild;
-
-   if ( parentNode->lastChild != NULL )
-      parentNode->lastChild->nextSibling = childNode;
-
-   if ( parentNode->firstChild == NULL )
-      parentNode->firstChild = childNode;
-
-   parentNode->lastChild = childNode;
+   Ast_addChildren( parentNode, childNode );
 }
 
 
@@ -71,29 +80,10 @@ void Ast_addChildren( Ast* parentNode, Ast* childrenList )
 {
    if ( parentNode == NULL || childrenList == NULL ) return;
 
-   Ast* firstChildFromList;
-   Ast* lastChildFromList;
-
-   firstChildFromList = childrenList;
-   while ( firstChildFromList->prevSibling != NULL )
-      firstChildFromList = firstChildFromList->prevSibling;
-
-   firstChildFromList->prevSibling = parentNode->lastChild;
-   if ( parentNode->lastChild != NULL )
-      parentNode->lastChild->nextSibling = firstChildFromList;
-
-   if ( parentNode->firstChild == NULL )
-      parentNode->firstChild = firstChildFromList;
-
-   childrenList = firstChildFromList;
-   while ( childrenList != NULL )
-   {
-      childrenList->parent = parentNode;
-
-      lastChildFromList = childrenList;
-      childrenList = childrenList->nextSibling;
-   }
-   parentNode->lastChild = lastChildFromList;
+   if ( parentNode->firstChild == 0 )
+      parentNode->firstChild = childrenList->index;
+   else
+      Ast_lastChild( parentNode )->nextSibling = childrenList->index;
 }
 
 
@@ -104,22 +94,54 @@ Ast* Ast_prependSibling( Ast* firstList, Ast* secondList )
    if ( secondList == NULL ) return firstList;
 
    Ast* lastFromFirstList = firstList;
-   Ast* firstFromSecondList = secondList;
+   while ( lastFromFirstList->nextSibling != 0 )
+      lastFromFirstList = Ast_nextSibling( lastFromFirstList );
+   lastFromFirstList->nextSibling = secondList->index;
 
-   while ( lastFromFirstList->nextSibling != NULL )
-      lastFromFirstList = lastFromFirstList->nextSibling;
+   return firstList;
+}
 
-   while ( firstFromSecondList->prevSibling != NULL )
-      firstFromSecondList = firstFromSecondList->prevSibling;
-   
-   lastFromFirstList->nextSibling = firstFromSecondList;
-   firstFromSecondList->prevSibling = lastFromFirstList;
 
-   return firstList;
+
+Ast* Ast_lastChild( Ast* node )
+{
+   Ast* child = Ast_firstChild( node );
+   if ( child == NULL ) return NULL;
+   while ( child->nextSibling != 0 )
+      child = Ast_nextSibling( child );
+   return child;
 }
 
 
 
+Ast* Ast_compact( Ast* ast )
+{
+   Ast** oldChunks = Ast_chunks;
+   int nOldChunks = nChunks;
+   int i;
+
+   // Arena nova; os nos antigos sao lidos pelos blocos guardados
+   Ast_chunks = NULL;
+   nChunks = 0;
+   nNodes = 1;
+
+   Ast* root = newAstNode();
+   AstIndex index = root->index;
+   *root = *ast;
+   root->index = index;
+   root->nextSibling = 0;
+   compactChildren( oldChunks, root, ast->firstChild );
+
+   for ( i = 0 ; i < nOldChunks ; i++ )
+      free( oldChunks[i] );
+   free( oldChunks );
+   return root;
+}
+
+
+
+
+
 void Ast_print( Ast* ast )
 {
    Ast_printAux( ast, 0 );
@@ -145,7 +167,7 @@ void Ast_printAux( Ast* ast, int ntab )
    { 
       case AST_VALSTRING:
       case AST_ID:
-         fprintf( stdout, " [%s]", ast->sval );
+         fprintf( stdout, " [%s]", Ast_sval( ast ) );
          break;
       case AST_VALINT:
          fprintf( stdout, " [%d]", ast->ival );
@@ -192,7 +214,7 @@ void Ast_printAux( Ast* ast, int ntab )
    fprintf( stdout, " @%d", ast->line );
 
    // Iprime as infos dos filhos
-   childCurr = ast->firstChild;
+   childCurr = Ast_firstChild( ast );
    if ( childCurr )
    {
       fprintf( stdout, " {\n" );
@@ -200,7 +222,7 @@ void Ast_printAux( Ast* ast, int ntab )
       do
       {
          Ast_printAux( childCurr, ntab+1 );
-      } while ( childCurr = childCurr->nextSibling );
+      } while ( childCurr = Ast_nextSibling( childCurr ) );
 
       ntabCurr = ntab;
       while ( ntabCurr-- ) fprintf( stdout, "   " );
@@ -213,34 +235,135 @@ void Ast_printAux( Ast* ast, int ntab )
 
 
 
+
 Ast* newAstNode()
 {
-   Ast* node = (Ast*) malloc( sizeof( Ast ) );
-   if ( node == NULL )
+   AstIndex index = nNodes++;
+
+   // Novo bloco; os anteriores nao mudam de lugar
+   if ( (int) ( index >> AST_CHUNK_BITS ) == nChunks )
    {
-      fprintf( stderr, "Memoria insuficiente!\n" );
-      exit( -1 );
+      Ast_chunks = (Ast**) realloc( Ast_chunks, ( nChunks + 1 ) * sizeof( Ast* ) );
+      if ( Ast_chunks == NULL || ( Ast_chunks[ nChunks ] = (Ast*) malloc( AST_CHUNK_SIZE * sizeof( Ast ) ) ) == NULL )
+      {
+         fprintf( stderr, "Memoria insuficiente!\n" );
+         exit( -1 );
+      }
+      nChunks++;
    }
-   
+
+   Ast* node = Ast_at( index );
    node->type = AST_INVALID;
    node->line = 0;
    node->ival = 0;
-   node->sval = NULL;
 
    node->dataType = TYPE_UNDEFINED;
    node->nReferences = 0;
 
-   node->parent = NULL;
-   node->firstChild = NULL;
-   node->lastChild = NULL;
-   node->nextSibling = NULL;
-   node->prevSibling = NULL;
+   node->index = index;
+   node->firstChild = 0;
+   node->nextSibling = 0;
 
    return node;
 }
 
 
 
+// Retorna o indice de svalue em Ast_strings, acrescentando se for nova
+int internString( char* svalue )
+{
+   unsigned int hash;
+   int i;
+
+   if ( svalue == NULL ) return 0;
+   hash = hashString( svalue );
+
+   // Sondagem linear, com a tabela no maximo meio cheia
+   if ( 2 * ( nStrings + 1 ) > nStringBuckets )
+   {
+      int n = nStringBuckets ? 2 * nStringBuckets : 2 * AST_INITIAL_STRINGS;
+      free( stringBuckets );
+      stringBuckets = (int*) calloc( n, sizeof( int ) );
+      nStringBuckets = n;
+      for ( i = 1 ; i <= nStrings ; i++ )
+      {
+         unsigned int h = hashString( Ast_strings[i] );
+         while ( stringBuckets[ h & ( n - 1 ) ] != 0 ) h++;
+         stringBuckets[ h & ( n - 1 ) ] = i;
+      }
+   }
+
+   for ( ; stringBuckets[ hash & ( nStringBuckets - 1 ) ] != 0 ; hash++ )
+   {
+      i = stringBuckets[ hash & ( nStringBuckets - 1 ) ];
+      if ( strcmp( Ast_strings[i], svalue ) == 0 )
+      {
+         free( svalue );
+         return i;
+      }
+   }
+
+   if ( nStrings + 2 > stringCapacity )
+   {
+      stringCapacity = stringCapacity ? 2 * stringCapacity : AST_INITIAL_STRINGS;
+      Ast_strings = (char**) realloc( Ast_strings, stringCapacity * sizeof( char* ) );
+      Ast_strings[0] = NULL;
+   }
+   Ast_strings[ ++nStrings ] = svalue;
+   stringBuckets[ hash & ( nStringBuckets - 1 ) ] = nStrings;
+   return nStrings;
+}
+
+
+
+// FNV-1a
+unsigned int hashString( const char* s )
+{
+   unsigned int hash = 2166136261u;
+   while ( *s )
+   {
+      hash ^= (unsigned char) *s++;
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+
+
+// Copia os filhos antigos para posicoes consecutivas e so depois desce
+// em cada um, para que cada subarvore fique junta
+void compactChildren( Ast** oldChunks, Ast* node, AstIndex oldFirstChild )
+{
+   AstIndex first = nNodes;
+   AstIndex oldChild = oldFirstChild;
+   AstIndex i;
+
+   node->firstChild = 0;
+   while ( oldChild != 0 )
+   {
+      Ast* old = oldChunks[ oldChild >> AST_CHUNK_BITS ] + ( oldChild & ( AST_CHUNK_SIZE - 1 ) );
+      Ast* copy = newAstNode();
+      AstIndex index = copy->index;
+      *copy = *old;
+      copy->index = index;
+      copy->nextSibling = ( old->nextSibling != 0 ) ? index + 1 : 0;
+      oldChild = old->nextSibling;
+   }
+   if ( nNodes == first ) return;
+   node->firstChild = first;
+
+   // firstChild dos filhos copiados ainda aponta para a arena antiga
+   for ( i = first ; ; i++ )
+   {
+      Ast* child = Ast_at( i );
+      compactChildren( oldChunks, child, child->firstChild );
+      if ( child->nextSibling == 0 ) break;
+   }
+}
+
+
+
+
 static char* typeTable( AstType type )
 {
    switch ( type )
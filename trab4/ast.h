@@ -6,12 +6,17 @@
 #ifndef AST_H
 #define AST_H
 
+#include <stddef.h>
+
 #include "sym.h"
 
 
 // Tipo basico de no da arvore sintatica abstrata
 typedef struct ast Ast;
 
+// Posicao de um no na arena; 0 indica nenhum no
+typedef unsigned int AstIndex;
+
 // Tipos de no
 typedef enum astType
 {
@@ -105,30 +110,56 @@ typedef enum astType
 } AstType;
 
 
-// No da AST
+// No da AST, com 24 bytes. Os nos ficam em blocos de uma arena e se
+// referem uns aos outros pela posicao; depois de Ast_compact os filhos
+// de cada no ocupam posicoes consecutivas.
 struct ast
 {
-   // Tipo do no
-   AstType type;
+   // Tipo do no (AstType)
+   unsigned char type;
+   // Tipo de dados (DataType)
+   signed char dataType;
+   signed char nReferences;
    // Linha em que se encontra
    unsigned int line;
-   // Valor numerico se possuir
+   // Valor numerico se possuir, ou o indice do valor string internado (ver Ast_sval)
    int ival;
-   // Valor string se possuir
-   char* sval;
-
-   // Tipo de dados
-   DataType dataType;
-   int nReferences;
 
    // Nos da AST relativos a esse
-   Ast* parent;
-   Ast* firstChild;
-   Ast* lastChild;
-   Ast* nextSibling;
-   Ast* prevSibling;
+   AstIndex index;
+   AstIndex firstChild;
+   AstIndex nextSibling;
 };
 
+#define AST_CHUNK_BITS 12
+
+// Blocos da arena, de 1 << AST_CHUNK_BITS nos cada
+extern Ast** Ast_chunks;
+
+// Strings internadas; Ast_strings[0] e NULL
+extern char** Ast_strings;
+
+static inline Ast* Ast_at( AstIndex index )
+{
+   if ( index == 0 ) return NULL;
+   return Ast_chunks[ index >> AST_CHUNK_BITS ] + ( index & ( ( 1 << AST_CHUNK_BITS ) - 1 ) );
+}
+
+static inline Ast* Ast_firstChild( Ast* node )
+{
+   return Ast_at( node->firstChild );
+}
+
+static inline Ast* Ast_nextSibling( Ast* node )
+{
+   return Ast_at( node->nextSibling );
+}
+
+static inline char* Ast_sval( Ast* node )
+{
+   return Ast_strings[ node->ival ];
+}
+
 
 
 /**
@@ -151,7 +182,8 @@ Ast* Ast_newFromTokenIv( AstType type, int ivalue, unsigned int line );
 /**
  * Cria um novo no com tipo semantico de string
  * @param type Indica o tipo de estrutura representado pelo no
- * @param ivalue O valor de string que ele guarda
+ * @param svalue O valor de string que ele guarda, alocado com malloc; a AST
+ *               passa a ser dona dele e o libera se o valor ja foi internado
  * @param line A linha em que essa estrutura se encontra no arquivo de entrada
  * @return O no gerado
  */
@@ -179,6 +211,22 @@ void Ast_addChildren( Ast* parentNode, Ast* childrenList );
  */
 Ast* Ast_prependSibling( Ast* firstList, Ast* secondList );
 
+/**
+ * Retorna o ultimo filho de um no
+ * @param node O no pai
+ * @return O ultimo filho, ou NULL se nao houver
+ */
+Ast* Ast_lastChild( Ast* node );
+
+/**
+ * Copia a arvore para uma arena nova, com os filhos de cada no em posicoes
+ * consecutivas e cada subarvore logo depois dos seus irmaos, e libera a
+ * arena antiga. Os ponteiros para os nos antigos deixam de valer.
+ * @param ast A raiz da arvore, ao fim da analise sintatica
+ * @return A raiz da arvore compactada
+ */
+Ast* Ast_compact( Ast* ast );
+
 /**
  * Imprime uma arvore sintatica na stdout
  * @param ast A arvore sintatica abstrata do programa a ser impresso
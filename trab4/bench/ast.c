@@ -0,0 +1,149 @@
+/**
+ * @file    ast.c
+ * @author  lhpelosi
+ *
+ * Memoria ocupada pela arvore sintatica e tempo de percorre-la, num
+ * programa gerado direto como AST com muitas funcoes de expressoes
+ * aritmeticas. Mede a arvore ja compactada, como o compilador a usa.
+ *
+ * Uso: bench/ast [funcoes]
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../ast.h"
+#include "../sym.h"
+
+#define BENCH_CMDS 64 // Atribuicoes por funcao
+#define BENCH_EXP_DEPTH 5 // Altura das expressoes
+#define BENCH_WALKS 20 // Percursos medidos
+
+static Ast* Bench_program( int nFunctions );
+static Ast* Bench_var( int i );
+static Ast* Bench_exp( int depth );
+static long Bench_walk( Ast* node, int* nNodes );
+static double Bench_now();
+
+
+
+int main( int argc, char** argv )
+{
+   int nFunctions = ( argc > 1 ) ? atoi( argv[1] ) : 500;
+
+   srand( 1715 );
+   size_t before = mallinfo2().uordblks;
+   Ast* program = Bench_program( nFunctions );
+   program = Ast_compact( program );
+   size_t bytes = mallinfo2().uordblks - before;
+
+   int nNodes = 0;
+   long sum = Bench_walk( program, &nNodes );
+   double start = Bench_now();
+   for ( int w = 0 ; w < BENCH_WALKS ; w++ )
+   {
+      int n = 0;
+      sum += Bench_walk( program, &n );
+   }
+   double walk = ( Bench_now() - start ) / BENCH_WALKS;
+
+   start = Bench_now();
+   int errors = Sym_annotate( program );
+   double annotate = Bench_now() - start;
+   if ( errors > 0 )
+   {
+      fprintf( stderr, "%d erros no programa gerado\n", errors );
+      return 1;
+   }
+
+   printf( "nos: %d (checksum %ld)\n", nNodes, sum );
+   printf( "memoria: %zu bytes, %.1f bytes/no (sizeof(Ast) = %zu)\n", bytes, (double) bytes / nNodes, sizeof( Ast ) );
+   printf( "percurso: %.2f ms, %.2f ns/no\n", 1e3 * walk, 1e9 * walk / nNodes );
+   printf( "Sym_annotate: %.2f ms, %.2f ns/no\n", 1e3 * annotate, 1e9 * annotate / nNodes );
+   return 0;
+}
+
+
+
+static Ast* Bench_program( int nFunctions )
+{
+   Ast* program = Ast_new( AST_PROGRAM, 1 );
+   for ( int g = 0 ; g < 16 ; g++ )
+   {
+      Ast* declvar = Ast_new( AST_DECLVAR, 1 );
+      Ast_addChild( declvar, Ast_firstChild( Bench_var( g ) ) );
+      Ast_addChild( declvar, Ast_new( AST_INT, 1 ) );
+      Ast_addChild( program, declvar );
+   }
+
+   for ( int f = 0 ; f < nFunctions ; f++ )
+   {
+      char* name = (char*) malloc( 16 );
+      snprintf( name, 16, "f%d", f );
+      Ast* fun = Ast_new( AST_FUN, f + 1 );
+      Ast_addChild( fun, Ast_newFromTokenSv( AST_ID, name, f + 1 ) );
+      Ast_addChild( fun, Ast_new( AST_PARAMS, f + 1 ) );
+      Ast* block = Ast_new( AST_BLOCK, f + 1 );
+      for ( int c = 0 ; c < BENCH_CMDS ; c++ )
+      {
+         Ast* atrib = Ast_new( AST_CMD_ATRIB, f + 1 );
+         Ast_addChild( atrib, Bench_var( rand() % 16 ) );
+         Ast_addChild( atrib, Bench_exp( BENCH_EXP_DEPTH ) );
+         Ast_addChild( block, atrib );
+      }
+      Ast_addChild( fun, block );
+      Ast_addChild( program, fun );
+   }
+   return program;
+}
+
+
+
+static Ast* Bench_var( int i )
+{
+   char* name = (char*) malloc( 16 );
+   snprintf( name, 16, "g%d", i );
+   Ast* var = Ast_new( AST_VAR, 1 );
+   Ast_addChild( var, Ast_newFromTokenSv( AST_ID, name, 1 ) );
+   return var;
+}
+
+
+
+// Soma ou produto de operandos, com folhas que sao numeros ou globais
+static Ast* Bench_exp( int depth )
+{
+   if ( depth == 0 )
+   {
+      if ( rand() % 2 )
+         return Ast_newFromTokenIv( AST_VALINT, rand() % 100, 1 );
+      return Bench_var( rand() % 16 );
+   }
+   Ast* exp = Ast_new( ( rand() % 2 ) ? AST_EXP_ADD : AST_EXP_MULT, 1 );
+   Ast_addChild( exp, Bench_exp( depth - 1 ) );
+   Ast_addChild( exp, Bench_exp( depth - 1 ) );
+   return exp;
+}
+
+
+
+// Percurso em pre-ordem, como o das visitas de Sym_annotate
+static long Bench_walk( Ast* node, int* nNodes )
+{
+   long sum = node->type + node->ival;
+   (*nNodes)++;
+   for ( Ast* child = Ast_firstChild( node ) ; child ; child = Ast_nextSibling( child ) )
+      sum += Bench_walk( child, nNodes );
+   return sum;
+}
+
+
+
+static double Bench_now()
+{
+   struct timespec t;
+   clock_gettime( CLOCK_MONOTONIC, &t );
+   return t.tv_sec + 1e-9 * t.tv_nsec;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file    sym.c
+ * @author  lhpelosi
+ *
+ * Tempo de Sym_annotate em programas gerados direto como AST, com
+ * muitos globais e funcoes de blocos profundamente aninhados. Cada
+ * nivel declara locais e le globais e locais dos niveis de fora.
+ *
+ * Uso: bench/sym [profundidade]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../ast.h"
+#include "../sym.h"
+
+#define BENCH_LOCALS 4 // Locais declarados por nivel
+#define BENCH_USES 8 // Atribuicoes por nivel
+
+static Ast* Bench_program( int nGlobals, int nFunctions, int depth, int* nUses );
+static Ast* Bench_declvar( const char* prefix, int i );
+static Ast* Bench_var( const char* prefix, int i );
+static Ast* Bench_block( int level, int depth, int nGlobals, int* nUses );
+static double Bench_now();
+
+
+
+int main( int argc, char** argv )
+{
+   int depth = ( argc > 1 ) ? atoi( argv[1] ) : 32;
+   int sizes[] = { 500, 1000, 2000, 4000, 8000 };
+
+   srand( 1715 );
+   printf( "%10s %10s %12s %12s %12s %14s\n", "globais", "funcoes", "simbolos", "referencias", "tempo (ms)", "ns/referencia" );
+   for ( int s = 0 ; s < 5 ; s++ )
+   {
+      int nGlobals = sizes[s];
+      int nFunctions = sizes[s] / 10;
+      int nUses = 0;
+      Ast* program = Bench_program( nGlobals, nFunctions, depth, &nUses );
+
+      double start = Bench_now();
+      int errors = Sym_annotate( program );
+      double time = Bench_now() - start;
+      if ( errors > 0 )
+      {
+         fprintf( stderr, "%d erros no programa gerado\n", errors );
+         return 1;
+      }
+      printf( "%10d %10d %12d %12d %12.2f %14.1f\n", nGlobals, nFunctions,
+              nGlobals + nFunctions * ( 1 + BENCH_LOCALS * depth ), nUses,
+              1e3 * time, 1e9 * time / nUses );
+   }
+   return 0;
+}
+
+
+
+static Ast* Bench_program( int nGlobals, int nFunctions, int depth, int* nUses )
+{
+   Ast* program = Ast_new( AST_PROGRAM, 1 );
+   for ( int g = 0 ; g < nGlobals ; g++ )
+      Ast_addChild( program, Bench_declvar( "g", g ) );
+
+   for ( int f = 0 ; f < nFunctions ; f++ )
+   {
+      char* name = (char*) malloc( 16 );
+      snprintf( name, 16, "f%d", f );
+      Ast* fun = Ast_new( AST_FUN, 1 );
+      Ast_addChild( fun, Ast_newFromTokenSv( AST_ID, name, 1 ) );
+      Ast_addChild( fun, Ast_new( AST_PARAMS, 1 ) );
+      Ast_addChild( fun, Bench_block( 0, depth, nGlobals, nUses ) );
+      Ast_addChild( program, fun );
+   }
+   return program;
+}
+
+
+
+static Ast* Bench_declvar( const char* prefix, int i )
+{
+   Ast* declvar = Ast_new( AST_DECLVAR, 1 );
+   Ast_addChild( declvar, Ast_firstChild( Bench_var( prefix, i ) ) );
+   Ast_addChild( declvar, Ast_new( AST_INT, 1 ) );
+   return declvar;
+}
+
+
+
+static Ast* Bench_var( const char* prefix, int i )
+{
+   char* name = (char*) malloc( 16 );
+   snprintf( name, 16, "%s%d", prefix, i );
+   Ast* var = Ast_new( AST_VAR, 1 );
+   Ast_addChild( var, Ast_newFromTokenSv( AST_ID, name, 1 ) );
+   return var;
+}
+
+
+
+// Nivel level: declara l<level>_*, atribui e abre um if com o proximo nivel
+static Ast* Bench_block( int level, int depth, int nGlobals, int* nUses )
+{
+   char prefix[16];
+   Ast* block = Ast_new( AST_BLOCK, 1 );
+
+   snprintf( prefix, 16, "l%d_", level );
+   for ( int i = 0 ; i < BENCH_LOCALS ; i++ )
+      Ast_addChild( block, Bench_declvar( prefix, i ) );
+
+   for ( int u = 0 ; u < BENCH_USES ; u++ )
+   {
+      // lK_i = gR + lJ_i, com J em qualquer nivel visivel
+      char outer[16];
+      snprintf( outer, 16, "l%d_", rand() % ( level + 1 ) );
+      Ast* sum = Ast_new( AST_EXP_ADD, 1 );
+      Ast_addChild( sum, Bench_var( "g", rand() % nGlobals ) );
+      Ast_addChild( sum, Bench_var( outer, rand() % BENCH_LOCALS ) );
+      Ast* atrib = Ast_new( AST_CMD_ATRIB, 1 );
+      Ast_addChild( atrib, Bench_var( prefix, u % BENCH_LOCALS ) );
+      Ast_addChild( atrib, sum );
+      Ast_addChild( block, atrib );
+      (*nUses) += 3; // Duas leituras e uma escrita
+   }
+
+   if ( level + 1 < depth )
+   {
+      Ast* cmdIf = Ast_new( AST_CMD_IF, 1 );
+      Ast_addChild( cmdIf, Ast_new( AST_TRUE, 1 ) );
+      Ast_addChild( cmdIf, Bench_block( level + 1, depth, nGlobals, nUses ) );
+      Ast_addChild( block, cmdIf );
+   }
+   return block;
+}
+
+
+
+static double Bench_now()
+{
+   struct timespec t;
+   clock_gettime( CLOCK_MONOTONIC, &t );
+   return t.tv_sec + 1e-9 * t.tv_nsec;
+}
@@ -0,0 +1,556 @@
+/**
+ * @file    lower.c
+ * @author  lhpelosi
+ */
+
+#include "lower.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct binding Binding;
+typedef struct lowering Lowering;
+
+// Variavel declarada visivel no escopo atual e o endereco que ela recebeu
+struct binding
+{
+   char* name;
+   Addr addr;
+   Binding* nextBinding;
+};
+
+struct lowering
+{
+   IR* ir;
+   Function* function;
+   // Ultima instrucao da funcao, onde as novas sao ligadas
+   Instr* lastInstr;
+   // Declaracoes visiveis, da mais interna para a mais externa
+   Binding* bindings;
+   // Linha do comando sendo traduzido
+   int line;
+   int nStrings;
+};
+
+static void Lower_globals( Lowering* lowering, Ast* program );
+static void Lower_fun( Lowering* lowering, Ast* fun );
+static void Lower_block( Lowering* lowering, Ast* block );
+static void Lower_cmdIf( Lowering* lowering, Ast* cmdIf );
+static void Lower_cmdWhile( Lowering* lowering, Ast* cmdWhile );
+static void Lower_cmdAtrib( Lowering* lowering, Ast* cmdAtrib );
+static void Lower_cmdReturn( Lowering* lowering, Ast* cmdReturn );
+static void Lower_call( Lowering* lowering, Ast* call );
+static Addr Lower_exp( Lowering* lowering, Ast* exp );
+static Addr Lower_operand( Lowering* lowering, Ast* exp, Ast* nextExp );
+static Addr Lower_var( Lowering* lowering, Ast* var, Ast* lastIndexer );
+static Addr Lower_string( Lowering* lowering, Ast* string );
+static void Lower_jump( Lowering* lowering, Ast* exp, int jumpIf, Addr label );
+
+static void Lower_emit( Lowering* lowering, Instr* instr );
+static Addr Lower_declare( Lowering* lowering, char* name );
+static Addr Lower_lookup( Lowering* lowering, char* name );
+static int Lower_isLeaf( Ast* exp );
+static Opcode Lower_opcode( AstType type );
+
+
+
+IR* Lower_program( Ast* program )
+{
+   Lowering lowering;
+   lowering.ir = IR_new();
+   lowering.function = NULL;
+   lowering.lastInstr = NULL;
+   lowering.bindings = NULL;
+   lowering.line = 0;
+   lowering.nStrings = 0;
+
+   // Globais primeiro, para que os locais de mesmo nome sejam renomeados
+   Lower_globals( &lowering, program );
+
+   Ast* child;
+   for ( child = Ast_firstChild( program ) ; child != NULL ; child = Ast_nextSibling( child ) )
+   {
+      if ( child->type == AST_FUN )
+         Lower_fun( &lowering, child );
+   }
+   return lowering.ir;
+}
+
+
+
+void Lower_globals( Lowering* lowering, Ast* program )
+{
+   Variable* globals = NULL;
+   Ast* child;
+   for ( child = Ast_firstChild( program ) ; child != NULL ; child = Ast_nextSibling( child ) )
+   {
+      if ( child->type == AST_DECLVAR )
+         globals = Variable_link( globals, Variable_new( Ast_sval( Ast_firstChild( child ) ) ) );
+   }
+   IR_setGlobals( lowering->ir, globals );
+}
+
+
+
+void Lower_fun( Lowering* lowering, Ast* fun )
+{
+   Ast* params = Ast_nextSibling( Ast_firstChild( fun ) );
+   Ast* block = Ast_nextSibling( params );
+   Ast* param;
+
+   // Os parametros sao os primeiros locais
+   Variable* args = NULL;
+   for ( param = Ast_firstChild( params ) ; param != NULL ; param = Ast_nextSibling( param ) )
+      args = Variable_link( args, Variable_new( Ast_sval( Ast_firstChild( param ) ) ) );
+
+   lowering->function = Function_new( Ast_sval( Ast_firstChild( fun ) ), args );
+   lowering->lastInstr = NULL;
+   lowering->bindings = NULL;
+   lowering->line = fun->line;
+   for ( param = Ast_firstChild( params ) ; param != NULL ; param = Ast_nextSibling( param ) )
+      Lower_declare( lowering, Ast_sval( Ast_firstChild( param ) ) );
+
+   Lower_block( lowering, block );
+
+   // Funcao que termina sem return; as que tem tipo devolvem 0
+   if ( lowering->lastInstr == NULL || ( lowering->lastInstr->op != OP_RET && lowering->lastInstr->op != OP_RET_VAL ) )
+   {
+      if ( fun->dataType == TYPE_VOID )
+         Lower_emit( lowering, Instr_new( OP_RET ) );
+      else
+         Lower_emit( lowering, Instr_new( OP_RET_VAL, Addr_litNum( 0 ) ) );
+   }
+
+   IR_addFunction( lowering->ir, lowering->function );
+}
+
+
+
+void Lower_block( Lowering* lowering, Ast* block )
+{
+   Binding* outerBindings = lowering->bindings;
+   Ast* node;
+   for ( node = Ast_firstChild( block ) ; node != NULL ; node = Ast_nextSibling( node ) )
+   {
+      lowering->line = node->line;
+      switch ( node->type )
+      {
+         case AST_DECLVAR :
+            Lower_declare( lowering, Ast_sval( Ast_firstChild( node ) ) );
+            break;
+         case AST_CMD_IF :
+            Lower_cmdIf( lowering, node );
+            break;
+         case AST_CMD_WHILE :
+            Lower_cmdWhile( lowering, node );
+            break;
+         case AST_CMD_ATRIB :
+            Lower_cmdAtrib( lowering, node );
+            break;
+         case AST_CMD_RETURN :
+            Lower_cmdReturn( lowering, node );
+            break;
+         case AST_CALL :
+            Lower_call( lowering, node );
+            break;
+         default:
+            break;
+      }
+   }
+
+   // Fim do escopo; os locais continuam na funcao e podem ser reaproveitados
+   while ( lowering->bindings != outerBindings )
+   {
+      Binding* binding = lowering->bindings;
+      lowering->bindings = binding->nextBinding;
+      free( binding );
+   }
+}
+
+
+
+void Lower_cmdIf( Lowering* lowering, Ast* cmdIf )
+{
+   Addr end = Addr_newLabel();
+   Ast* node = Ast_firstChild( cmdIf );
+   while ( node != NULL )
+   {
+      // else final
+      if ( node->type == AST_BLOCK )
+      {
+         Lower_block( lowering, node );
+         break;
+      }
+
+      Ast* block = Ast_nextSibling( node );
+      Addr next = Addr_newLabel();
+      lowering->line = node->line;
+      Lower_jump( lowering, node, 0, next );
+      Lower_block( lowering, block );
+      if ( Ast_nextSibling( block ) != NULL )
+         Lower_emit( lowering, Instr_new( OP_GOTO, end ) );
+      Lower_emit( lowering, Instr_new( OP_LABEL, next ) );
+      node = Ast_nextSibling( block );
+   }
+   Lower_emit( lowering, Instr_new( OP_LABEL, end ) );
+}
+
+
+
+void Lower_cmdWhile( Lowering* lowering, Ast* cmdWhile )
+{
+   Ast* exp = Ast_firstChild( cmdWhile );
+   Ast* block = Ast_nextSibling( exp );
+   Addr body = Addr_newLabel();
+   Addr exit = Addr_newLabel();
+
+   // Laco rodado: o teste de entrada e repetido no fim, e cada volta
+   // custa um unico desvio condicional em vez de um condicional e um goto
+   Lower_jump( lowering, exp, 0, exit );
+   Lower_emit( lowering, Instr_new( OP_LABEL, body ) );
+   Lower_block( lowering, block );
+   lowering->line = cmdWhile->line;
+   Lower_jump( lowering, exp, 1, body );
+   Lower_emit( lowering, Instr_new( OP_LABEL, exit ) );
+}
+
+
+
+void Lower_cmdAtrib( Lowering* lowering, Ast* cmdAtrib )
+{
+   Ast* var = Ast_firstChild( cmdAtrib );
+   Ast* exp = Ast_nextSibling( var );
+   Ast* lastIndexer = Ast_lastChild( var );
+   if ( lastIndexer == Ast_firstChild( var ) ) lastIndexer = NULL;
+
+   // Atribuicao simples
+   if ( lastIndexer == NULL )
+   {
+      Addr value = Lower_exp( lowering, exp );
+      Lower_emit( lowering, Instr_new( OP_SET, Lower_lookup( lowering, Ast_sval( Ast_firstChild( var ) ) ), value ) );
+      return;
+   }
+
+   // Atribuicao a elemento: v[i]...[k] = exp indexa ate o penultimo
+   Addr base = Lower_var( lowering, var, lastIndexer );
+   Addr index = Lower_operand( lowering, lastIndexer, exp );
+   Addr value = Lower_exp( lowering, exp );
+   Lower_emit( lowering, Instr_new( OP_IDX_SET, base, index, value ) );
+}
+
+
+
+void Lower_cmdReturn( Lowering* lowering, Ast* cmdReturn )
+{
+   if ( Ast_firstChild( cmdReturn ) == NULL )
+      Lower_emit( lowering, Instr_new( OP_RET ) );
+   else
+      Lower_emit( lowering, Instr_new( OP_RET_VAL, Lower_exp( lowering, Ast_firstChild( cmdReturn ) ) ) );
+}
+
+
+
+void Lower_call( Lowering* lowering, Ast* call )
+{
+   Ast* arg;
+   int nArgs = 0;
+   for ( arg = Ast_nextSibling( Ast_firstChild( call ) ) ; arg != NULL ; arg = Ast_nextSibling( arg ) )
+      nArgs++;
+
+   // Os argumentos sao calculados antes, pois os params devem vir
+   // imediatamente antes do call
+   Addr* values = (Addr*) malloc( ( nArgs + 1 ) * sizeof( Addr ) );
+   int i = 0;
+   for ( arg = Ast_nextSibling( Ast_firstChild( call ) ) ; arg != NULL ; arg = Ast_nextSibling( arg ) )
+      values[i++] = Lower_operand( lowering, arg, Ast_nextSibling( arg ) );
+
+   // Empilhados do ultimo para o primeiro argumento
+   for ( i = nArgs-1 ; i >= 0 ; i-- )
+      Lower_emit( lowering, Instr_new( OP_PARAM, values[i] ) );
+   Lower_emit( lowering, Instr_new( OP_CALL, Addr_function( Ast_sval( Ast_firstChild( call ) ) ), Addr_litNum( nArgs ) ) );
+   free( values );
+}
+
+
+
+Addr Lower_exp( Lowering* lowering, Ast* exp )
+{
+   Addr result;
+   Addr left;
+   Addr right;
+
+   switch ( exp->type )
+   {
+      case AST_VALINT:
+         return Addr_litNum( exp->ival );
+
+      case AST_TRUE:
+         return Addr_litNum( 1 );
+
+      case AST_FALSE:
+         return Addr_litNum( 0 );
+
+      case AST_VALSTRING:
+         return Lower_string( lowering, exp );
+
+      case AST_VAR:
+         return Lower_var( lowering, exp, NULL );
+
+      case AST_CALL:
+         Lower_call( lowering, exp );
+         // Copia, pois a proxima chamada sobrescreve $ret
+         result = Function_newTemp( lowering->function );
+         Lower_emit( lowering, Instr_new( OP_SET, result, Addr_resolve( strdup( "$ret" ), lowering->ir, lowering->function ) ) );
+         return result;
+
+      case AST_EXP_NEW:
+         left = Lower_exp( lowering, Ast_firstChild( exp ) );
+         result = Function_newTemp( lowering->function );
+         Lower_emit( lowering, Instr_new( OP_NEW, result, left ) );
+         return result;
+
+      case AST_EXP_NEG:
+         left = Lower_exp( lowering, Ast_firstChild( exp ) );
+         result = Function_newTemp( lowering->function );
+         Lower_emit( lowering, Instr_new( OP_NEG, result, left ) );
+         return result;
+
+      case AST_EXP_NOT:
+         left = Lower_exp( lowering, Ast_firstChild( exp ) );
+         result = Function_newTemp( lowering->function );
+         Lower_emit( lowering, Instr_new( OP_EQ, result, left, Addr_litNum( 0 ) ) );
+         return result;
+
+      case AST_EXP_AND:
+      case AST_EXP_OR:
+      {
+         // Valor booleano de uma expressao em curto-circuito
+         Addr end = Addr_newLabel();
+         result = Function_newTemp( lowering->function );
+         Lower_emit( lowering, Instr_new( OP_SET, result, Addr_litNum( 0 ) ) );
+         Lower_jump( lowering, exp, 0, end );
+         Lower_emit( lowering, Instr_new( OP_SET, result, Addr_litNum( 1 ) ) );
+         Lower_emit( lowering, Instr_new( OP_LABEL, end ) );
+         return result;
+      }
+
+      default:
+         left = Lower_operand( lowering, Ast_firstChild( exp ), Ast_nextSibling( Ast_firstChild( exp ) ) );
+         right = Lower_exp( lowering, Ast_nextSibling( Ast_firstChild( exp ) ) );
+         result = Function_newTemp( lowering->function );
+         Lower_emit( lowering, Instr_new( Lower_opcode( exp->type ), result, left, right ) );
+         return result;
+   }
+}
+
+
+
+// Calcula exp antes de nextExp; um global lido e copiado se nextExp
+// tiver chamadas que possam altera-lo
+Addr Lower_operand( Lowering* lowering, Ast* exp, Ast* nextExp )
+{
+   Addr value = Lower_exp( lowering, exp );
+   if ( value.type == AD_GLOBAL && nextExp != NULL && !Lower_isLeaf( nextExp ) )
+   {
+      Addr copy = Function_newTemp( lowering->function );
+      Lower_emit( lowering, Instr_new( OP_SET, copy, value ) );
+      return copy;
+   }
+   return value;
+}
+
+
+
+// Le v[i][j]... ate o indice anterior a stop (NULL para todos)
+Addr Lower_var( Lowering* lowering, Ast* var, Ast* stop )
+{
+   Addr base = Lower_lookup( lowering, Ast_sval( Ast_firstChild( var ) ) );
+   Ast* indexer;
+   for ( indexer = Ast_nextSibling( Ast_firstChild( var ) ) ; indexer != stop ; indexer = Ast_nextSibling( indexer ) )
+   {
+      Addr index = Lower_exp( lowering, indexer );
+      Addr element = Function_newTemp( lowering->function );
+      Lower_emit( lowering, Instr_new( OP_SET_IDX, element, base, index ) );
+      base = element;
+   }
+   return base;
+}
+
+
+
+// Strings sao vetores de int (ver Sym_visitExp); o literal vai para
+// .data e e copiado para um vetor novo a cada avaliacao
+Addr Lower_string( Lowering* lowering, Ast* string )
+{
+   int length = strlen( Ast_sval( string ) );
+   char* name = (char*) malloc( 24 );
+   char* value = (char*) malloc( 2 * length + 3 );
+   char* c = value;
+   int i;
+
+   snprintf( name, 24, ".LStr_%d", lowering->nStrings );
+   *c++ = '"';
+   for ( i = 0 ; i < length ; i++ )
+   {
+      switch ( Ast_sval( string )[i] )
+      {
+         case '\n': *c++ = '\\'; *c++ = 'n'; break;
+         case '\t': *c++ = '\\'; *c++ = 't'; break;
+         case '\\': *c++ = '\\'; *c++ = '\\'; break;
+         case '"': *c++ = '\\'; *c++ = '"'; break;
+         default: *c++ = Ast_sval( string )[i];
+      }
+   }
+   *c++ = '"';
+   *c = '\0';
+   lowering->ir->strings = String_link( lowering->ir->strings, String_new( name, value ) );
+
+   Addr data;
+   data.type = AD_STRING;
+   data.str = name;
+   data.num = lowering->nStrings++;
+
+   // Copia ate o terminador inclusive
+   Addr array = Function_newTemp( lowering->function );
+   Addr index = Function_newTemp( lowering->function );
+   Addr character = Function_newTemp( lowering->function );
+   Addr loop = Addr_newLabel();
+   Lower_emit( lowering, Instr_new( OP_NEW, array, Addr_litNum( length + 1 ) ) );
+   Lower_emit( lowering, Instr_new( OP_SET, index, Addr_litNum( 0 ) ) );
+   Lower_emit( lowering, Instr_new( OP_LABEL, loop ) );
+   Lower_emit( lowering, Instr_new( OP_SET_IDX_BYTE, character, data, index ) );
+   Lower_emit( lowering, Instr_new( OP_IDX_SET, array, index, character ) );
+   Lower_emit( lowering, Instr_new( OP_ADD, index, index, Addr_litNum( 1 ) ) );
+   Lower_emit( lowering, Instr_new( OP_IF, character, loop ) );
+   return array;
+}
+
+
+
+// Desvia para label se exp for igual a jumpIf, senao segue em frente.
+// and e or nunca calculam o lado direito sem necessidade.
+void Lower_jump( Lowering* lowering, Ast* exp, int jumpIf, Addr label )
+{
+   Addr skip;
+   switch ( exp->type )
+   {
+      case AST_TRUE:
+      case AST_FALSE:
+         if ( ( exp->type == AST_TRUE ) == jumpIf )
+            Lower_emit( lowering, Instr_new( OP_GOTO, label ) );
+         break;
+
+      case AST_EXP_NOT:
+         Lower_jump( lowering, Ast_firstChild( exp ), !jumpIf, label );
+         break;
+
+      case AST_EXP_AND:
+      case AST_EXP_OR:
+         // and desviando se falso e or desviando se verdadeiro: qualquer lado decide
+         if ( ( exp->type == AST_EXP_AND ) != jumpIf )
+         {
+            Lower_jump( lowering, Ast_firstChild( exp ), jumpIf, label );
+            Lower_jump( lowering, Ast_nextSibling( Ast_firstChild( exp ) ), jumpIf, label );
+         }
+         // Senao o lado esquerdo pode encerrar sem desviar
+         else
+         {
+            skip = Addr_newLabel();
+            Lower_jump( lowering, Ast_firstChild( exp ), !jumpIf, skip );
+            Lower_jump( lowering, Ast_nextSibling( Ast_firstChild( exp ) ), jumpIf, label );
+            Lower_emit( lowering, Instr_new( OP_LABEL, skip ) );
+         }
+         break;
+
+      default:
+         Lower_emit( lowering, Instr_new( jumpIf ? OP_IF : OP_IF_FALSE, Lower_exp( lowering, exp ), label ) );
+         break;
+   }
+}
+
+
+
+void Lower_emit( Lowering* lowering, Instr* instr )
+{
+   instr->line = lowering->line;
+   if ( lowering->lastInstr == NULL )
+      lowering->function->code = instr;
+   else
+      lowering->lastInstr->next = instr;
+   lowering->lastInstr = instr;
+}
+
+
+
+Addr Lower_declare( Lowering* lowering, char* name )
+{
+   // Um global ou uma declaracao ainda visivel com o mesmo nome exige um local novo
+   Addr addr = Addr_resolve( name, lowering->ir, lowering->function );
+   Binding* binding;
+   for ( binding = lowering->bindings ; binding != NULL ; binding = binding->nextBinding )
+   {
+      if ( strcmp( binding->name, name ) == 0 ) break;
+   }
+   if ( addr.type != AD_LOCAL || binding != NULL )
+      addr = Function_newLocal( lowering->function, name );
+
+   binding = (Binding*) malloc( sizeof( Binding ) );
+   binding->name = name;
+   binding->addr = addr;
+   binding->nextBinding = lowering->bindings;
+   lowering->bindings = binding;
+   return addr;
+}
+
+
+
+Addr Lower_lookup( Lowering* lowering, char* name )
+{
+   Binding* binding;
+   for ( binding = lowering->bindings ; binding != NULL ; binding = binding->nextBinding )
+   {
+      if ( strcmp( binding->name, name ) == 0 ) return binding->addr;
+   }
+   // Global, ja verificado por Sym_annotate
+   return Addr_resolve( name, lowering->ir, lowering->function );
+}
+
+
+
+// Expressoes que nao executam chamadas
+int Lower_isLeaf( Ast* exp )
+{
+   switch ( exp->type )
+   {
+      case AST_VALINT:
+      case AST_TRUE:
+      case AST_FALSE:
+      case AST_VALSTRING:
+         return 1;
+      case AST_VAR:
+         return Ast_nextSibling( Ast_firstChild( exp ) ) == NULL;
+      default:
+         return 0;
+   }
+}
+
+
+
+Opcode Lower_opcode( AstType type )
+{
+   switch ( type )
+   {
+      case AST_EXP_EQ : return OP_EQ;
+      case AST_EXP_UNEQ : return OP_NE;
+      case AST_EXP_L : return OP_LT;
+      case AST_EXP_G : return OP_GT;
+      case AST_EXP_LEQ : return OP_LE;
+      case AST_EXP_GEQ : return OP_GE;
+      case AST_EXP_ADD : return OP_ADD;
+      case AST_EXP_SUB : return OP_SUB;
+      case AST_EXP_MULT : return OP_MUL;
+      case AST_EXP_DIV : return OP_DIV;
+      default : return OP_ADD;
+   }
+}
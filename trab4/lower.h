@@ -0,0 +1,20 @@
+/**
+ * @file    lower.h
+ * @author  lhpelosi
+ */
+
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "ast.h"
+#include "ir.h"
+
+/**
+ * Traduz a arvore anotada por Sym_annotate para o codigo intermediario
+ * do backend (trab6), em memoria, sem passar pelo texto .m0.ir
+ * @param program A arvore sintatica abstrata do programa, sem erros de tipo
+ * @return O programa em codigo intermediario, pronto para Pass_run e Asm_write
+ */
+IR* Lower_program( Ast* program );
+
+#endif
@@ -7,12 +7,19 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "ast.h"
 
+#define SYM_INITIAL_BUCKETS 256
+#define SYM_INITIAL_SCOPES 16
+#define SYM_ARENA_SIZE ( 64 * 1024 )
+
 static SymbolTable* Sym_newSymbolTable();
 static void Sym_delete( SymbolTable* table );
-static void Sym_deleteScope( Scope* scope );
-static void Sym_deleteSymbol( Symbol* symbol );
+static void* Sym_alloc( SymbolTable* table, int size );
+static unsigned int Sym_hash( const char* name );
+static SymbolName* Sym_intern( SymbolTable* table, char* name, int isInsert );
+static void Sym_rehash( SymbolTable* table );
 static void Sym_addSymbol( SymbolTable* table, char* name, DataType type, int nReferences, int line );
 static Symbol* Sym_getSymbol( SymbolTable* table, char* name, int isScopeSearch );
 static void Sym_beginScope( SymbolTable* table );
@@ -40,7 +47,9 @@ static void Sym_fail( const char* message, char* name, Ast* node );
 int Sym_annotate( Ast* program )
 {
    SymbolTable* table = Sym_newSymbolTable();
-   return Sym_visitProgram( table, program );
+   int errors = Sym_visitProgram( table, program );
+   Sym_delete( table );
+   return errors;
 }
 
 
@@ -48,9 +57,15 @@ int Sym_annotate( Ast* program )
 SymbolTable* Sym_newSymbolTable()
 {
    SymbolTable* table = (SymbolTable*) malloc( sizeof( SymbolTable ) );
-   table->innerScope = (Scope*) malloc( sizeof( Scope ) );
-   table->innerScope->symbolList = NULL;
-   table->innerScope->nextScope = NULL;
+   table->nBuckets = SYM_INITIAL_BUCKETS;
+   table->buckets = (SymbolName**) calloc( table->nBuckets, sizeof( SymbolName* ) );
+   table->nNames = 0;
+   table->nScopes = SYM_INITIAL_SCOPES;
+   table->scopes = (Symbol**) malloc( table->nScopes * sizeof( Symbol* ) );
+   table->scopes[0] = NULL;
+   table->depth = 0;
+   table->arena = NULL;
+   table->function = NULL;
    return table;
 }
 
@@ -58,26 +73,99 @@ SymbolTable* Sym_newSymbolTable()
 
 void Sym_delete( SymbolTable* table )
 {
-   // Destroi somente a tabela, nao os simbolos
+   // Os nomes pertencem a AST; simbolos e entradas estao nas arenas
    if ( table == NULL ) return;
-   Sym_deleteScope( table->innerScope );
+   while ( table->arena != NULL )
+   {
+      SymbolArena* arena = table->arena;
+      table->arena = arena->nextArena;
+      free( arena->data );
+      free( arena );
+   }
+   free( table->buckets );
+   free( table->scopes );
    free( table );
 }
 
 
 
-void Sym_deleteScope( Scope* scope )
+void* Sym_alloc( SymbolTable* table, int size )
+{
+   SymbolArena* arena = table->arena;
+   size = ( size + sizeof( void* ) - 1 ) & ~( sizeof( void* ) - 1 );
+   if ( arena == NULL || arena->used + size > arena->size )
+   {
+      arena = (SymbolArena*) malloc( sizeof( SymbolArena ) );
+      arena->size = ( size > SYM_ARENA_SIZE ) ? size : SYM_ARENA_SIZE;
+      arena->data = (char*) malloc( arena->size );
+      arena->used = 0;
+      arena->nextArena = table->arena;
+      table->arena = arena;
+   }
+   void* p = arena->data + arena->used;
+   arena->used += size;
+   return p;
+}
+
+
+
+// FNV-1a
+unsigned int Sym_hash( const char* name )
+{
+   unsigned int hash = 2166136261u;
+   while ( *name )
+   {
+      hash ^= (unsigned char) *name++;
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+
+
+SymbolName* Sym_intern( SymbolTable* table, char* name, int isInsert )
 {
-   if ( scope == NULL ) return;
-   free( scope );
+   unsigned int hash = Sym_hash( name );
+   SymbolName* entry;
+   for ( entry = table->buckets[ hash & ( table->nBuckets - 1 ) ] ; entry != NULL ; entry = entry->nextName )
+   {
+      if ( entry->name == name || ( entry->hash == hash && strcmp( entry->name, name ) == 0 ) ) return entry;
+   }
+   if ( !isInsert ) return NULL;
+
+   if ( table->nNames >= table->nBuckets )
+      Sym_rehash( table );
+   entry = (SymbolName*) Sym_alloc( table, sizeof( SymbolName ) );
+   entry->name = name;
+   entry->hash = hash;
+   entry->symbol = NULL;
+   entry->nextName = table->buckets[ hash & ( table->nBuckets - 1 ) ];
+   table->buckets[ hash & ( table->nBuckets - 1 ) ] = entry;
+   table->nNames++;
+   return entry;
 }
 
 
 
-void Sym_deleteSymbol( Symbol* symbol )
+void Sym_rehash( SymbolTable* table )
 {
-   free( symbol->name );
-   free( symbol );
+   int nBuckets = 2 * table->nBuckets;
+   SymbolName** buckets = (SymbolName**) calloc( nBuckets, sizeof( SymbolName* ) );
+   int i;
+   for ( i = 0 ; i < table->nBuckets ; i++ )
+   {
+      SymbolName* entry = table->buckets[i];
+      while ( entry != NULL )
+      {
+         SymbolName* next = entry->nextName;
+         entry->nextName = buckets[ entry->hash & ( nBuckets - 1 ) ];
+         buckets[ entry->hash & ( nBuckets - 1 ) ] = entry;
+         entry = next;
+      }
+   }
+   free( table->buckets );
+   table->buckets = buckets;
+   table->nBuckets = nBuckets;
 }
 
 
@@ -85,57 +173,61 @@ void Sym_deleteSymbol( Symbol* symbol )
 void Sym_addSymbol( SymbolTable* table, char* name, DataType type, int nReferences, int line )
 {
    // Inicializa
-   Symbol* newSymbol = (Symbol*) malloc( sizeof( Symbol ) );
-   newSymbol->name = name;
+   SymbolName* entry = Sym_intern( table, name, 1 );
+   Symbol* newSymbol = (Symbol*) Sym_alloc( table, sizeof( Symbol ) );
+   newSymbol->name = entry->name;
    newSymbol->type = type;
    newSymbol->nReferences = nReferences;
    newSymbol->line = line;
+   newSymbol->depth = table->depth;
+   newSymbol->entry = entry;
+
+   // Esconde a declaracao anterior do nome ate o fim do escopo
+   newSymbol->shadowed = entry->symbol;
+   entry->symbol = newSymbol;
 
-   // Acrescenta na tabela
-   newSymbol->nextSymbol = table->innerScope->symbolList;
-   table->innerScope->symbolList = newSymbol;
+   // Acrescenta no escopo atual
+   newSymbol->nextSymbol = table->scopes[ table->depth ];
+   table->scopes[ table->depth ] = newSymbol;
 }
 
 
 
 Symbol* Sym_getSymbol( SymbolTable* table, char* name, int isScopeSearch )
 {
-   Scope* scope;
-   Symbol* symbol;
-
    if ( table == NULL ) return NULL;
 
-   for ( scope = table->innerScope ; scope != NULL ; scope = scope->nextScope )
-   {
-      for ( symbol = scope->symbolList ; symbol != NULL ; symbol = symbol->nextSymbol )
-      {
-         if ( strcmp( symbol->name, name ) == 0 ) return symbol;
-      }
+   SymbolName* entry = Sym_intern( table, name, 0 );
+   if ( entry == NULL || entry->symbol == NULL ) return NULL;
 
-      // Caso esteja procurando apenas no escopo interno, pode parar
-      if ( isScopeSearch ) return NULL;
-   }
+   // Caso esteja procurando apenas no escopo interno, a declaracao visivel tem que ser dele
+   if ( isScopeSearch && entry->symbol->depth != table->depth ) return NULL;
 
-   return NULL;
+   return entry->symbol;
 }
 
 
 
 void Sym_beginScope( SymbolTable* table )
 {
-   Scope* newScope = (Scope*) malloc( sizeof( Scope ) );
-   newScope->symbolList = NULL;
-   newScope->nextScope = table->innerScope;
-   table->innerScope = newScope;
+   table->depth++;
+   if ( table->depth == table->nScopes )
+   {
+      table->nScopes *= 2;
+      table->scopes = (Symbol**) realloc( table->scopes, table->nScopes * sizeof( Symbol* ) );
+   }
+   table->scopes[ table->depth ] = NULL;
 }
 
 
 
 void Sym_endScope( SymbolTable* table )
 {
-   Scope* scope = table->innerScope;
-   table->innerScope = table->innerScope->nextScope;
-   Sym_deleteScope( scope );
+   // Volta a mostrar o que as declaracoes do escopo escondiam
+   Symbol* symbol;
+   for ( symbol = table->scopes[ table->depth ] ; symbol != NULL ; symbol = symbol->nextSymbol )
+      symbol->entry->symbol = symbol->shadowed;
+   table->depth--;
 }
 
 
@@ -144,7 +236,7 @@ int Sym_visitProgram( SymbolTable* table, Ast* program )
 {
    Ast* child;
    int errors = 0;
-   for ( child = program->firstChild ; child != NULL ; child = child->nextSibling )
+   for ( child = Ast_firstChild( program ) ; child != NULL ; child = Ast_nextSibling( child ) )
    {
       if ( child->type == AST_FUN )
       {
@@ -163,7 +255,7 @@ int Sym_visitProgram( SymbolTable* table, Ast* program )
 int Sym_visitFun( SymbolTable* table, Ast* fun )
 {
    int errors = 0;
-   char* name = fun->firstChild->sval;
+   char* name = Ast_sval( Ast_firstChild( fun ) );
    // Verifica se o simbolo ja existe no escopo
    Symbol* symbol = Sym_getSymbol( table, name, 1 );
    if ( symbol != NULL )
@@ -173,7 +265,7 @@ int Sym_visitFun( SymbolTable* table, Ast* fun )
    }
    else
    {
-      Ast* typeNode = fun->firstChild->nextSibling->nextSibling->nextSibling;
+      Ast* typeNode = Ast_nextSibling( Ast_nextSibling( Ast_nextSibling( Ast_firstChild( fun ) ) ) );
       int nReferences = 0;
       DataType symbolType;
       if ( typeNode == NULL )
@@ -189,16 +281,17 @@ int Sym_visitFun( SymbolTable* table, Ast* fun )
       fun->dataType = symbolType;
       fun->nReferences = nReferences;
 
+      table->function = fun;
       Sym_beginScope( table );
       // Visita os parametros
-      Ast* parameter = fun->firstChild->nextSibling->firstChild;
+      Ast* parameter = Ast_firstChild( Ast_nextSibling( Ast_firstChild( fun ) ) );
       while ( parameter != NULL )
       {
          errors += Sym_visitDeclvar( table, parameter );
-         parameter = parameter->nextSibling;
+         parameter = Ast_nextSibling( parameter );
       }
       // Visita o bloco
-      errors += Sym_visitBlock( table, fun->firstChild->nextSibling->nextSibling );
+      errors += Sym_visitBlock( table, Ast_nextSibling( Ast_nextSibling( Ast_firstChild( fun ) ) ) );
       Sym_endScope( table );
 
       return errors;
@@ -209,7 +302,7 @@ int Sym_visitFun( SymbolTable* table, Ast* fun )
 
 int Sym_visitDeclvar( SymbolTable* table, Ast* declvar )
 {
-   char* name = declvar->firstChild->sval;
+   char* name = Ast_sval( Ast_firstChild( declvar ) );
    // Verifica se o simbolo ja existe no escopo
    Symbol* symbol = Sym_getSymbol( table, name, 1 );
    if ( symbol != NULL )
@@ -220,7 +313,7 @@ int Sym_visitDeclvar( SymbolTable* table, Ast* declvar )
    else
    {
       DataType dataType;
-      Ast* typeNode = declvar->firstChild->nextSibling;
+      Ast* typeNode = Ast_nextSibling( Ast_firstChild( declvar ) );
       int nReferences = Sym_getDataType( typeNode, &dataType );
 
       Sym_addSymbol( table, name, dataType, nReferences, declvar->line );
@@ -235,7 +328,7 @@ int Sym_visitDeclvar( SymbolTable* table, Ast* declvar )
 int Sym_visitBlock( SymbolTable* table, Ast* block )
 {
    int errors = 0;
-   Ast* node = block->firstChild;
+   Ast* node = Ast_firstChild( block );
    while ( node != NULL )
    {
       switch ( node->type )
@@ -261,7 +354,7 @@ int Sym_visitBlock( SymbolTable* table, Ast* block )
          default:
             break;
       }
-      node = node->nextSibling;
+      node = Ast_nextSibling( node );
    }
    return errors;
 }
@@ -271,23 +364,23 @@ int Sym_visitBlock( SymbolTable* table, Ast* block )
 int Sym_visitVar( SymbolTable* table, Ast* var )
 {
    int errors = 0;
-   char* name = var->firstChild->sval;
+   char* name = Ast_sval( Ast_firstChild( var ) );
    Symbol* symbol = Sym_getSymbol( table, name, 0 );
    if ( symbol == NULL )
    {
-      Sym_fail( "Simbolo nao declarado.", name, var->firstChild );
+      Sym_fail( "Simbolo nao declarado.", name, Ast_firstChild( var ) );
       return 1;
    }
    var->dataType = symbol->type;
    var->nReferences = symbol->nReferences;
 
-   Ast* indexer = var->firstChild->nextSibling;
+   Ast* indexer = Ast_nextSibling( Ast_firstChild( var ) );
    while( indexer != NULL )
    {
       errors += Sym_visitExp( table, indexer );
       errors += Sym_checkDataType( indexer, TYPE_INT, 0 );
       (var->nReferences)--; // Pois a indexacao faz 'perder' uma referencia
-      indexer = indexer->nextSibling;
+      indexer = Ast_nextSibling( indexer );
    }
 
    return errors;
@@ -298,7 +391,7 @@ int Sym_visitVar( SymbolTable* table, Ast* var )
 int Sym_visitCmdIf( SymbolTable* table, Ast* cmdIf )
 {
    int errors = 0;
-   Ast* node = cmdIf->firstChild;
+   Ast* node = Ast_firstChild( cmdIf );
    while ( node != NULL )
    {
       if ( node->type == AST_BLOCK )
@@ -312,7 +405,7 @@ int Sym_visitCmdIf( SymbolTable* table, Ast* cmdIf )
          errors += Sym_visitExp( table, node );
          errors += Sym_checkDataType( node, TYPE_BOOL, 0 );
       }
-      node = node->nextSibling;
+      node = Ast_nextSibling( node );
    }
    return errors;
 }
@@ -322,8 +415,8 @@ int Sym_visitCmdIf( SymbolTable* table, Ast* cmdIf )
 int Sym_visitCmdWhile( SymbolTable* table, Ast* cmdWhile )
 {
    int errors = 0;
-   Ast* exp = cmdWhile->firstChild;
-   Ast* block = cmdWhile->firstChild->nextSibling;
+   Ast* exp = Ast_firstChild( cmdWhile );
+   Ast* block = Ast_nextSibling( Ast_firstChild( cmdWhile ) );
 
    errors += Sym_visitExp( table, exp );
    errors += Sym_checkDataType( exp, TYPE_BOOL, 0 );
@@ -340,8 +433,8 @@ int Sym_visitCmdWhile( SymbolTable* table, Ast* cmdWhile )
 int Sym_visitCmdAtrib( SymbolTable* table, Ast* cmdAtrib )
 {
    int errors = 0;
-   Ast* left = cmdAtrib->firstChild;
-   Ast* right = cmdAtrib->firstChild->nextSibling;
+   Ast* left = Ast_firstChild( cmdAtrib );
+   Ast* right = Ast_nextSibling( Ast_firstChild( cmdAtrib ) );
 
    errors += Sym_visitVar( table, left );
    errors += Sym_visitExp( table, right );
@@ -357,21 +450,19 @@ int Sym_visitCmdReturn( SymbolTable* table, Ast* cmdReturn )
 {
    int errors = 0;
 
-   Ast* parentFunction = cmdReturn;
-   while ( parentFunction->type != AST_FUN )
-      parentFunction = parentFunction->parent;
+   Ast* parentFunction = table->function;
 
    // Return simples
-   if ( cmdReturn->firstChild == NULL )
+   if ( Ast_firstChild( cmdReturn ) == NULL )
    {
       cmdReturn->dataType = TYPE_VOID;
    }
    // Return com expressao
    else
    {
-      errors += Sym_visitExp( table, cmdReturn->firstChild );
-      cmdReturn->dataType = cmdReturn->firstChild->dataType;
-      cmdReturn->nReferences = cmdReturn->firstChild->nReferences;
+      errors += Sym_visitExp( table, Ast_firstChild( cmdReturn ) );
+      cmdReturn->dataType = Ast_firstChild( cmdReturn )->dataType;
+      cmdReturn->nReferences = Ast_firstChild( cmdReturn )->nReferences;
    }
 
    errors += Sym_matchDataType( cmdReturn, parentFunction );
@@ -383,7 +474,7 @@ int Sym_visitCmdReturn( SymbolTable* table, Ast* cmdReturn )
 int Sym_visitCall( SymbolTable* table, Ast* call )
 {
    int errors = 0;
-   char* name = call->firstChild->sval;
+   char* name = Ast_sval( Ast_firstChild( call ) );
    Symbol* symbol = Sym_getSymbol( table, name, 0 );
    if ( symbol == NULL )
    {
@@ -393,11 +484,11 @@ int Sym_visitCall( SymbolTable* table, Ast* call )
    call->dataType = symbol->type;
    call->nReferences = symbol->nReferences;
 
-   Ast* parameter = call->firstChild->nextSibling;
+   Ast* parameter = Ast_nextSibling( Ast_firstChild( call ) );
    while( parameter != NULL )
    {
       errors += Sym_visitExp( table, parameter );
-      parameter = parameter->nextSibling;
+      parameter = Ast_nextSibling( parameter );
    }
    return errors;
 }
@@ -426,31 +517,31 @@ int Sym_visitExp( SymbolTable* table, Ast* exp )
 
       case AST_EXP_NOT:
          exp->dataType = TYPE_BOOL;
-         errors += Sym_visitExp( table, exp->firstChild );
-         errors += Sym_checkDataType( exp->firstChild, TYPE_BOOL, 0 );
+         errors += Sym_visitExp( table, Ast_firstChild( exp ) );
+         errors += Sym_checkDataType( Ast_firstChild( exp ), TYPE_BOOL, 0 );
          break;
 
       case AST_EXP_NEG:
          exp->dataType = TYPE_INT;
-         errors += Sym_visitExp( table, exp->firstChild );
-         errors += Sym_checkDataType( exp->firstChild, TYPE_INT, 0 );
+         errors += Sym_visitExp( table, Ast_firstChild( exp ) );
+         errors += Sym_checkDataType( Ast_firstChild( exp ), TYPE_INT, 0 );
          break;
 
       case AST_EXP_OR:
       case AST_EXP_AND:
          exp->dataType = TYPE_BOOL;
-         errors += Sym_visitExp( table, exp->firstChild );
-         errors += Sym_visitExp( table, exp->firstChild->nextSibling );
-         errors += Sym_checkDataType( exp->firstChild, TYPE_BOOL, 0 );
-         errors += Sym_checkDataType( exp->firstChild->nextSibling, TYPE_BOOL, 0 );
+         errors += Sym_visitExp( table, Ast_firstChild( exp ) );
+         errors += Sym_visitExp( table, Ast_nextSibling( Ast_firstChild( exp ) ) );
+         errors += Sym_checkDataType( Ast_firstChild( exp ), TYPE_BOOL, 0 );
+         errors += Sym_checkDataType( Ast_nextSibling( Ast_firstChild( exp ) ), TYPE_BOOL, 0 );
          break;
 
       case AST_EXP_EQ:
       case AST_EXP_UNEQ:
          exp->dataType = TYPE_BOOL;
-         errors += Sym_visitExp( table, exp->firstChild );
-         errors += Sym_visitExp( table, exp->firstChild->nextSibling );
-         errors += Sym_matchDataType( exp->firstChild, exp->firstChild->nextSibling );
+         errors += Sym_visitExp( table, Ast_firstChild( exp ) );
+         errors += Sym_visitExp( table, Ast_nextSibling( Ast_firstChild( exp ) ) );
+         errors += Sym_matchDataType( Ast_firstChild( exp ), Ast_nextSibling( Ast_firstChild( exp ) ) );
          break;
 
       case AST_EXP_L:
@@ -458,10 +549,10 @@ int Sym_visitExp( SymbolTable* table, Ast* exp )
       case AST_EXP_LEQ:
       case AST_EXP_GEQ:
          exp->dataType = TYPE_BOOL;
-         errors += Sym_visitExp( table, exp->firstChild );
-         errors += Sym_visitExp( table, exp->firstChild->nextSibling );
-         errors += Sym_checkDataType( exp->firstChild, TYPE_INT, 0 );
-         errors += Sym_checkDataType( exp->firstChild->nextSibling, TYPE_INT, 0 );
+         errors += Sym_visitExp( table, Ast_firstChild( exp ) );
+         errors += Sym_visitExp( table, Ast_nextSibling( Ast_firstChild( exp ) ) );
+         errors += Sym_checkDataType( Ast_firstChild( exp ), TYPE_INT, 0 );
+         errors += Sym_checkDataType( Ast_nextSibling( Ast_firstChild( exp ) ), TYPE_INT, 0 );
          break;
 
       case AST_EXP_ADD:
@@ -469,17 +560,21 @@ int Sym_visitExp( SymbolTable* table, Ast* exp )
       case AST_EXP_MULT:
       case AST_EXP_DIV:
          exp->dataType = TYPE_INT;
-         errors += Sym_visitExp( table, exp->firstChild );
-         errors += Sym_visitExp( table, exp->firstChild->nextSibling );
-         errors += Sym_checkDataType( exp->firstChild, TYPE_INT, 0 );
-         errors += Sym_checkDataType( exp->firstChild->nextSibling, TYPE_INT, 0 );
+         errors += Sym_visitExp( table, Ast_firstChild( exp ) );
+         errors += Sym_visitExp( table, Ast_nextSibling( Ast_firstChild( exp ) ) );
+         errors += Sym_checkDataType( Ast_firstChild( exp ), TYPE_INT, 0 );
+         errors += Sym_checkDataType( Ast_nextSibling( Ast_firstChild( exp ) ), TYPE_INT, 0 );
          break;
 
       case AST_EXP_NEW:
-         errors += Sym_visitExp( table, exp->firstChild );
-         exp->nReferences = Sym_getDataType( exp->firstChild->nextSibling, &(exp->dataType) );
+      {
+         DataType dataType;
+         errors += Sym_visitExp( table, Ast_firstChild( exp ) );
+         exp->nReferences = Sym_getDataType( Ast_nextSibling( Ast_firstChild( exp ) ), &dataType );
+         exp->dataType = dataType;
          (exp->nReferences)++; // Pois o proprio new adiciona uma referencia
          break;
+      }
 
       case AST_VAR:
          errors += Sym_visitVar( table, exp );
@@ -528,7 +623,7 @@ int Sym_getDataType( Ast* typeNode, DataType* dataType )
    while ( typeNode->type == AST_ARRAY )
    {
       nReferences++;
-      typeNode = typeNode->firstChild;
+      typeNode = Ast_firstChild( typeNode );
    }
    switch ( typeNode->type )
    {
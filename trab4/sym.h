@@ -12,7 +12,8 @@ typedef struct ast Ast;
 
 
 typedef struct symbol Symbol;
-typedef struct scope Scope;
+typedef struct symbolName SymbolName;
+typedef struct symbolArena SymbolArena;
 typedef struct symbolTable SymbolTable;
 typedef enum dType DataType;
 
@@ -32,18 +33,47 @@ struct symbol
    DataType type;
    int nReferences;
    int line;
+   // Profundidade do escopo da declaracao, 0 para os globais
+   int depth;
+   SymbolName* entry;
+   // Declaracao de mesmo nome escondida por esta
+   Symbol* shadowed;
+   // Proxima declaracao do mesmo escopo
    Symbol* nextSymbol;
 };
 
-struct scope
+// Nome internado: cada identificador tem uma unica entrada na tabela
+// de hash, que aponta para a declaracao visivel mais interna
+struct symbolName
 {
-   Symbol* symbolList;
-   Scope* nextScope;
+   char* name;
+   unsigned int hash;
+   Symbol* symbol;
+   SymbolName* nextName;
+};
+
+// Bloco de memoria de onde saem os simbolos e os nomes; tudo e
+// liberado de uma vez ao fim da analise
+struct symbolArena
+{
+   char* data;
+   int used;
+   int size;
+   SymbolArena* nextArena;
 };
 
 struct symbolTable
 {
-   Scope* innerScope;
+   SymbolName** buckets;
+   int nBuckets;
+   int nNames;
+   // scopes[d] lista as declaracoes do escopo de profundidade d
+   Symbol** scopes;
+   int depth;
+   int nScopes;
+   SymbolArena* arena;
+   // Funcao sendo analisada, cujo tipo os return devem ter
+   Ast* function;
 };
 
 int Sym_annotate( Ast* program );
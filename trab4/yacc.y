@@ -5,8 +5,11 @@
  */
 
 # include <stdio.h>
+# include <string.h>
 # include "ast.h"
 # include "sym.h"
+# include "lower.h"
+# include "pass.h"
 
 extern FILE * yyin;
 int yydebug=1;
@@ -26,6 +29,8 @@ Ast* _program = NULL;
 // Numero da linha corrente de leitura do arquivo
 extern unsigned int _line;
 
+int compile( Ast* program, char* inputFileName, PassLevel level, int debugLines );
+
 %}
 
 %type <node> programa
@@ -302,8 +307,22 @@ yyerror( char *s )
 
 int main( int argc, char * argv[] )
 {
-   if ( argc > 1 )
-      yyin = fopen( argv[1] ,"r" );
+   char* inputFileName = NULL;
+   int emitAsm = 0;
+   int debugLines = 0;
+   PassLevel level = PASS_O0;
+   int i;
+
+   for ( i = 1 ; i < argc ; i++ )
+   {
+      if ( strcmp( argv[i], "-S" ) == 0 ) emitAsm = 1;
+      else if ( strcmp( argv[i], "-O" ) == 0 ) level = PASS_O2;
+      else if ( strcmp( argv[i], "-g" ) == 0 ) debugLines = 1;
+      else inputFileName = argv[i];
+   }
+
+   if ( inputFileName != NULL )
+      yyin = fopen( inputFileName ,"r" );
 
    if ( yyin == NULL )
    {
@@ -316,11 +335,54 @@ int main( int argc, char * argv[] )
    if ( _lexicalError > 0 || _syntaxError > 0 )
       return -1;
 
+   // Filhos em posicoes consecutivas para as visitas seguintes
+   _program = Ast_compact( _program );
+
    _symError = Sym_annotate( _program );
    if ( _symError > 0 )
       return -1;
 
-   Ast_print( _program );
+   if ( !emitAsm )
+   {
+      Ast_print( _program );
+      return 0;
+   }
+   return compile( _program, inputFileName, level, debugLines );
+}
+
+// Traduz a arvore direto para o codigo intermediario do backend e dele
+// para assembly em arquivo.s, sem escrever nem reler o texto .m0.ir
+int compile( Ast* program, char* inputFileName, PassLevel level, int debugLines )
+{
+   UnrollOptions unroll = { 4, 64, NULL };
+   InlineOptions inlining = { -1, 2, -1, NULL };
+   EscapeOptions escape = { 1024, NULL };
+   AsmOptions asmOptions = { 0, 0, NULL, 0, 0, 0, 0, NULL, 0, 0, NULL, NULL };
+   PassOptions passes = { level, &inlining, &unroll, &escape, &asmOptions, NULL, NULL };
+   char outputFileName[256];
+   char* extension;
+   FILE* outputFile;
+
+   IR* ir = Lower_program( program );
+   if ( debugLines )
+      asmOptions.sourceFile = inputFileName;
+   Pass_configure( &passes );
+   Pass_run( ir, &passes );
+
+   snprintf( outputFileName, sizeof( outputFileName ) - 2, "%s", inputFileName );
+   // Troca a extensao do nome do arquivo, nao de um diretorio
+   extension = strrchr( outputFileName, '.' );
+   if ( extension == NULL || strchr( extension, '/' ) != NULL )
+      extension = outputFileName + strlen( outputFileName );
+   strcpy( extension, ".s" );
+   outputFile = fopen( outputFileName, "w" );
+   if ( outputFile == NULL )
+   {
+      fprintf( stderr, "Nao foi possivel criar %s\n", outputFileName );
+      return -1;
+   }
+   Asm_write( ir, &asmOptions, outputFile );
+   fclose( outputFile );
    return 0;
 }
 
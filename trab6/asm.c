@@ -6,18 +6,89 @@
 #include "asm.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+#include "callgraph.h"
+#include "cfg.h"
+#include "frame.h"
+#include "remark.h"
+#include "runtime.h"
+#include "timing.h"
 
 #define ASM_ADDR_BUFFER_SIZE 128
+#define ASM_SWITCH_MIN_CASES 4 // Comparacoes seguidas que viram tabela ou arvore
+#define ASM_SWITCH_DENSITY 3 // Entradas na tabela por caso, no maximo
+#define ASM_ALLOC_SITE_SIZE 20 // sizeof(RuntimeAllocSite) em 32 bits
+
+typedef struct SwitchCase_ {
+   int key;
+   const char* label;
+} SwitchCase;
+
+static AsmOptions Asm_options;
+static Frame* Asm_frame; // Disposicao das variaveis da funcao sendo escrita
+static int Asm_useEsp; // Variaveis enderecadas por %esp, sem %ebp
+static int Asm_pushDepth; // Bytes empilhados por params desde o prologo
+static CallGraph* Asm_callGraph; // Funcoes internas recebem argumentos em registradores
+static const char* Asm_argRegisters[3] = { "%eax", "%edx", "%ecx" };
+static Addr Asm_regParams[3]; // Params guardados ate o call que os passa em registradores
+static int Asm_outArea; // Bytes da area de saida dos params, -1 se forem empilhados
+static Cfg* Asm_cfg; // Blocos da funcao sendo escrita, para achar os lacos
+static char* Asm_isLoopHeader; // Por bloco do Asm_cfg, destino de um desvio para tras
+static int Asm_inCold; // Escrevendo em .text.unlikely
+static int* Asm_tempUses; // Usos de cada temporaria da funcao, por Addr.num
+static char** Asm_jumpTargets; // Rotulos de destino dos desvios da funcao, ordenados
+static int Asm_nJumpTargets;
+static int Asm_hasColdPart; // A funcao foi dividida e a parte fria tem o simbolo funcao.cold
+static int Asm_line; // Ultima linha do .m0.ir dada por .loc
+static int Asm_allocBase; // Primeiro ponto de alocacao da funcao, com -falloc-profile
+static int Asm_allocSite; // Proximo ponto de alocacao a ser escrito
+static int Asm_nAllocSites;
 
 static void Asm_writeFunction( Function* function, FILE* outputFile );
-static void Asm_writeBlock( BasicBlock* block, Function* function, FILE* outputFile );
+static void Asm_writeProfileTables( Profile* profile, FILE* outputFile );
+static void Asm_writeAllocTables( IR* program, FILE* outputFile );
+static void Asm_writeBody( BasicBlock* blockList, Function* function, FILE* outputFile );
+static void Asm_writeBlock( BasicBlock* block, int nInstr, Function* function, FILE* outputFile );
 static void Asm_writeInstr( Instr* instr, Function* function, FILE* outputFile );
 static void Asm_writeBinOpArit( char* op, Instr* instr, Function* function, FILE* outputFile );
 static void Asm_writeBinOpComp( char* op, Instr* instr, Function* function, FILE* outputFile );
+static int Asm_isFusedBranch( Instr* instr );
+static void Asm_writeFusedBranch( Instr* compare, Function* function, FILE* outputFile );
+static int Asm_isSelect( BasicBlock* block, Function* function );
+static void Asm_writeSelect( Instr* branch, BasicBlock* left, Function* function, FILE* outputFile );
+static int Asm_switchLength( BasicBlock* block, Function* function );
+static void Asm_countTempUses( Function* function );
+static void Asm_collectJumpTargets( Function* function );
+static int Asm_countJumpsTo( const char* label );
+static int Asm_compareLabels( const void* a, const void* b );
+static int Asm_switchCase( Instr* test, Addr* var, int* key );
+static void Asm_writeSwitch( BasicBlock* block, int nCases, Function* function, FILE* outputFile );
+static void Asm_writeDecisionTree( SwitchCase* cases, int lo, int hi, int label, int* nNodes, FILE* outputFile );
+static int Asm_compareCases( const void* a, const void* b );
 static void Asm_writeNew( int size, Instr* instr, Function* function, FILE* outputFile );
+static void Asm_writeRuntimeNew( int size, Instr* instr, Function* function, FILE* outputFile );
+static void Asm_writeAllocCall( const char* allocator, FILE* outputFile );
+static void Asm_writeProfiledAlloc( FILE* outputFile );
+static void Asm_writeLoad( int size, Instr* instr, Function* function, FILE* outputFile );
+static void Asm_writeStore( int size, Instr* instr, Function* function, FILE* outputFile );
+static void Asm_writeTailCall( Instr* instr, Function* function, FILE* outputFile );
 static void Asm_writeReturn( FILE* outputFile );
+static void Asm_writeEpilogue( FILE* outputFile );
+static int Asm_isTailCall( Instr* instr, Function* function );
+static int Asm_isLeaf( Function* function );
+static int Asm_nRegArgs( const char* name );
+static const char* Asm_calleeName( Instr* call );
+static Instr* Asm_findCall( Instr* param, int* arg );
+static int Asm_outgoingSize( Function* function );
+static void Asm_getStackArg( int slot, char* output );
+static void Asm_writeGet( Addr addr, const char* reg, Function* function, FILE* outputFile );
+static void Asm_writeSet( Addr addr, Function* function, FILE* outputFile );
+static int Asm_isByte( Addr addr, Function* function );
 static void Asm_getAddr( Addr addr, Function* function, char* output );
 static void Asm_translateAddr( Addr addr, Function* function, char* output );
+static void Asm_frameAddr( int offset, char* output );
+static int Asm_getRetTemp( Function* function, Addr* ret );
 static int Asm_generateLabel();
 static BasicBlock* Block_generateBlocks( Instr* instr, Function* function );
 static Instr* Block_getInstr( BasicBlock* block, int n );
@@ -26,9 +97,17 @@ static void Block_setUsage( Addr addr, int usagePos, int* usageInfo , int locals
 
 
 
-void Asm_write( IR* program, FILE* outputFile )
+void Asm_write( IR* program, AsmOptions* options, FILE* outputFile )
 {
+   Asm_options = *options;
+   Asm_callGraph = Asm_options.registerArgs ? CallGraph_build( program ) : NULL;
+
    // Strings e globais
+   if ( Asm_options.sourceFile )
+      fprintf( outputFile, "\t.file\t\"%s\"\n"
+                           "\t.file 1\t\"%s\"\n",
+                           Asm_options.sourceFile,
+                           Asm_options.sourceFile );
 	fprintf( outputFile, ".data\n" );
 	for ( String* s = program->strings ; s ; s = s->next )
    {
@@ -38,49 +117,230 @@ void Asm_write( IR* program, FILE* outputFile )
    {
 		fprintf( outputFile, ".comm\t%s, 4\n", v->name );
 	}
+   if ( Asm_options.profile )
+      Asm_writeProfileTables( Asm_options.profile, outputFile );
+   if ( Asm_options.allocProfile )
+      Asm_writeAllocTables( program, outputFile );
 	fprintf( outputFile, "\n.text\n" );
+   Asm_allocBase = 0;
+   Timing_count( TIMING_BYTES, ftell( outputFile ) );
    // Imprime as funcoes
 	for ( Function* fun = program->functions ; fun ; fun = fun->next )
    {
+      Timing_function( fun );
+      long start = ftell( outputFile );
+      Timing_start( TIMING_EMIT );
 		Asm_writeFunction( fun, outputFile );
+      Timing_stop( TIMING_EMIT );
+      Timing_count( TIMING_BYTES, ftell( outputFile ) - start );
 	}
+   Timing_function( NULL );
+   CallGraph_delete( Asm_callGraph );
+   Asm_callGraph = NULL;
 }
 
 
 
 static void Asm_writeFunction( Function* function, FILE* outputFile )
 {
-   int nVariables = 0;
    BasicBlock* blockList = NULL;
+   int nRegArgs = Asm_nRegArgs( function->name );
+   Asm_frame = Frame_build( function, Asm_options.shareSlots, nRegArgs );
+   Asm_outArea = Asm_outgoingSize( function );
+   if ( Asm_options.frameStats )
+      fprintf( Asm_options.frameStats, "Registro de ativacao: funcao %s, %d bytes antes, %d bytes depois\n",
+                                       function->name, Frame_classicSize( function ), Asm_frame->size );
+
+   // Sem %ebp nas funcoes folha, ou em todas se pedido
+   Asm_useEsp = ( Asm_options.omitFramePointer == 2 ) ||
+                ( Asm_options.omitFramePointer == 1 && Asm_isLeaf( function ) );
+
+   // Rotulos alcancados por desvios para tras comecam lacos
+   if ( Asm_options.alignLoops )
+   {
+      Asm_cfg = Cfg_build( function );
+      Asm_isLoopHeader = (char*) calloc( Asm_cfg->nBlocks, sizeof(char) );
+      for ( int i = 0 ; i < Asm_cfg->nBlocks ; i++ )
+         for ( int k = 0 ; k < Asm_cfg->blocks[i]->nSucc ; k++ )
+            if ( Asm_cfg->blocks[i]->succ[k]->index <= i )
+               Asm_isLoopHeader[ Asm_cfg->blocks[i]->succ[k]->index ] = 1;
+   }
 
-   // Conta as variaveis
-   nVariables += Function_nLocals( function );
-   nVariables += Function_nTemps( function );
-   nVariables -= function->nArgs;
+   Timing_start( TIMING_BLOCKS );
+   blockList = Block_generateBlocks( function->code, function );
+   Timing_stop( TIMING_BLOCKS );
+   Timing_start( TIMING_NEXT_USE );
+	for ( BasicBlock* block = blockList ; block ; block = block->next )
+      Block_computeNextUsage( block, function );
+   Timing_stop( TIMING_NEXT_USE );
+   if ( Timing_enabled )
+   {
+      int nInstrs = 0;
+      for ( BasicBlock* block = blockList ; block ; block = block->next )
+      {
+         nInstrs += block->nInstr;
+         Timing_count( TIMING_BLOCK_COUNT, 1 );
+      }
+      Timing_count( TIMING_INSTRS, nInstrs );
+      Timing_count( TIMING_LOCALS, Function_nLocals( function ) );
+      Timing_count( TIMING_TEMPS, Function_nTemps( function ) );
+   }
 
-	fprintf( outputFile, "\n.globl %s\n"
-                        ".type\t%s, @function\n"
+   // Funcoes internas nao sao exportadas, pois nao seguem a convencao do C
+   fprintf( outputFile, "\n" );
+   // Funcao que nunca executou no perfil fica inteira longe das outras
+   Asm_inCold = 0;
+   Asm_hasColdPart = 0;
+   if ( Asm_options.splitCold && function->code && function->code->count == 0 )
+   {
+      fprintf( outputFile, "\t.section .text.unlikely,\"ax\",@progbits\n" );
+      Asm_inCold = 1;
+   }
+   if ( nRegArgs == 0 && !( Asm_callGraph && CallGraph_find( Asm_callGraph, function->name )->isInternal ) )
+      fprintf( outputFile, ".globl %s\n", function->name );
+	fprintf( outputFile, ".type\t%s, @function\n"
                         "%s:\n",
                         function->name,
-                        function->name,
                         function->name );
    // Registro de ativacao
-   fprintf( outputFile, "\tpushl\t%%ebp\n"
-                        "\tmovl\t%%esp, %%ebp\n" );
-   // Aloca espaco das variaveis
-   fprintf( outputFile, "\tsubl\t$%d, %%esp\n", 4*nVariables );
-   // Salva os registradores
-   fprintf( outputFile, "\tpushl\t%%ebx\n"
-                        "\tpushl\t%%esi\n"
-                        "\tpushl\t%%edi\n" );
+   if ( !Asm_useEsp )
+      fprintf( outputFile, "\tpushl\t%%ebp\n"
+                           "\tmovl\t%%esp, %%ebp\n" );
+   // Aloca espaco das variaveis e, abaixo delas, a area de saida dos params.
+   // Nenhum registrador preservado (%ebx, %esi, %edi) e usado pelo codigo gerado
+   int outArea = ( Asm_outArea > 0 ) ? Asm_outArea : 0;
+   int reserve = Asm_frame->size + outArea;
+   if ( reserve > 0 )
+      fprintf( outputFile, "\tsubl\t$%d, %%esp\n", reserve );
+   // Argumentos recebidos em registradores vao para o registro de ativacao
+   Variable* arg = function->locals;
+   for ( int r = 0 ; r < nRegArgs ; r++, arg = arg->next )
+   {
+      char bufferArg[ASM_ADDR_BUFFER_SIZE];
+      Addr local;
+      local.type = AD_LOCAL;
+      local.num = r;
+      local.str = (char*) arg->name;
+      Asm_pushDepth = 0;
+      Asm_getAddr( local, function, bufferArg );
+      fprintf( outputFile, "\tmovl\t%s, %s\n", Asm_argRegisters[r], bufferArg );
+   }
+   // O perfil e gravado quando o programa termina
+   if ( Asm_options.profile && strcmp( function->name, "main" ) == 0 )
+      fprintf( outputFile, "\tpushl\t$%d\n"
+                           "\tpushl\t$.LProfile_sites\n"
+                           "\tpushl\t$.LProfile_counters\n"
+                           "\tpushl\t$.LProfile_file\n"
+                           "\tcall\tRuntime_startProfile\n"
+                           "\taddl\t$16, %%esp\n",
+                           Asm_options.profile->nSites );
+   if ( Asm_options.allocProfile && strcmp( function->name, "main" ) == 0 )
+      fprintf( outputFile, "\tpushl\t$%d\n"
+                           "\tpushl\t$%d\n"
+                           "\tpushl\t$.LAlloc_sites\n"
+                           "\tpushl\t$.LAlloc_file\n"
+                           "\tcall\tRuntime_startAllocProfile\n"
+                           "\taddl\t$16, %%esp\n",
+                           Asm_options.runtimeAlloc,
+                           Asm_nAllocSites );
+
+   Asm_countTempUses( function );
+   Asm_collectJumpTargets( function );
+   Asm_writeBody( blockList, function, outputFile );
+   Asm_allocBase = Asm_allocSite;
+   // Tamanho do simbolo, para que os perfis atribuam as amostras a funcao
+   fprintf( outputFile, "\t.size\t%s%s, .-%s%s\n",
+                        function->name, Asm_hasColdPart ? ".cold" : "",
+                        function->name, Asm_hasColdPart ? ".cold" : "" );
+   if ( Asm_inCold )
+      fprintf( outputFile, "\t.text\n" );
+
+   Frame_delete( Asm_frame );
+   Asm_frame = NULL;
+   free( Asm_tempUses );
+   Asm_tempUses = NULL;
+   free( Asm_jumpTargets );
+   Asm_jumpTargets = NULL;
+   if ( Asm_cfg )
+   {
+      free( Asm_isLoopHeader );
+      Cfg_delete( Asm_cfg );
+      Asm_cfg = NULL;
+   }
+}
+
+
+
+static void Asm_writeProfileTables( Profile* profile, FILE* outputFile )
+{
+   fprintf( outputFile, "\t.align 8\n"
+                        ".LProfile_counters:\n"
+                        "\t.zero\t%d\n"
+                        ".LProfile_file:\t.string \"%s\"\n",
+                        8 * profile->nCounters,
+                        profile->fileName );
+   for ( int i = 0 ; i < profile->nSites ; i++ )
+      fprintf( outputFile, ".LProfile_site_%d:\t.string \"%s\"\n", i, profile->sites[i].name );
+   // Pares nome e indice do contador, como RuntimeProfileSite
+   fprintf( outputFile, "\t.align 4\n"
+                        ".LProfile_sites:\n" );
+   for ( int i = 0 ; i < profile->nSites ; i++ )
+      fprintf( outputFile, "\t.long\t.LProfile_site_%d, %d\n", i, profile->sites[i].counter );
+}
+
+
+
+static void Asm_writeAllocTables( IR* program, FILE* outputFile )
+{
+   // Um ponto por new, na mesma ordem em que o codigo e escrito, com o
+   // nome da funcao e a posicao da instrucao
+   Asm_nAllocSites = 0;
+   fprintf( outputFile, ".LAlloc_file:\t.string \"%s\"\n", Asm_options.allocProfile );
+   for ( Function* fun = program->functions ; fun ; fun = fun->next )
+   {
+      int index = 0;
+      for ( Instr* instr = fun->code ; instr ; instr = instr->next, index++ )
+         if ( instr->op == OP_NEW || instr->op == OP_NEW_BYTE )
+            fprintf( outputFile, ".LAlloc_name_%d:\t.string \"%s %d\"\n", Asm_nAllocSites++, fun->name, index );
+   }
+   // Nome e totais zerados, como RuntimeAllocSite
+   fprintf( outputFile, "\t.align 4\n"
+                        ".LAlloc_sites:\n" );
+   for ( int i = 0 ; i < Asm_nAllocSites ; i++ )
+      fprintf( outputFile, "\t.long\t.LAlloc_name_%d\n"
+                           "\t.zero\t%d\n",
+                           i, ASM_ALLOC_SITE_SIZE - 4 );
+}
+
 
-   blockList = Block_generateBlocks( function->code, function );
 
+static void Asm_writeBody( BasicBlock* blockList, Function* function, FILE* outputFile )
+{
+   Asm_pushDepth = 0;
+   Asm_allocSite = Asm_allocBase;
+   Asm_line = 0;
 	for ( BasicBlock* block = blockList ; block ; block = block->next )
    {
-      Block_computeNextUsage( block, function );
-      Asm_writeBlock( block, function, outputFile );
-	}
+      // Comparacoes de uma variavel com varias constantes viram um desvio indexado
+      int nCases = Asm_switchLength( block, function );
+      if ( nCases > 0 )
+      {
+         Asm_writeBlock( block, block->nInstr-2, function, outputFile );
+         Asm_writeSwitch( block, nCases, function, outputFile );
+         for ( int c = 1 ; c < nCases ; c++ )
+            block = block->next;
+         continue;
+      }
+      // Atribuicoes nos dois lados de um if viram um cmov
+      if ( Asm_isSelect( block, function ) )
+      {
+         Asm_writeBlock( block, block->nInstr-1, function, outputFile );
+         Asm_writeSelect( Block_getInstr( block, block->nInstr-1 ), block->next, function, outputFile );
+         block = block->next->next;
+         continue;
+      }
+      Asm_writeBlock( block, block->nInstr, function, outputFile );
+   }
 
    // Caso nao tenha um ret no final da funcao
    for ( Instr* instr = function->code ; instr ; instr = instr->next )
@@ -90,11 +350,35 @@ static void Asm_writeFunction( Function* function, FILE* outputFile )
 
 
 
-static void Asm_writeBlock( BasicBlock* block, Function* function, FILE* outputFile )
+static void Asm_writeBlock( BasicBlock* block, int nInstr, Function* function, FILE* outputFile )
 {
    int iInstr = 0;
-   for ( Instr* instr = block->instr ; iInstr < block->nInstr ; instr = instr->next, iInstr++ )
+   for ( Instr* instr = block->instr ; iInstr < nInstr ; instr = instr->next, iInstr++ )
+   {
+      // Linha do .m0.ir de onde vem o codigo a seguir
+      if ( Asm_options.sourceFile && instr->line > 0 && instr->line != Asm_line && instr->op != OP_LABEL )
+      {
+         fprintf( outputFile, "\t.loc 1 %d\n", instr->line );
+         Asm_line = instr->line;
+      }
+      // Chamada seguida do retorno do seu resultado vira um salto
+      if ( Asm_isTailCall( instr, function ) && iInstr+1 < nInstr )
+      {
+         Asm_writeTailCall( instr, function, outputFile );
+         instr = instr->next;
+         iInstr++;
+         continue;
+      }
+      // Comparacao seguida do desvio que testa o seu resultado
+      if ( Asm_isFusedBranch( instr ) && iInstr+1 < nInstr )
+      {
+         Asm_writeFusedBranch( instr, function, outputFile );
+         instr = instr->next;
+         iInstr++;
+         continue;
+      }
       Asm_writeInstr( instr, function, outputFile );
+   }
 }
 
 
@@ -103,12 +387,33 @@ static void Asm_writeInstr( Instr* instr, Function* function, FILE* outputFile )
 {
    // Buffers para guardar as strings representando os enderecos
    char bufferX[ASM_ADDR_BUFFER_SIZE];
-   char bufferY[ASM_ADDR_BUFFER_SIZE];
-   char bufferZ[ASM_ADDR_BUFFER_SIZE];
+   Addr retTemp;
+   Instr* call;
+   int arg = 0;
+   int nRegArgs = 0;
 
    switch ( instr->op )
    {
       case OP_LABEL :
+         // Os blocos frios ficam no fim da funcao, depois dos quentes
+         // A parte quente termina aqui e a fria ganha o seu proprio simbolo
+         if ( Asm_options.splitCold && instr->count == 0 && !Asm_inCold )
+         {
+            fprintf( outputFile, "\t.size\t%s, .-%s\n"
+                                 "\t.section .text.unlikely,\"ax\",@progbits\n"
+                                 ".type\t%s.cold, @function\n"
+                                 "%s.cold:\n",
+                                 function->name, function->name,
+                                 function->name, function->name );
+            Asm_inCold = 1;
+            Asm_hasColdPart = 1;
+         }
+         if ( Asm_cfg )
+         {
+            CfgBlock* block = Cfg_findLabel( Asm_cfg, instr->x.str );
+            if ( block && Asm_isLoopHeader[ block->index ] )
+               fprintf( outputFile, "\t.p2align 4,,10\n" );
+         }
          fprintf( outputFile, "%s:\n", instr->x.str );
          break;
 
@@ -117,15 +422,61 @@ static void Asm_writeInstr( Instr* instr, Function* function, FILE* outputFile )
          break;
 
       case OP_PARAM :
+         call = Asm_findCall( instr, &arg );
+         nRegArgs = call ? Asm_nRegArgs( call->x.str ) : 0;
+         // Argumentos em registradores sao carregados so no call
+         if ( arg < nRegArgs )
+         {
+            Asm_regParams[arg] = instr->x;
+            break;
+         }
+         // Com a area de saida, cada param vai direto para sua posicao
+         if ( Asm_outArea >= 0 && call )
+         {
+            if ( instr->x.type == AD_NUMBER || instr->x.type == AD_STRING )
+            {
+               Asm_getAddr( instr->x, function, bufferX );
+               fprintf( outputFile, "\tmovl\t%s, %d(%%esp)\n", bufferX, 4 * (arg - nRegArgs) );
+               break;
+            }
+            Asm_writeGet( instr->x, "%eax", function, outputFile );
+            fprintf( outputFile, "\tmovl\t%%eax, %d(%%esp)\n", 4 * (arg - nRegArgs) );
+            break;
+         }
+         if ( Asm_isByte( instr->x, function ) )
+         {
+            Asm_writeGet( instr->x, "%eax", function, outputFile );
+            fprintf( outputFile, "\tpushl\t%%eax\n" );
+            Asm_pushDepth += 4;
+            break;
+         }
          Asm_getAddr( instr->x, function, bufferX );
          fprintf( outputFile, "\tpushl\t%s\n", bufferX );
+         Asm_pushDepth += 4;
          break;
 
       case OP_CALL :
-         fprintf( outputFile, "\tcall\t%s\n"
-                              "\taddl\t$%d, %%esp\n", // Desaloca os parametros
-                              instr->x.str,
-                              4 * instr->y.num );
+         nRegArgs = Asm_nRegArgs( instr->x.str );
+         for ( int r = 0 ; r < nRegArgs && r < instr->y.num ; r++ )
+            Asm_writeGet( Asm_regParams[r], Asm_argRegisters[r], function, outputFile );
+         fprintf( outputFile, "\tcall\t%s\n", Asm_calleeName( instr ) );
+         // Desaloca os parametros empilhados
+         if ( Asm_outArea < 0 && instr->y.num > nRegArgs )
+         {
+            fprintf( outputFile, "\taddl\t$%d, %%esp\n", 4 * (instr->y.num - nRegArgs) );
+            Asm_pushDepth -= 4 * (instr->y.num - nRegArgs);
+         }
+         // O valor de retorno fica na temporaria $ret, se a funcao a usar
+         if ( Asm_getRetTemp( function, &retTemp ) )
+            Asm_writeSet( retTemp, function, outputFile );
+         break;
+
+      case OP_COUNT :
+         // Contador de 64 bits do perfil
+         fprintf( outputFile, "\taddl\t$1, .LProfile_counters+%d\n"
+                              "\tadcl\t$0, .LProfile_counters+%d\n",
+                              8 * instr->x.num,
+                              8 * instr->x.num + 4 );
          break;
 
       case OP_RET :
@@ -133,142 +484,73 @@ static void Asm_writeInstr( Instr* instr, Function* function, FILE* outputFile )
          break;
 
       case OP_RET_VAL :
-         Asm_getAddr( instr->x, function, bufferX );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n", bufferX );
+         Asm_writeGet( instr->x, "%eax", function, outputFile );
          Asm_writeReturn( outputFile );
          break;
 
       case OP_IF :
-         Asm_getAddr( instr->x, function, bufferX );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tcmpl\t$0, %%eax\n"
-                              "\tjne\t%s\n",
-                              bufferX,
-                              instr->y.str );
-         break;
-
       case OP_IF_FALSE :
-         Asm_getAddr( instr->x, function, bufferX );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tcmpl\t$0, %%eax\n"
-                              "\tje\t%s\n",
-                              bufferX,
+         if ( Remark_wants( function ) )
+            Remark_emit( REMARK_MISSED, "branch-fusion", function, Remark_index( function, instr ),
+                         Asm_options.fuseBranches ? "%s nao vem da comparacao anterior" : "%s testado com cmpl: fusao desligada",
+                         instr->x.str );
+         Asm_writeGet( instr->x, "%eax", function, outputFile );
+         fprintf( outputFile, "\tcmpl\t$0, %%eax\n"
+                              "\tj%s\t%s\n",
+                              instr->op == OP_IF ? "ne" : "e",
                               instr->y.str );
          break;
 
-      case OP_NE : Asm_writeBinOpComp( "jne", instr, function, outputFile ); break;
-      case OP_EQ : Asm_writeBinOpComp( "je", instr, function, outputFile ); break;
-      case OP_LT : Asm_writeBinOpComp( "jl", instr, function, outputFile ); break;
-      case OP_GT : Asm_writeBinOpComp( "jg", instr, function, outputFile ); break;
-      case OP_LE : Asm_writeBinOpComp( "jle", instr, function, outputFile ); break;
-      case OP_GE : Asm_writeBinOpComp( "jge", instr, function, outputFile ); break;
+      case OP_NE : Asm_writeBinOpComp( "setne", instr, function, outputFile ); break;
+      case OP_EQ : Asm_writeBinOpComp( "sete", instr, function, outputFile ); break;
+      case OP_LT : Asm_writeBinOpComp( "setl", instr, function, outputFile ); break;
+      case OP_GT : Asm_writeBinOpComp( "setg", instr, function, outputFile ); break;
+      case OP_LE : Asm_writeBinOpComp( "setle", instr, function, outputFile ); break;
+      case OP_GE : Asm_writeBinOpComp( "setge", instr, function, outputFile ); break;
 
       case OP_ADD : Asm_writeBinOpArit( "addl", instr, function, outputFile ); break;
       case OP_SUB : Asm_writeBinOpArit( "subl", instr, function, outputFile ); break;
       case OP_MUL : Asm_writeBinOpArit( "imul", instr, function, outputFile ); break;
 
       case OP_DIV :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         Asm_getAddr( instr->z, function, bufferZ );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tmovl\t%s, %%ecx\n"
-                              "\tcltd\n"
-                              "\tidiv\t%%ecx\n"
-                              "\tmovl\t%%eax, %s\n",
-                              bufferY,
-                              bufferZ,
-                              bufferX );
+         Asm_writeGet( instr->y, "%eax", function, outputFile );
+         Asm_writeGet( instr->z, "%ecx", function, outputFile );
+         fprintf( outputFile, "\tcltd\n"
+                              "\tidiv\t%%ecx\n" );
+         Asm_writeSet( instr->x, function, outputFile );
          break;
          
       case OP_NEG :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tnegl\t%%eax\n"
-                              "\tmovl\t%%eax, %s\n",
-                              bufferY,
-                              bufferX );
+         Asm_writeGet( instr->y, "%eax", function, outputFile );
+         fprintf( outputFile, "\tnegl\t%%eax\n" );
+         Asm_writeSet( instr->x, function, outputFile );
          break;
 
       case OP_NEW : Asm_writeNew( 4, instr, function, outputFile ); break;
       case OP_NEW_BYTE : Asm_writeNew( 1, instr, function, outputFile ); break;
+
+      // Vetor que nao escapa da funcao, guardado no proprio registro
+      case OP_NEW_FRAME :
+         Asm_frameAddr( Frame_arrayOffset( Asm_frame, instr ), bufferX );
+         fprintf( outputFile, "\tleal\t%s, %%eax\n", bufferX );
+         Asm_writeSet( instr->x, function, outputFile );
+         break;
          
       case OP_SET :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tmovl\t%%eax, %s\n",
-                              bufferY,
-                              bufferX );
+         Asm_writeGet( instr->y, "%eax", function, outputFile );
+         Asm_writeSet( instr->x, function, outputFile );
          break;
          
       case OP_SET_BYTE :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tmovsbl\t%%eax, %s\n",
-                              bufferY,
-                              bufferX );
-         break;
-         
-      case OP_SET_IDX :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         Asm_getAddr( instr->z, function, bufferZ );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tmovl\t%s, %%ecx\n"
-                              "\timul\t$4, %%eax\n"
-                              "\taddl\t%%ecx, %%eax\n"
-                              "\tmovl\t(%%eax), %%eax\n"
-                              "\tmovl\t%%eax, %s\n",
-                              bufferZ,
-                              bufferY,
-                              bufferX );
+         Asm_writeGet( instr->y, "%eax", function, outputFile );
+         fprintf( outputFile, "\tmovsbl\t%%al, %%eax\n" );
+         Asm_writeSet( instr->x, function, outputFile );
          break;
          
-      case OP_SET_IDX_BYTE :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         Asm_getAddr( instr->z, function, bufferZ );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tmovl\t%s, %%ecx\n"
-                              "\taddl\t%%ecx, %%eax\n"
-                              "\tmovl\t(%%eax), %%eax\n"
-                              "\tmovsbl\t%%eax, %s\n",
-                              bufferZ,
-                              bufferY,
-                              bufferX );
-         break;
-         
-      case OP_IDX_SET :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         Asm_getAddr( instr->z, function, bufferZ );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tmovl\t%s, %%ecx\n"
-                              "\timul\t$4, %%eax\n"
-                              "\taddl\t%%ecx, %%eax\n"
-                              "\tmovl\t%s, %%ecx\n"
-                              "\tmovl\t%%ecx, (%%eax)\n",
-                              bufferY,
-                              bufferX,
-                              bufferZ );
-         break;
-         
-      case OP_IDX_SET_BYTE :
-         Asm_getAddr( instr->x, function, bufferX );
-         Asm_getAddr( instr->y, function, bufferY );
-         Asm_getAddr( instr->z, function, bufferZ );
-         fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                              "\tmovl\t%s, %%ecx\n"
-                              "\taddl\t%%ecx, %%eax\n"
-                              "\tmovl\t%s, %%ecx\n"
-                              "\tmovb\t%%ecx, (%%eax)\n",
-                              bufferY,
-                              bufferX,
-                              bufferZ );
-         break;
+      case OP_SET_IDX : Asm_writeLoad( 4, instr, function, outputFile ); break;
+      case OP_SET_IDX_BYTE : Asm_writeLoad( 1, instr, function, outputFile ); break;
+      case OP_IDX_SET : Asm_writeStore( 4, instr, function, outputFile ); break;
+      case OP_IDX_SET_BYTE : Asm_writeStore( 1, instr, function, outputFile ); break;
          
       default:
          break;
@@ -279,89 +561,689 @@ static void Asm_writeInstr( Instr* instr, Function* function, FILE* outputFile )
 
 static void Asm_writeBinOpArit( char* op, Instr* instr, Function* function, FILE* outputFile )
 {
-   // Buffers para guardar as strings representando os enderecos
-   char bufferX[ASM_ADDR_BUFFER_SIZE];
-   char bufferY[ASM_ADDR_BUFFER_SIZE];
-   char bufferZ[ASM_ADDR_BUFFER_SIZE];
-   Asm_getAddr( instr->x, function, bufferX );
-   Asm_getAddr( instr->y, function, bufferY );
-   Asm_getAddr( instr->z, function, bufferZ );
-
-   fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                        "\tmovl\t%s, %%ecx\n"
-                        "\t%s\t%%ecx, %%eax\n"
-                        "\tmovl\t%%eax, %s\n",
-                        bufferY,
-                        bufferZ,
-                        op,
-                        bufferX );
+   Asm_writeGet( instr->y, "%eax", function, outputFile );
+   Asm_writeGet( instr->z, "%ecx", function, outputFile );
+   fprintf( outputFile, "\t%s\t%%ecx, %%eax\n", op );
+   Asm_writeSet( instr->x, function, outputFile );
 }
 
 
 
 static void Asm_writeBinOpComp( char* op, Instr* instr, Function* function, FILE* outputFile )
 {
-   // Buffers para guardar as strings representando os enderecos
-   char bufferX[ASM_ADDR_BUFFER_SIZE];
-   char bufferY[ASM_ADDR_BUFFER_SIZE];
-   char bufferZ[ASM_ADDR_BUFFER_SIZE];
-   Asm_getAddr( instr->x, function, bufferX );
-   Asm_getAddr( instr->y, function, bufferY );
-   Asm_getAddr( instr->z, function, bufferZ );
+   // O resultado vem das flags, sem desvios
+   char buffer[ASM_ADDR_BUFFER_SIZE];
+   Asm_writeGet( instr->y, "%eax", function, outputFile );
+   if ( instr->z.type == AD_NUMBER )
+   {
+      Asm_getAddr( instr->z, function, buffer );
+      fprintf( outputFile, "\tcmpl\t%s, %%eax\n", buffer );
+   }
+   else
+   {
+      Asm_writeGet( instr->z, "%ecx", function, outputFile );
+      fprintf( outputFile, "\tcmpl\t%%ecx, %%eax\n" );
+   }
+   fprintf( outputFile, "\t%s\t%%al\n"
+                        "\tmovzbl\t%%al, %%eax\n",
+                        op );
+   Asm_writeSet( instr->x, function, outputFile );
+}
+
+
+
+static int Asm_isFusedBranch( Instr* instr )
+{
+   // x = a < b; if x goto L
+   if ( !Asm_options.fuseBranches || instr->op < OP_NE || instr->op > OP_GE ) return 0;
+   Instr* branch = instr->next;
+   return branch && ( branch->op == OP_IF || branch->op == OP_IF_FALSE ) && Addr_eq( branch->x, instr->x );
+}
+
+
+
+static void Asm_writeFusedBranch( Instr* compare, Function* function, FILE* outputFile )
+{
+   // O resultado ainda e guardado, pois pode ser usado depois, mas o
+   // desvio usa as flags da comparacao em vez de testa-lo de novo
+   static char* conditions[] = { "ne", "e", "l", "g", "le", "ge" };
+   static char* negated[] = { "e", "ne", "ge", "le", "g", "l" };
+   char set[8];
+   Instr* branch = compare->next;
+   int c = compare->op - OP_NE;
+   sprintf( set, "set%s", conditions[c] );
+   Asm_writeBinOpComp( set, compare, function, outputFile );
+   fprintf( outputFile, "\tj%s\t%s\n", branch->op == OP_IF ? conditions[c] : negated[c], branch->y.str );
+   if ( Remark_wants( function ) )
+      Remark_emit( REMARK_PASSED, "branch-fusion", function, Remark_index( function, branch ),
+                   "%s usa as flags de %s", branch->op == OP_IF ? "if" : "ifFalse", compare->x.str );
+}
+
+
+
+static int Asm_isSelect( BasicBlock* block, Function* function )
+{
+   // if c goto L1; x = a; goto L2; L1: x = b; L2:
+   // sem outros desvios para L1
+   Instr* branch = Block_getInstr( block, block->nInstr-1 );
+   if ( branch->op != OP_IF && branch->op != OP_IF_FALSE ) return 0;
+   BasicBlock* left = block->next;
+   if ( left == NULL || left->nInstr != 2 || left->next == NULL ) return 0;
+   BasicBlock* right = left->next;
+   if ( right->nInstr != 2 || right->next == NULL ) return 0;
+   Instr* setLeft = left->instr;
+   Instr* jump = setLeft->next;
+   Instr* label = right->instr;
+   Instr* setRight = label->next;
+   Instr* join = right->next->instr;
+   if ( setLeft->op != OP_SET || jump->op != OP_GOTO ||
+        label->op != OP_LABEL || setRight->op != OP_SET || join->op != OP_LABEL )
+      return 0;
+   if ( strcmp( branch->y.str, label->x.str ) != 0 || strcmp( jump->x.str, join->x.str ) != 0 ||
+        !Addr_eq( setLeft->x, setRight->x ) )
+      return 0;
+
+   return Asm_countJumpsTo( label->x.str ) == 1;
+}
+
+
+
+static void Asm_writeSelect( Instr* branch, BasicBlock* left, Function* function, FILE* outputFile )
+{
+   Instr* setLeft = left->instr;
+   Instr* setRight = left->next->instr->next;
+
+   // Os dois valores sao lidos e o desvio escolhe com cmov
+   Asm_writeGet( setLeft->y, "%eax", function, outputFile );
+   Asm_writeGet( setRight->y, "%ecx", function, outputFile );
+   Asm_writeGet( branch->x, "%edx", function, outputFile );
+   fprintf( outputFile, "\ttestl\t%%edx, %%edx\n"
+                        "\t%s\t%%ecx, %%eax\n",
+                        ( branch->op == OP_IF ) ? "cmovne" : "cmove" );
+   Asm_writeSet( setLeft->x, function, outputFile );
+}
+
+
+
+static int Asm_switchLength( BasicBlock* block, Function* function )
+{
+   // Blocos seguidos terminando em x == K; if t goto L, sobre o mesmo x
+   Addr var;
+   int key = 0;
+   int n = 0;
+   if ( block->nInstr < 2 || !Asm_switchCase( Block_getInstr( block, block->nInstr-2 ), &var, &key ) ) return 0;
+   for ( BasicBlock* next = block->next ; next && next->nInstr == 2 ; next = next->next )
+   {
+      Addr nextVar;
+      if ( !Asm_switchCase( next->instr, &nextVar, &key ) || !Addr_eq( var, nextVar ) ) break;
+      n++;
+   }
+   if ( n+1 < ASM_SWITCH_MIN_CASES ) return 0;
+
+   // Os resultados das comparacoes so podem ser usados pelos ifs
+   BasicBlock* caseBlock = block;
+   Instr* test = Block_getInstr( block, block->nInstr-2 );
+   for ( int c = 0 ; c <= n ; c++ )
+   {
+      if ( Asm_tempUses[ test->x.num ] != 1 ) return 0;
+      caseBlock = caseBlock->next;
+      if ( caseBlock ) test = caseBlock->instr;
+   }
+   return n+1;
+}
+
+
+
+static void Asm_countTempUses( Function* function )
+{
+   // Uma passada por funcao, em vez de uma por caso de cada cadeia
+   Asm_tempUses = (int*) calloc( Function_nTemps( function )+1, sizeof(int) );
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      if ( instr->y.type == AD_TEMP ) Asm_tempUses[ instr->y.num ]++;
+      if ( instr->z.type == AD_TEMP ) Asm_tempUses[ instr->z.num ]++;
+      if ( instr->x.type == AD_TEMP && !Instr_hasDef( instr ) ) Asm_tempUses[ instr->x.num ]++;
+   }
+}
+
+
+
+static void Asm_collectJumpTargets( Function* function )
+{
+   // Como em Asm_countTempUses, uma passada por funcao em vez de uma por
+   // candidato a cmov
+   Asm_nJumpTargets = 0;
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+      if ( Instr_jumpTarget( instr ) ) Asm_nJumpTargets++;
+   Asm_jumpTargets = (char**) malloc( (Asm_nJumpTargets+1) * sizeof(char*) );
+   Asm_nJumpTargets = 0;
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      Addr* target = Instr_jumpTarget( instr );
+      if ( target ) Asm_jumpTargets[ Asm_nJumpTargets++ ] = target->str;
+   }
+   qsort( Asm_jumpTargets, Asm_nJumpTargets, sizeof(char*), Asm_compareLabels );
+}
+
+
+
+static int Asm_countJumpsTo( const char* label )
+{
+   char** found = (char**) bsearch( &label, Asm_jumpTargets, Asm_nJumpTargets, sizeof(char*), Asm_compareLabels );
+   if ( found == NULL ) return 0;
+   // Os iguais estao juntos em volta do encontrado
+   char** first = found;
+   char** last = found;
+   while ( first > Asm_jumpTargets && strcmp( first[-1], label ) == 0 ) first--;
+   while ( last+1 < Asm_jumpTargets + Asm_nJumpTargets && strcmp( last[1], label ) == 0 ) last++;
+   return last - first + 1;
+}
+
+
+
+static int Asm_switchCase( Instr* test, Addr* var, int* key )
+{
+   // x == K ou K == x, seguido de if sobre o resultado
+   Instr* branch = test->next;
+   if ( test->op != OP_EQ || branch == NULL || branch->op != OP_IF || !Addr_eq( branch->x, test->x ) ) return 0;
+   if ( test->x.type != AD_TEMP ) return 0;
+   if ( test->z.type == AD_NUMBER && ( test->y.type == AD_LOCAL || test->y.type == AD_TEMP || test->y.type == AD_GLOBAL ) )
+   {
+      *var = test->y;
+      *key = test->z.num;
+   }
+   else if ( test->y.type == AD_NUMBER && ( test->z.type == AD_LOCAL || test->z.type == AD_TEMP || test->z.type == AD_GLOBAL ) )
+   {
+      *var = test->z;
+      *key = test->y.num;
+   }
+   else
+      return 0;
+   return !Addr_eq( *var, test->x );
+}
+
+
+
+static void Asm_writeSwitch( BasicBlock* block, int nCases, Function* function, FILE* outputFile )
+{
    int label = Asm_generateLabel();
+   SwitchCase* cases = (SwitchCase*) malloc( nCases * sizeof(SwitchCase) );
+   Addr var;
+   int nKeys = 0;
+
+   // Casos em ordem de chave; em chaves repetidas vale o primeiro teste
+   BasicBlock* caseBlock = block;
+   Instr* test = Block_getInstr( block, block->nInstr-2 );
+   for ( int c = 0 ; c < nCases ; c++ )
+   {
+      int key = 0;
+      Asm_switchCase( test, &var, &key );
+      int repeated = 0;
+      for ( int k = 0 ; k < nKeys ; k++ )
+         if ( cases[k].key == key ) repeated = 1;
+      if ( !repeated )
+      {
+         cases[ nKeys ].key = key;
+         cases[ nKeys ].label = test->next->y.str;
+         nKeys++;
+      }
+      caseBlock = caseBlock->next;
+      if ( caseBlock ) test = caseBlock->instr;
+   }
+   qsort( cases, nKeys, sizeof(SwitchCase), Asm_compareCases );
 
-   fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                        "\tmovl\t%s, %%ecx\n"
-                        "\tcmpl\t%%ecx, %%eax\n"
-                        "\t%s\t.LComp_%d_a\n"
-                        "\tmovl\t$0, %%eax\n"
-                        "\tjmp\t.LComp_%d_b\n"
-                        ".LComp_%d_a:\n"
-                        "\tmovl\t$1, %%eax\n"
-                        ".LComp_%d_b:\n"
-                        "\tmovl\t%%eax, %s\n",
-                        bufferY,
-                        bufferZ,
-                        op, label,
-                        label,
-                        label,
-                        label,
-                        bufferX );
+   Asm_writeGet( var, "%eax", function, outputFile );
+   long long range = (long long) cases[ nKeys-1 ].key - cases[0].key + 1;
+   if ( range <= ASM_SWITCH_DENSITY * nKeys )
+   {
+      // Chaves densas: tabela de desvios indexada por x - menor chave
+      if ( cases[0].key != 0 )
+         fprintf( outputFile, "\tsubl\t$%d, %%eax\n", cases[0].key );
+      fprintf( outputFile, "\tcmpl\t$%d, %%eax\n"
+                           "\tja\t.LSwitch_%d_default\n"
+                           "\tjmp\t*.LSwitch_%d_table(,%%eax,4)\n"
+                           ".section .rodata\n"
+                           "\t.align 4\n"
+                           ".LSwitch_%d_table:\n",
+                           (int) range - 1,
+                           label,
+                           label,
+                           label );
+      int k = 0;
+      for ( long long value = cases[0].key ; value <= cases[ nKeys-1 ].key ; value++ )
+      {
+         if ( cases[k].key == value )
+            fprintf( outputFile, "\t.long\t%s\n", cases[ k++ ].label );
+         else
+            fprintf( outputFile, "\t.long\t.LSwitch_%d_default\n", label );
+      }
+      fprintf( outputFile, ".previous\n" );
+   }
+   else
+   {
+      // Chaves esparsas: busca binaria por comparacoes
+      int nNodes = 0;
+      Asm_writeDecisionTree( cases, 0, nKeys-1, label, &nNodes, outputFile );
+   }
+   fprintf( outputFile, ".LSwitch_%d_default:\n", label );
+   free( cases );
+}
+
+
+
+static void Asm_writeDecisionTree( SwitchCase* cases, int lo, int hi, int label, int* nNodes, FILE* outputFile )
+{
+   if ( hi - lo < ASM_SWITCH_MIN_CASES - 1 )
+   {
+      for ( int k = lo ; k <= hi ; k++ )
+         fprintf( outputFile, "\tcmpl\t$%d, %%eax\n"
+                              "\tje\t%s\n",
+                              cases[k].key,
+                              cases[k].label );
+      fprintf( outputFile, "\tjmp\t.LSwitch_%d_default\n", label );
+      return;
+   }
+   int mid = (lo + hi) / 2;
+   int right = (*nNodes)++;
+   fprintf( outputFile, "\tcmpl\t$%d, %%eax\n"
+                        "\tje\t%s\n"
+                        "\tjg\t.LSwitch_%d_%d\n",
+                        cases[mid].key,
+                        cases[mid].label,
+                        label, right );
+   Asm_writeDecisionTree( cases, lo, mid-1, label, nNodes, outputFile );
+   fprintf( outputFile, ".LSwitch_%d_%d:\n", label, right );
+   Asm_writeDecisionTree( cases, mid+1, hi, label, nNodes, outputFile );
 }
 
 
 
+static int Asm_compareCases( const void* a, const void* b )
+{
+   const SwitchCase* ca = (const SwitchCase*) a;
+   const SwitchCase* cb = (const SwitchCase*) b;
+   if ( ca->key == cb->key ) return 0;
+   return ( ca->key < cb->key ) ? -1 : 1;
+}
+
+
+
+static int Asm_compareLabels( const void* a, const void* b )
+{
+   return strcmp( *(char* const*) a, *(char* const*) b );
+}
+
+
 
 static void Asm_writeNew( int size, Instr* instr, Function* function, FILE* outputFile )
 {
-   // Buffers para guardar as strings representando os enderecos
-   char bufferX[ASM_ADDR_BUFFER_SIZE];
-   char bufferY[ASM_ADDR_BUFFER_SIZE];
-   Asm_getAddr( instr->x, function, bufferX );
-   Asm_getAddr( instr->y, function, bufferY );
-   fprintf( outputFile, "\tmovl\t%s, %%eax\n"
-                        "\timul\t$%d, %%eax\n"
-                        "\tpushl\t%%eax\n"
-                        "\tcall\tmalloc\n"
-                        "\taddl\t$4, %%esp\n"
-                        "\tmovl\t%%eax, %s\n",
-                        bufferY,
-                        size,
-                        bufferX );
+   // Com -falloc-profile todo new passa pelo runtime, que conta o ponto
+   if ( Asm_options.allocProfile )
+   {
+      Asm_writeGet( instr->y, "%eax", function, outputFile );
+      if ( size != 1 )
+         fprintf( outputFile, "\timul\t$%d, %%eax\n", size );
+      Asm_writeProfiledAlloc( outputFile );
+      Asm_writeSet( instr->x, function, outputFile );
+      return;
+   }
+   if ( Asm_options.runtimeAlloc )
+   {
+      Asm_writeRuntimeNew( size, instr, function, outputFile );
+      return;
+   }
+   Asm_writeGet( instr->y, "%eax", function, outputFile );
+   fprintf( outputFile, "\timul\t$%d, %%eax\n", size );
+   Asm_writeAllocCall( "malloc", outputFile );
+   Asm_writeSet( instr->x, function, outputFile );
+}
+
+
+
+static void Asm_writeRuntimeNew( int size, Instr* instr, Function* function, FILE* outputFile )
+{
+   int label = Asm_generateLabel();
+
+   // Tamanho constante: o tamanho do bloco e conhecido aqui
+   if ( instr->y.type == AD_NUMBER )
+   {
+      int bytes = size * instr->y.num;
+      if ( bytes < 0 || bytes > RUNTIME_MAX_SMALL - 4 )
+      {
+         fprintf( outputFile, "\tmovl\t$%d, %%eax\n", bytes );
+         Asm_writeAllocCall( "Runtime_alloc", outputFile );
+         Asm_writeSet( instr->x, function, outputFile );
+         return;
+      }
+      fprintf( outputFile, "\tmovl\tRuntime_heapNext, %%ecx\n"
+                           "\tleal\t%d(%%ecx), %%eax\n",
+                           Runtime_blockSize( bytes ) );
+   }
+   else
+   {
+      // O tamanho pedido fica em %edx para o caminho lento
+      Asm_writeGet( instr->y, "%eax", function, outputFile );
+      if ( size != 1 )
+         fprintf( outputFile, "\timul\t$%d, %%eax\n", size );
+      fprintf( outputFile, "\tmovl\t%%eax, %%edx\n"
+                           "\tcmpl\t$%d, %%eax\n"
+                           "\tja\t.LNew_%d_slow\n"
+                           "\taddl\t$%d, %%eax\n"
+                           "\tandl\t$%d, %%eax\n"
+                           "\tmovl\tRuntime_heapNext, %%ecx\n"
+                           "\taddl\t%%ecx, %%eax\n",
+                           RUNTIME_MAX_SMALL - 4,
+                           label,
+                           4 + RUNTIME_GRANULE - 1,
+                           -RUNTIME_GRANULE );
+   }
+
+   // Caminho rapido: avanca o apontador se o bloco couber na regiao atual
+   fprintf( outputFile, "\tcmpl\tRuntime_heapLimit, %%eax\n"
+                        "\tja\t.LNew_%d_slow\n"
+                        "\tmovl\t%%eax, Runtime_heapNext\n",
+                        label );
+   if ( instr->y.type == AD_NUMBER )
+      fprintf( outputFile, "\tmovl\t$%d, (%%ecx)\n", Runtime_blockSize( size * instr->y.num ) );
+   else
+      fprintf( outputFile, "\tsubl\t%%ecx, %%eax\n"
+                           "\tmovl\t%%eax, (%%ecx)\n" );
+   fprintf( outputFile, "\tleal\t4(%%ecx), %%eax\n"
+                        "\tjmp\t.LNew_%d_done\n"
+                        ".LNew_%d_slow:\n",
+                        label,
+                        label );
+   if ( instr->y.type == AD_NUMBER )
+      fprintf( outputFile, "\tmovl\t$%d, %%eax\n", size * instr->y.num );
+   else
+      fprintf( outputFile, "\tmovl\t%%edx, %%eax\n" );
+   Asm_writeAllocCall( "Runtime_alloc", outputFile );
+   fprintf( outputFile, ".LNew_%d_done:\n", label );
+   Asm_writeSet( instr->x, function, outputFile );
+}
+
+
+
+static void Asm_writeProfiledAlloc( FILE* outputFile )
+{
+   // Runtime_profiledAlloc( tamanho em %eax, registro do ponto )
+   int site = Asm_allocSite++;
+   if ( Asm_outArea >= 8 )
+      fprintf( outputFile, "\tmovl\t%%eax, 0(%%esp)\n"
+                           "\tmovl\t$.LAlloc_sites+%d, 4(%%esp)\n"
+                           "\tcall\tRuntime_profiledAlloc\n",
+                           ASM_ALLOC_SITE_SIZE * site );
+   else
+      fprintf( outputFile, "\tpushl\t$.LAlloc_sites+%d\n"
+                           "\tpushl\t%%eax\n"
+                           "\tcall\tRuntime_profiledAlloc\n"
+                           "\taddl\t$8, %%esp\n",
+                           ASM_ALLOC_SITE_SIZE * site );
+}
+
+
+
+static void Asm_writeAllocCall( const char* allocator, FILE* outputFile )
+{
+   // Tamanho em %eax, passado pela area de saida se houver
+   if ( Asm_outArea >= 4 )
+      fprintf( outputFile, "\tmovl\t%%eax, 0(%%esp)\n"
+                           "\tcall\t%s\n",
+                           allocator );
+   else
+      fprintf( outputFile, "\tpushl\t%%eax\n"
+                           "\tcall\t%s\n"
+                           "\taddl\t$4, %%esp\n",
+                           allocator );
+}
+
+
+
+static void Asm_writeLoad( int size, Instr* instr, Function* function, FILE* outputFile )
+{
+   const char* load = ( size == 1 ) ? "movsbl" : "movl";
+
+   // Indice constante vira deslocamento, sem calculo de endereco
+   if ( instr->z.type == AD_NUMBER )
+   {
+      Asm_writeGet( instr->y, "%ecx", function, outputFile );
+      fprintf( outputFile, "\t%s\t%d(%%ecx), %%eax\n",
+                           load, size * instr->z.num );
+      Asm_writeSet( instr->x, function, outputFile );
+      return;
+   }
+
+   Asm_writeGet( instr->z, "%eax", function, outputFile );
+   Asm_writeGet( instr->y, "%ecx", function, outputFile );
+   if ( size != 1 )
+      fprintf( outputFile, "\timul\t$%d, %%eax\n", size );
+   fprintf( outputFile, "\taddl\t%%ecx, %%eax\n"
+                        "\t%s\t(%%eax), %%eax\n",
+                        load );
+   Asm_writeSet( instr->x, function, outputFile );
+}
+
+
+
+static void Asm_writeStore( int size, Instr* instr, Function* function, FILE* outputFile )
+{
+   const char* store = ( size == 1 ) ? "movb\t%cl" : "movl\t%ecx";
+
+   // Indice constante vira deslocamento, sem calculo de endereco
+   if ( instr->y.type == AD_NUMBER )
+   {
+      Asm_writeGet( instr->x, "%eax", function, outputFile );
+      Asm_writeGet( instr->z, "%ecx", function, outputFile );
+      fprintf( outputFile, "\t%s, %d(%%eax)\n",
+                           store, size * instr->y.num );
+      return;
+   }
+
+   Asm_writeGet( instr->y, "%eax", function, outputFile );
+   Asm_writeGet( instr->x, "%ecx", function, outputFile );
+   if ( size != 1 )
+      fprintf( outputFile, "\timul\t$%d, %%eax\n", size );
+   fprintf( outputFile, "\taddl\t%%ecx, %%eax\n" );
+   Asm_writeGet( instr->z, "%ecx", function, outputFile );
+   fprintf( outputFile, "\t%s, (%%eax)\n",
+                        store );
+}
+
+
+
+static void Asm_writeTailCall( Instr* instr, Function* function, FILE* outputFile )
+{
+   char bufferArg[ASM_ADDR_BUFFER_SIZE];
+   int nRegArgs = Asm_nRegArgs( instr->x.str );
+   if ( nRegArgs > instr->y.num ) nRegArgs = instr->y.num;
+
+   // Argumentos em registradores sao lidos antes que os da pilha sejam sobrescritos
+   for ( int r = 0 ; r < nRegArgs ; r++ )
+      Asm_writeGet( Asm_regParams[r], Asm_argRegisters[r], function, outputFile );
+   // Os params da pilha passam para as posicoes dos argumentos desta funcao,
+   // sem passar por registradores
+   for ( int slot = 0 ; slot < instr->y.num - nRegArgs ; slot++ )
+   {
+      Asm_getStackArg( slot, bufferArg );
+      fprintf( outputFile, "\tpushl\t%d(%%esp)\n"
+                           "\tpopl\t%s\n",
+                           4 * slot,
+                           bufferArg );
+   }
+   // Descarta os params e desfaz o registro de ativacao antes do salto
+   if ( Asm_useEsp && Asm_pushDepth > 0 )
+      fprintf( outputFile, "\taddl\t$%d, %%esp\n", Asm_pushDepth );
+   Asm_writeEpilogue( outputFile );
+   if ( Asm_outArea < 0 )
+      Asm_pushDepth -= 4 * (instr->y.num - nRegArgs);
+   fprintf( outputFile, "\tjmp\t%s\n", Asm_calleeName( instr ) );
 }
 
 
 
 static void Asm_writeReturn( FILE* outputFile )
 {
-   // Recupera os registradores
-   fprintf( outputFile, "\tpopl\t%%edi\n"
-                        "\tpopl\t%%esi\n"
-                        "\tpopl\t%%ebx\n" );
+   Asm_writeEpilogue( outputFile );
+   fprintf( outputFile, "\tret\n" );
+}
+
+
+
+static void Asm_writeEpilogue( FILE* outputFile )
+{
+   // Descarta a area de saida e params ainda empilhados
+   if ( Asm_useEsp && Asm_outArea > 0 )
+      fprintf( outputFile, "\taddl\t$%d, %%esp\n", Asm_outArea );
    // Retorno de registro de ativacao
+   if ( Asm_useEsp )
+   {
+      if ( Asm_frame->size > 0 )
+         fprintf( outputFile, "\taddl\t$%d, %%esp\n", Asm_frame->size );
+      return;
+   }
    fprintf( outputFile, "\tmovl\t%%ebp, %%esp\n"
-                        "\tpopl\t%%ebp\n"
-                        "\tret\n" );
+                        "\tpopl\t%%ebp\n" );
+}
+
+
+
+static int Asm_isTailCall( Instr* instr, Function* function )
+{
+   // Quem chamou esta funcao desempilha os argumentos, entao a funcao
+   // chamada nao pode receber mais argumentos do que esta
+   if ( !Asm_options.tailCalls || instr->op != OP_CALL || instr->next == NULL ) return 0;
+   if ( instr->y.num - Asm_nRegArgs( instr->x.str ) > function->nArgs - Asm_nRegArgs( function->name ) ) return 0;
+   Instr* next = instr->next;
+   if ( next->op == OP_RET ) return 1;
+   return next->op == OP_RET_VAL && next->x.type == AD_TEMP && strcmp( next->x.str, "$ret" ) == 0;
+}
+
+
+
+static int Asm_isLeaf( Function* function )
+{
+   // Sem chamadas nem alocacoes, %esp nao muda dentro do corpo
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+      if ( instr->op == OP_CALL || instr->op == OP_PARAM ||
+           instr->op == OP_NEW || instr->op == OP_NEW_BYTE )
+         return 0;
+   return 1;
+}
+
+
+
+static const char* Asm_calleeName( Instr* call )
+{
+   // Blocos do alocador de runtime.c voltam para ele
+   if ( Asm_options.runtimeAlloc && strcmp( call->x.str, "free" ) == 0 )
+      return "Runtime_free";
+   return call->x.str;
+}
+
+
+
+static int Asm_nRegArgs( const char* name )
+{
+   // Ate tres argumentos em %eax, %edx e %ecx, como no regparm(3) do gcc
+   CallNode* node = Asm_callGraph ? CallGraph_find( Asm_callGraph, name ) : NULL;
+   if ( node == NULL || !node->isInternal ) return 0;
+   return ( node->function->nArgs < 3 ) ? node->function->nArgs : 3;
+}
+
+
+
+static Instr* Asm_findCall( Instr* param, int* arg )
+{
+   // O ultimo param antes do call eh o primeiro argumento
+   *arg = 0;
+   for ( Instr* instr = param->next ; instr ; instr = instr->next )
+   {
+      if ( instr->op == OP_CALL ) return instr;
+      if ( instr->op != OP_PARAM ) return NULL;
+      (*arg)++;
+   }
+   return NULL;
+}
+
+
+
+static int Asm_outgoingSize( Function* function )
+{
+   // Maior numero de params na pilha de um call; -1 se algum param
+   // nao estiver logo antes do seu call
+   if ( Asm_callGraph == NULL ) return -1;
+   int size = 0;
+   int nParams = 0;
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      if ( instr->op == OP_PARAM )
+      {
+         nParams++;
+         continue;
+      }
+      if ( instr->op == OP_CALL )
+      {
+         if ( nParams != instr->y.num ) return -1;
+         int stack = 4 * (nParams - Asm_nRegArgs( instr->x.str ));
+         if ( stack > size ) size = stack;
+      }
+      else if ( nParams > 0 )
+      {
+         return -1;
+      }
+      int allocArgs = Asm_options.allocProfile ? 8 : 4;
+      if ( ( instr->op == OP_NEW || instr->op == OP_NEW_BYTE ) && size < allocArgs ) size = allocArgs;
+      nParams = 0;
+   }
+   return ( nParams > 0 ) ? -1 : size;
+}
+
+
+
+static void Asm_getStackArg( int slot, char* output )
+{
+   // Posicao dos argumentos que esta funcao recebeu pela pilha
+   if ( !Asm_useEsp )
+   {
+      sprintf( output, "%d(%%ebp)", 4 * (slot + 2) );
+      return;
+   }
+   int outArea = ( Asm_outArea > 0 ) ? Asm_outArea : 0;
+   sprintf( output, "%d(%%esp)", Asm_pushDepth + outArea + Asm_frame->size + 4 * (slot + 1) );
+}
+
+
+
+static void Asm_writeGet( Addr addr, const char* reg, Function* function, FILE* outputFile )
+{
+   char buffer[ASM_ADDR_BUFFER_SIZE];
+   Asm_getAddr( addr, function, buffer );
+   // Variaveis de um byte sao estendidas com sinal
+   fprintf( outputFile, "\t%s\t%s, %s\n",
+                        Asm_isByte( addr, function ) ? "movsbl" : "movl",
+                        buffer,
+                        reg );
+}
+
+
+
+static void Asm_writeSet( Addr addr, Function* function, FILE* outputFile )
+{
+   // Guarda o valor de %eax
+   char buffer[ASM_ADDR_BUFFER_SIZE];
+   Asm_getAddr( addr, function, buffer );
+   fprintf( outputFile, "\t%s, %s\n",
+                        Asm_isByte( addr, function ) ? "movb\t%al" : "movl\t%eax",
+                        buffer );
+}
+
+
+
+static int Asm_isByte( Addr addr, Function* function )
+{
+   if ( addr.type == AD_LOCAL ) return Asm_frame->isByte[ addr.num ];
+   if ( addr.type == AD_TEMP ) return Asm_frame->isByte[ Function_nLocals( function ) + addr.num ];
+   return 0;
 }
 
 
@@ -379,38 +1261,24 @@ static void Asm_getAddr( Addr addr, Function* function, char* output )
 static void Asm_translateAddr( Addr addr, Function* function, char* output )
 {
    int nLocals = Function_nLocals( function );
-   int nArgs = function->nArgs;
-   int pos = 0;
+   int var = 0;
 
    switch ( addr.type )
    {
-      // Pega variaveis globais e strings de .data
+      // Variaveis globais ficam em .comm, strings sao usadas pelo endereco
       case AD_GLOBAL :
+         sprintf( output, "%s", addr.str );
+         break;
+
       case AD_STRING :
          sprintf( output, "$%s", addr.str );
          break;
 
-      // Para as variaveis locais verifica se sao parametros ou internas
+      // Locais e temporarias na posicao dada pela disposicao do registro
       case AD_LOCAL :
-         if ( addr.num < nArgs ) // Eh parametro da funcao
-         {
-            pos = addr.num + 2; // +2 pelo deslocamento do %ebp e do end de retorno
-         }
-         else // Eh variavel interna
-         {
-            pos = addr.num - nArgs + 1; // +1 pelo deslocamento do %ebp
-            pos = -pos; // Pois os enderecos crescem pra baixo
-         }
-         pos *= 4; // Variaveis de 4 bytes
-         sprintf( output, "%d(%%ebp)", pos );
-         break;
-
-      // As variaveis temporarias sao alocadas apos as locais
       case AD_TEMP :
-         pos = nLocals - nArgs + addr.num + 1; // +1 pelo deslocamento do %ebp
-         pos = -pos; // Pois os enderecos crescem pra baixo
-         pos *= 4; // Variaveis de 4 bytes
-         sprintf( output, "%d(%%ebp)", pos );
+         var = ( addr.type == AD_LOCAL ) ? addr.num : nLocals + addr.num;
+         Asm_frameAddr( Asm_frame->offset[var], output );
          break;
 
       // Constantes numericas
@@ -426,6 +1294,39 @@ static void Asm_translateAddr( Addr addr, Function* function, char* output )
 
 
 
+static void Asm_frameAddr( int offset, char* output )
+{
+   if ( !Asm_useEsp )
+   {
+      sprintf( output, "%d(%%ebp)", offset );
+      return;
+   }
+   // Sem %ebp: o endereco de retorno fica logo acima das variaveis,
+   // e abaixo delas os registradores salvos e os params empilhados
+   int pos = Asm_pushDepth + Asm_frame->size + offset;
+   if ( Asm_outArea > 0 ) pos += Asm_outArea;
+   if ( offset > 0 ) pos -= 4; // Nao ha %ebp empilhado
+   sprintf( output, "%d(%%esp)", pos );
+}
+
+
+
+static int Asm_getRetTemp( Function* function, Addr* ret )
+{
+   int i = 0;
+   for ( Variable* v = function->temps ; v ; v = v->next, i++ )
+      if ( strcmp( v->name, "$ret" ) == 0 )
+      {
+         ret->type = AD_TEMP;
+         ret->str = (char*) v->name;
+         ret->num = i;
+         return 1;
+      }
+   return 0;
+}
+
+
+
 static int Asm_generateLabel()
 {
    static int nLabel = 0;
@@ -532,6 +1433,7 @@ static void Block_computeNextUsage( BasicBlock* block, Function* function )
          case OP_NEG:
          case OP_NEW:
          case OP_NEW_BYTE:
+         case OP_NEW_FRAME:
          case OP_SET_IDX:
          case OP_SET_IDX_BYTE:
             Block_setUsage( instr->x, -1, usageInfo, nLocals );
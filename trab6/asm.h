@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include "ir.h"
+#include "profile.h"
 
 typedef struct BasicBlock_ BasicBlock;
 struct BasicBlock_ {
@@ -20,7 +21,22 @@ struct BasicBlock_ {
    Variable** addressDescriptor;
 };
 
-void Asm_write( IR* program, FILE* outputFile );
+typedef struct AsmOptions_ {
+   int tailCalls; // Chamadas em posicao de retorno reaproveitam o registro de ativacao
+   int shareSlots; // Variaveis com vidas disjuntas dividem posicoes do registro
+   FILE* frameStats; // Relatorio do tamanho dos registros, NULL para nenhum
+   int omitFramePointer; // Sem %ebp: 0 nunca, 1 nas funcoes folha, 2 sempre
+   int registerArgs; // Funcoes internas recebem argumentos em registradores
+   int runtimeAlloc; // new usa o alocador de runtime.c em vez do malloc
+   int alignLoops; // Alinha os rotulos que sao destino de desvios para tras
+   Profile* profile; // Contadores inseridos por -fprofile-generate, NULL para nenhum
+   int splitCold; // Blocos que o perfil diz nunca executar vao para .text.unlikely
+   int fuseBranches; // Desvio sobre o resultado da comparacao anterior usa as flags
+   const char* allocProfile; // Relatorio por ponto de alocacao de -falloc-profile, NULL para nenhum
+   const char* sourceFile; // Arquivo .m0.ir das diretivas .file e .loc de -g, NULL para nenhum
+} AsmOptions;
+
+void Asm_write( IR* program, AsmOptions* options, FILE* outputFile );
 
 #endif
 
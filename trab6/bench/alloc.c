@@ -0,0 +1,87 @@
+/**
+ * @file    alloc.c
+ * @author  lhpelosi
+ *
+ * Vazao de alocacao do alocador de runtime.c comparada com malloc/free:
+ * blocos pequenos de tamanhos variados, com um conjunto fixo de blocos
+ * vivos em que o mais antigo e liberado a cada nova alocacao.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../runtime.h"
+
+#define BENCH_LIVE 1024
+
+static double Bench_now();
+static double Bench_runtime( int n, const int* sizes );
+static double Bench_malloc( int n, const int* sizes );
+
+
+
+int main( int argc, char** argv )
+{
+   int n = ( argc > 1 ) ? atoi( argv[1] ) : 10000000;
+   int* sizes = (int*) malloc( 4096 * sizeof(int) );
+
+   // Os mesmos tamanhos para os dois alocadores, como os de new em Mini0
+   srand( 1715 );
+   for ( int i = 0 ; i < 4096 ; i++ )
+      sizes[i] = 4 * ( 1 + rand() % 16 );
+
+   double tMalloc = Bench_malloc( n, sizes );
+   double tRuntime = Bench_runtime( n, sizes );
+   printf( "alocacoes: %d\n", n );
+   printf( "malloc:    %8.2f ns/alocacao\n", 1e9 * tMalloc / n );
+   printf( "runtime:   %8.2f ns/alocacao\n", 1e9 * tRuntime / n );
+   printf( "ganho:     %8.2fx\n", tMalloc / tRuntime );
+   free( sizes );
+   return 0;
+}
+
+
+
+static double Bench_now()
+{
+   struct timespec t;
+   clock_gettime( CLOCK_MONOTONIC, &t );
+   return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+
+
+static double Bench_runtime( int n, const int* sizes )
+{
+   void* live[ BENCH_LIVE ] = { NULL };
+   double start = Bench_now();
+   for ( int i = 0 ; i < n ; i++ )
+   {
+      int* p = (int*) Runtime_new( sizes[ i & 4095 ] );
+      p[0] = i;
+      Runtime_free( live[ i % BENCH_LIVE ] );
+      live[ i % BENCH_LIVE ] = p;
+   }
+   for ( int i = 0 ; i < BENCH_LIVE ; i++ )
+      Runtime_free( live[i] );
+   return Bench_now() - start;
+}
+
+
+
+static double Bench_malloc( int n, const int* sizes )
+{
+   void* live[ BENCH_LIVE ] = { NULL };
+   double start = Bench_now();
+   for ( int i = 0 ; i < n ; i++ )
+   {
+      int* p = (int*) malloc( sizes[ i & 4095 ] );
+      p[0] = i;
+      free( live[ i % BENCH_LIVE ] );
+      live[ i % BENCH_LIVE ] = p;
+   }
+   for ( int i = 0 ; i < BENCH_LIVE ; i++ )
+      free( live[i] );
+   return Bench_now() - start;
+}
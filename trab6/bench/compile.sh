@@ -0,0 +1,26 @@
+#!/bin/sh
+# Vazao do backend em programas gerados de tamanho crescente: para cada
+# tamanho, instrucoes lidas por segundo e memoria residente maxima,
+# tiradas de -ftime-report=json.
+#
+# Uso: bench/compile.sh [opcoes do backend]    (padrao: -O)
+
+BACKEND=${BACKEND:-./backend}
+GENIR=${GENIR:-./bench/genir}
+FLAGS=${*:--O}
+SIZES=${SIZES:-"250 500 1000 2000 4000 8000"}
+FUNCTIONS=${FUNCTIONS:-16}
+DIR=$(mktemp -d)
+
+printf "%10s %12s %12s %16s %12s\n" "instr/fun" "instrucoes" "tempo (ms)" "instrucoes/s" "RSS (KB)"
+for n in $SIZES; do
+   ir=$DIR/gen$n.m0.ir
+   $GENIR -s 1715 -f $FUNCTIONS -n $n -d 3 > $ir
+   instrs=$(grep -c '^	' $ir)
+   json=$($BACKEND $FLAGS -ftime-report=json $ir 2>&1 >/dev/null)
+   ms=$(echo "$json" | sed -n 's/.*"total_ms": \([0-9.]*\).*/\1/p')
+   rss=$(echo "$json" | sed -n 's/.*"max_rss_kb": \([0-9]*\).*/\1/p')
+   awk -v n=$n -v i=$instrs -v ms=$ms -v rss=$rss \
+       'BEGIN { printf "%10d %12d %12.1f %16.0f %12d\n", n, i, ms, ( ms > 0 ) ? 1000 * i / ms : 0, rss }'
+done
+rm -rf $DIR
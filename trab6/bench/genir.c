@@ -0,0 +1,261 @@
+/**
+ * @file    genir.c
+ * @author  lhpelosi
+ *
+ * Gera programas .m0.ir validos, de tamanho e forma configuraveis, para
+ * medir a vazao do backend. A mesma semente gera sempre o mesmo programa.
+ *
+ * Uso: genir [-s semente] [-f funcoes] [-n instrucoes] [-t temporarias]
+ *            [-d profundidade] [-a acessos] > programa.m0.ir
+ *
+ *   -f  numero de funcoes alem de main
+ *   -n  instrucoes por funcao, aproximadamente
+ *   -t  temporarias distintas por funcao
+ *   -d  profundidade maxima de lacos aninhados
+ *   -a  porcentagem das instrucoes que acessam vetores
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GEN_MAX_DEPTH 8
+#define GEN_LOOP_TRIPS 3 // Voltas de cada laco, menor que o tamanho dos vetores
+#define GEN_ARRAY_SIZE 16
+
+typedef struct GenOptions_ {
+   unsigned seed;
+   int nFunctions;
+   int nInstrs;
+   int nTemps;
+   int maxDepth;
+   int arrayPercent;
+} GenOptions;
+
+static GenOptions Gen_options = { 1715, 16, 200, 16, 2, 20 };
+static int Gen_label; // Proximo rotulo da funcao
+static int Gen_emitted; // Instrucoes ja escritas na funcao
+
+static void Gen_writeFunction( int f );
+static void Gen_writeBlock( int f, int depth, int budget );
+static void Gen_writeStatement( int f, int depth );
+static const char* Gen_value( int depth, char* buffer );
+static const char* Gen_index( int depth, char* buffer );
+static int Gen_random( int n );
+static int Gen_usage( const char* program );
+
+
+
+int main( int argc, char** argv )
+{
+   for ( int i = 1 ; i < argc ; i += 2 )
+   {
+      // Toda opcao exige um valor; uma opcao sozinha no fim e um erro
+      if ( i+1 >= argc )
+         return Gen_usage( argv[0] );
+      int value = atoi( argv[i+1] );
+      if ( strcmp( argv[i], "-s" ) == 0 ) Gen_options.seed = value;
+      else if ( strcmp( argv[i], "-f" ) == 0 ) Gen_options.nFunctions = value;
+      else if ( strcmp( argv[i], "-n" ) == 0 ) Gen_options.nInstrs = value;
+      else if ( strcmp( argv[i], "-t" ) == 0 ) Gen_options.nTemps = value;
+      else if ( strcmp( argv[i], "-d" ) == 0 ) Gen_options.maxDepth = value;
+      else if ( strcmp( argv[i], "-a" ) == 0 ) Gen_options.arrayPercent = value;
+      else
+         return Gen_usage( argv[0] );
+   }
+   if ( Gen_options.nTemps < 1 ) Gen_options.nTemps = 1;
+   if ( Gen_options.maxDepth > GEN_MAX_DEPTH ) Gen_options.maxDepth = GEN_MAX_DEPTH;
+   srand( Gen_options.seed );
+
+   printf( "global g\n\n" );
+   for ( int f = 0 ; f < Gen_options.nFunctions ; f++ )
+      Gen_writeFunction( f );
+
+   // main chama a ultima funcao, que chama as anteriores
+   printf( "fun main()\n" );
+   if ( Gen_options.nFunctions > 0 )
+   {
+      printf( "\tparam 2\n"
+              "\tparam 1\n"
+              "\tcall f%d 2\n"
+              "\tparam $ret\n"
+              "\tcall printi 1\n",
+              Gen_options.nFunctions-1 );
+   }
+   printf( "\tparam g\n"
+           "\tcall printi 1\n"
+           "\tret 0\n" );
+   return 0;
+}
+
+
+
+static void Gen_writeFunction( int f )
+{
+   Gen_label = 0;
+   Gen_emitted = 0;
+
+   // Todas as variaveis comecam definidas
+   printf( "fun f%d(a, b)\n"
+           "\tx = a + b\n"
+           "\ty = a - b\n"
+           "\tv = new %d\n",
+           f,
+           GEN_ARRAY_SIZE );
+   for ( int k = 0 ; k < GEN_ARRAY_SIZE ; k++ )
+      printf( "\tv[%d] = %d\n", k, k );
+   for ( int t = 0 ; t < Gen_options.nTemps ; t++ )
+      printf( "\t$t%d = %d\n", t, t );
+   Gen_emitted = 3 + GEN_ARRAY_SIZE + Gen_options.nTemps;
+
+   Gen_writeBlock( f, 0, Gen_options.nInstrs - Gen_emitted );
+   printf( "\tret x\n\n" );
+}
+
+
+
+static void Gen_writeBlock( int f, int depth, int budget )
+{
+   int end = Gen_emitted + budget;
+   while ( Gen_emitted < end )
+   {
+      int remaining = end - Gen_emitted;
+      int choice = Gen_random( 100 );
+      if ( depth < Gen_options.maxDepth && remaining > 16 && choice < 10 )
+      {
+         // Laco com contador proprio do nivel: i = 0; enquanto i < voltas
+         int start = Gen_label++;
+         int exit = Gen_label++;
+         printf( "\ti%d = 0\n"
+                 ".Lf%d_%d:\n"
+                 "\t$c%d = i%d < %d\n"
+                 "\tifFalse $c%d goto .Lf%d_%d\n",
+                 depth, f, start, depth, depth, GEN_LOOP_TRIPS, depth, f, exit );
+         Gen_emitted += 3;
+         Gen_writeBlock( f, depth+1, remaining / 3 );
+         printf( "\ti%d = i%d + 1\n"
+                 "\tgoto .Lf%d_%d\n"
+                 ".Lf%d_%d:\n",
+                 depth, depth, f, start, f, exit );
+         Gen_emitted += 2;
+      }
+      else if ( remaining > 8 && choice < 20 )
+      {
+         // if com os dois lados
+         char buffer[32];
+         int other = Gen_label++;
+         int join = Gen_label++;
+         printf( "\t$c%d = %s < %d\n"
+                 "\tif $c%d goto .Lf%d_%d\n",
+                 depth, Gen_value( depth, buffer ), Gen_random( 64 ), depth, f, other );
+         Gen_emitted += 2;
+         Gen_writeBlock( f, depth, remaining / 4 );
+         printf( "\tgoto .Lf%d_%d\n"
+                 ".Lf%d_%d:\n",
+                 f, join, f, other );
+         Gen_emitted++;
+         Gen_writeBlock( f, depth, remaining / 4 );
+         printf( ".Lf%d_%d:\n", f, join );
+      }
+      else
+      {
+         Gen_writeStatement( f, depth );
+      }
+   }
+}
+
+
+
+static void Gen_writeStatement( int f, int depth )
+{
+   static const char* ops[] = { "+", "-", "*", "+", "<", "==" };
+   char left[32];
+   char right[32];
+   int choice = Gen_random( 100 );
+   int t = Gen_random( Gen_options.nTemps );
+
+   if ( choice < Gen_options.arrayPercent / 2 )
+   {
+      printf( "\t$t%d = v[%s]\n", t, Gen_index( depth, left ) );
+      Gen_emitted++;
+   }
+   else if ( choice < Gen_options.arrayPercent )
+   {
+      printf( "\tv[%s] = %s\n", Gen_index( depth, left ), Gen_value( depth, right ) );
+      Gen_emitted++;
+   }
+   else if ( choice < Gen_options.arrayPercent + 3 && f > 0 )
+   {
+      // Chamadas so para funcoes anteriores, sem recursao
+      printf( "\tparam %s\n"
+              "\tparam %s\n"
+              "\tcall f%d 2\n"
+              "\t$t%d = $ret\n",
+              Gen_value( depth, left ), Gen_value( depth, right ), Gen_random( f ), t );
+      Gen_emitted += 4;
+   }
+   else if ( choice < Gen_options.arrayPercent + 6 )
+   {
+      printf( "\tg = g + %s\n", Gen_value( depth, left ) );
+      Gen_emitted++;
+   }
+   else if ( choice < Gen_options.arrayPercent + 10 )
+   {
+      printf( "\t$t%d = %s / %d\n", t, Gen_value( depth, left ), 1 + Gen_random( 7 ) );
+      Gen_emitted++;
+   }
+   else
+   {
+      const char* op = ops[ Gen_random( 6 ) ];
+      Gen_value( depth, left );
+      Gen_value( depth, right );
+      if ( Gen_random( 4 ) == 0 )
+         printf( "\t%s = %s %s %s\n", Gen_random( 2 ) ? "x" : "y", left, op, right );
+      else
+         printf( "\t$t%d = %s %s %s\n", t, left, op, right );
+      Gen_emitted++;
+   }
+}
+
+
+
+static const char* Gen_value( int depth, char* buffer )
+{
+   int choice = Gen_random( 10 );
+   if ( choice < 5 )
+      sprintf( buffer, "$t%d", Gen_random( Gen_options.nTemps ) );
+   else if ( choice < 7 )
+      sprintf( buffer, "%s", Gen_random( 2 ) ? "x" : "y" );
+   else if ( choice < 8 && depth > 0 )
+      sprintf( buffer, "i%d", Gen_random( depth ) );
+   else
+      sprintf( buffer, "%d", Gen_random( 100 ) );
+   return buffer;
+}
+
+
+
+static const char* Gen_index( int depth, char* buffer )
+{
+   // Contadores de laco ou constantes, sempre dentro do vetor
+   if ( depth > 0 && Gen_random( 2 ) )
+      sprintf( buffer, "i%d", Gen_random( depth ) );
+   else
+      sprintf( buffer, "%d", Gen_random( GEN_ARRAY_SIZE ) );
+   return buffer;
+}
+
+
+
+static int Gen_random( int n )
+{
+   return rand() % n;
+}
+
+
+
+static int Gen_usage( const char* program )
+{
+   fprintf( stderr, "Uso: %s [-s semente] [-f funcoes] [-n instrucoes] [-t temporarias] [-d profundidade] [-a acessos]\n", program );
+   return 1;
+}
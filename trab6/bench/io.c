@@ -0,0 +1,23 @@
+/**
+ * @file    io.c
+ * @author  lhpelosi
+ *
+ * Funcoes de saida chamadas pelos kernels de bench/kernels, ligadas com
+ * a libc de 32 bits.
+ */
+
+#include <stdio.h>
+
+
+
+void printi( int n )
+{
+   printf( "%d\n", n );
+}
+
+
+
+void prints( const char* s )
+{
+   printf( "%s\n", s );
+}
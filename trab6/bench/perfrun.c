@@ -0,0 +1,171 @@
+/**
+ * @file    perfrun.c
+ * @author  lhpelosi
+ *
+ * Executa um programa varias vezes e escreve a mediana do tempo de parede
+ * e, onde perf_event_open estiver disponivel, dos ciclos, instrucoes e
+ * desvios mal previstos do processo, so em modo usuario. Um contador
+ * indisponivel sai como "-". A saida do programa e descartada.
+ *
+ * Uso: perfrun [-r repeticoes] programa [argumentos]
+ *
+ * Saida: ms ciclos instrucoes desvios-errados
+ */
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PERF_N_EVENTS 3
+#define PERF_N_VALUES ( 1 + PERF_N_EVENTS ) // Tempo e contadores
+
+static const unsigned long long Perf_events[ PERF_N_EVENTS ] = {
+   PERF_COUNT_HW_CPU_CYCLES,
+   PERF_COUNT_HW_INSTRUCTIONS,
+   PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int Perf_run( char** argv, double* values );
+static int Perf_open( pid_t pid, unsigned long long config );
+static double Perf_median( double* values, int n );
+static int Perf_compare( const void* a, const void* b );
+static double Perf_now();
+
+
+
+int main( int argc, char** argv )
+{
+   int repeat = 5;
+   int first = 1;
+   if ( argc > 2 && strcmp( argv[1], "-r" ) == 0 )
+   {
+      repeat = atoi( argv[2] );
+      first = 3;
+   }
+   if ( first >= argc || repeat < 1 )
+   {
+      fprintf( stderr, "Uso: %s [-r repeticoes] programa [argumentos]\n", argv[0] );
+      return 1;
+   }
+
+   double* samples[ PERF_N_VALUES ];
+   for ( int v = 0 ; v < PERF_N_VALUES ; v++ )
+      samples[v] = (double*) malloc( repeat * sizeof(double) );
+   for ( int r = 0 ; r < repeat ; r++ )
+   {
+      double values[ PERF_N_VALUES ];
+      if ( Perf_run( argv + first, values ) < 0 )
+      {
+         fprintf( stderr, "%s: falha ao executar %s\n", argv[0], argv[first] );
+         return 1;
+      }
+      for ( int v = 0 ; v < PERF_N_VALUES ; v++ )
+         samples[v][r] = values[v];
+   }
+
+   printf( "%.3f", Perf_median( samples[0], repeat ) );
+   for ( int v = 1 ; v < PERF_N_VALUES ; v++ )
+   {
+      double median = Perf_median( samples[v], repeat );
+      if ( median < 0 )
+         printf( " -" );
+      else
+         printf( " %.0f", median );
+   }
+   printf( "\n" );
+   for ( int v = 0 ; v < PERF_N_VALUES ; v++ )
+      free( samples[v] );
+   return 0;
+}
+
+
+
+static int Perf_run( char** argv, double* values )
+{
+   // O filho espera os contadores serem abertos antes do exec
+   int sync[2];
+   if ( pipe( sync ) < 0 ) return -1;
+   pid_t pid = fork();
+   if ( pid < 0 ) return -1;
+   if ( pid == 0 )
+   {
+      char c;
+      close( sync[1] );
+      if ( read( sync[0], &c, 1 ) < 0 ) _exit( 127 );
+      int null = open( "/dev/null", O_WRONLY );
+      dup2( null, 1 );
+      execvp( argv[0], argv );
+      _exit( 127 );
+   }
+
+   int fds[ PERF_N_EVENTS ];
+   close( sync[0] );
+   for ( int e = 0 ; e < PERF_N_EVENTS ; e++ )
+      fds[e] = Perf_open( pid, Perf_events[e] );
+   double start = Perf_now();
+   close( sync[1] );
+   int status;
+   waitpid( pid, &status, 0 );
+   values[0] = 1e3 * ( Perf_now() - start );
+
+   for ( int e = 0 ; e < PERF_N_EVENTS ; e++ )
+   {
+      unsigned long long count;
+      values[e+1] = -1;
+      if ( fds[e] < 0 ) continue;
+      if ( read( fds[e], &count, sizeof(count) ) == sizeof(count) )
+         values[e+1] = count;
+      close( fds[e] );
+   }
+   return ( WIFEXITED( status ) && WEXITSTATUS( status ) != 127 ) ? 0 : -1;
+}
+
+
+
+static int Perf_open( pid_t pid, unsigned long long config )
+{
+   // Comeca desligado e liga sozinho no exec do filho
+   struct perf_event_attr attr;
+   memset( &attr, 0, sizeof(attr) );
+   attr.size = sizeof(attr);
+   attr.type = PERF_TYPE_HARDWARE;
+   attr.config = config;
+   attr.disabled = 1;
+   attr.enable_on_exec = 1;
+   attr.inherit = 1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   return syscall( SYS_perf_event_open, &attr, pid, -1, -1, 0 );
+}
+
+
+
+static double Perf_median( double* values, int n )
+{
+   qsort( values, n, sizeof(double), Perf_compare );
+   return ( n % 2 ) ? values[ n/2 ] : ( values[ n/2 - 1 ] + values[ n/2 ] ) / 2;
+}
+
+
+
+static int Perf_compare( const void* a, const void* b )
+{
+   double x = *(const double*) a;
+   double y = *(const double*) b;
+   return ( x > y ) - ( x < y );
+}
+
+
+
+static double Perf_now()
+{
+   struct timespec t;
+   clock_gettime( CLOCK_MONOTONIC, &t );
+   return t.tv_sec + 1e-9 * t.tv_nsec;
+}
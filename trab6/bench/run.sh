@@ -0,0 +1,53 @@
+#!/bin/sh
+# Tempo de execucao do codigo gerado: monta e liga cada kernel de
+# bench/kernels com cada configuracao, roda varias vezes e escreve a
+# mediana do tempo e, se o sistema permitir, de ciclos, instrucoes e
+# desvios mal previstos. Cada configuracao e um backend seguido das suas
+# opcoes; a primeira e a referencia da coluna "relativo".
+#
+# Uso: bench/run.sh [-r repeticoes] [configuracao ...]
+#
+#   bench/run.sh "./backend" "./backend -O"
+#   bench/run.sh "../antigo/backend -O" "./backend -O"
+
+REPEAT=5
+if [ "$1" = "-r" ]; then
+   REPEAT=$2
+   shift 2
+fi
+[ $# -eq 0 ] && set -- "./backend" "./backend -O"
+
+HERE=$(cd $(dirname $0) && pwd)
+CC32=${CC32:-"gcc -m32 -O2"}
+PERFRUN=${PERFRUN:-$HERE/perfrun}
+KERNELS=${KERNELS:-$HERE/kernels/*.m0.ir}
+DIR=$(mktemp -d)
+
+printf "%-8s %-36s %10s %9s %14s %14s %12s\n" "kernel" "configuracao" "ms" "relativo" "ciclos" "instrucoes" "desv. errados"
+for kernel in $KERNELS; do
+   name=$(basename $kernel .m0.ir)
+   base=""
+   reference=""
+   c=0
+   for config in "$@"; do
+      c=$((c+1))
+      mkdir -p $DIR/$c
+      cp $kernel $DIR/$c/
+      prog=$DIR/$c/$name
+      if ! $config $prog.m0.ir > /dev/null 2>&1 || ! $CC32 -o $prog $prog.s $HERE/io.c $HERE/../runtime.c; then
+         printf "%-8s %-36s %10s\n" "$name" "$config" "falhou"
+         continue
+      fi
+
+      # A saida tem que ser a mesma em todas as configuracoes
+      output=$($prog | cksum)
+      [ -z "$reference" ] && reference=$output
+      [ "$output" != "$reference" ] && echo "AVISO: saida de $name difere com \"$config\""
+
+      stats=$($PERFRUN -r $REPEAT $prog)
+      [ -z "$base" ] && base=${stats%% *}
+      echo "$stats" | awk -v name=$name -v config="$config" -v base=$base \
+         '{ printf "%-8s %-36s %10.2f %8.2fx %14s %14s %12s\n", name, config, $1, ( base > 0 ) ? $1 / base : 0, $2, $3, $4 }'
+   done
+done
+rm -rf $DIR
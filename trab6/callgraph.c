@@ -0,0 +1,205 @@
+/**
+ * @file    callgraph.c
+ * @author  lhpelosi
+ */
+
+#include "callgraph.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Tarjan_ {
+   CallGraph* graph;
+   int* index;
+   int* lowlink;
+   int* onStack;
+   CallNode** stack;
+   int top;
+   int nextIndex;
+   int nScc;
+   int nOrdered;
+} Tarjan;
+
+static int CallGraph_compareNames( const void* a, const void* b );
+static int CallGraph_position( CallGraph* graph, CallNode* node );
+static void CallGraph_visit( Tarjan* t, CallNode* node );
+
+
+
+CallGraph* CallGraph_build( IR* program )
+{
+   CallGraph* graph = (CallGraph*) calloc( 1, sizeof(CallGraph) );
+   for ( Function* fun = program->functions ; fun ; fun = fun->next )
+      graph->nNodes++;
+   graph->nodes = (CallNode**) malloc( (graph->nNodes+1) * sizeof(CallNode*) );
+   graph->byName = (CallNode**) malloc( (graph->nNodes+1) * sizeof(CallNode*) );
+
+   int i = 0;
+   for ( Function* fun = program->functions ; fun ; fun = fun->next, i++ )
+   {
+      CallNode* node = (CallNode*) calloc( 1, sizeof(CallNode) );
+      node->function = fun;
+      graph->byName[i] = node;
+   }
+   qsort( graph->byName, graph->nNodes, sizeof(CallNode*), CallGraph_compareNames );
+
+   // Somente main pode ser chamada de fora do programa
+   for ( i = 0 ; i < graph->nNodes ; i++ )
+      graph->byName[i]->isInternal = ( strcmp( graph->byName[i]->function->name, "main" ) != 0 );
+
+   // Arestas das chamadas a funcoes definidas no programa
+   for ( i = 0 ; i < graph->nNodes ; i++ )
+   {
+      CallNode* node = graph->byName[i];
+      int nParams = 0;
+      for ( Instr* instr = node->function->code ; instr ; instr = instr->next )
+      {
+         node->size++;
+         if ( instr->op == OP_PARAM )
+         {
+            nParams++;
+            continue;
+         }
+         int isCall = ( instr->op == OP_CALL );
+         int params = nParams;
+         nParams = 0;
+         if ( !isCall ) continue;
+         CallNode* callee = CallGraph_find( graph, instr->x.str );
+         if ( callee == NULL ) continue;
+         if ( params != instr->y.num || params != callee->function->nArgs )
+            callee->isInternal = 0;
+         node->callees = (CallNode**) realloc( node->callees, (node->nCallees+1) * sizeof(CallNode*) );
+         node->callees[ node->nCallees++ ] = callee;
+         callee->nCallers++;
+      }
+   }
+
+   // Componentes fortemente conexos (Tarjan), que saem das folhas para as raizes
+   Tarjan t;
+   t.graph = graph;
+   t.index = (int*) malloc( (graph->nNodes+1) * sizeof(int) );
+   t.lowlink = (int*) malloc( (graph->nNodes+1) * sizeof(int) );
+   t.onStack = (int*) calloc( graph->nNodes+1, sizeof(int) );
+   t.stack = (CallNode**) malloc( (graph->nNodes+1) * sizeof(CallNode*) );
+   t.top = 0;
+   t.nextIndex = 0;
+   t.nScc = 0;
+   t.nOrdered = 0;
+   for ( i = 0 ; i < graph->nNodes ; i++ )
+      t.index[i] = -1;
+   for ( i = 0 ; i < graph->nNodes ; i++ )
+      if ( t.index[i] < 0 )
+         CallGraph_visit( &t, graph->byName[i] );
+
+   free( t.index );
+   free( t.lowlink );
+   free( t.onStack );
+   free( t.stack );
+   return graph;
+}
+
+
+
+void CallGraph_delete( CallGraph* graph )
+{
+   if ( graph == NULL ) return;
+   for ( int i = 0 ; i < graph->nNodes ; i++ )
+   {
+      free( graph->nodes[i]->callees );
+      free( graph->nodes[i] );
+   }
+   free( graph->nodes );
+   free( graph->byName );
+   free( graph );
+}
+
+
+
+CallNode* CallGraph_find( CallGraph* graph, const char* name )
+{
+   int lo = 0;
+   int hi = graph->nNodes - 1;
+   while ( lo <= hi )
+   {
+      int mid = (lo + hi) / 2;
+      int cmp = strcmp( name, graph->byName[mid]->function->name );
+      if ( cmp == 0 ) return graph->byName[mid];
+      if ( cmp < 0 ) hi = mid - 1;
+      else lo = mid + 1;
+   }
+   return NULL;
+}
+
+
+
+static int CallGraph_compareNames( const void* a, const void* b )
+{
+   const CallNode* na = *(const CallNode**) a;
+   const CallNode* nb = *(const CallNode**) b;
+   return strcmp( na->function->name, nb->function->name );
+}
+
+
+
+static int CallGraph_position( CallGraph* graph, CallNode* node )
+{
+   // Posicao no vetor ordenado por nome
+   int lo = 0;
+   int hi = graph->nNodes - 1;
+   while ( lo <= hi )
+   {
+      int mid = (lo + hi) / 2;
+      int cmp = strcmp( node->function->name, graph->byName[mid]->function->name );
+      if ( cmp == 0 ) return mid;
+      if ( cmp < 0 ) hi = mid - 1;
+      else lo = mid + 1;
+   }
+   return -1;
+}
+
+
+
+static void CallGraph_visit( Tarjan* t, CallNode* node )
+{
+   int v = CallGraph_position( t->graph, node );
+   t->index[v] = t->nextIndex;
+   t->lowlink[v] = t->nextIndex;
+   t->nextIndex++;
+   t->stack[ t->top++ ] = node;
+   t->onStack[v] = 1;
+
+   for ( int c = 0 ; c < node->nCallees ; c++ )
+   {
+      CallNode* callee = node->callees[c];
+      int w = CallGraph_position( t->graph, callee );
+      if ( callee == node ) node->isRecursive = 1;
+      if ( t->index[w] < 0 )
+      {
+         CallGraph_visit( t, callee );
+         if ( t->lowlink[w] < t->lowlink[v] ) t->lowlink[v] = t->lowlink[w];
+      }
+      else if ( t->onStack[w] && t->index[w] < t->lowlink[v] )
+      {
+         t->lowlink[v] = t->index[w];
+      }
+   }
+
+   // Raiz de um componente: desempilha todos os seus nos
+   if ( t->lowlink[v] == t->index[v] )
+   {
+      int first = t->nOrdered;
+      CallNode* member;
+      do
+      {
+         member = t->stack[ --t->top ];
+         t->onStack[ CallGraph_position( t->graph, member ) ] = 0;
+         member->scc = t->nScc;
+         member->order = t->nOrdered;
+         t->graph->nodes[ t->nOrdered++ ] = member;
+      } while ( member != node );
+      if ( t->nOrdered - first > 1 )
+         for ( int i = first ; i < t->nOrdered ; i++ )
+            t->graph->nodes[i]->isRecursive = 1;
+      t->nScc++;
+   }
+}
@@ -0,0 +1,35 @@
+/**
+ * @file    callgraph.h
+ * @author  lhpelosi
+ */
+
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "ir.h"
+
+typedef struct CallNode_ CallNode;
+struct CallNode_ {
+   Function* function;
+   int size; // Numero de instrucoes
+   CallNode** callees; // Funcoes do programa chamadas por esta, com repeticao
+   int nCallees;
+   int nCallers; // Chamadas recebidas de funcoes do programa
+   int order; // Posicao em CallGraph.nodes
+   int scc; // Componente fortemente conexo
+   int isRecursive; // Participa de um ciclo de chamadas
+   int isInternal; // So chamada por call direto, com todos os params logo antes
+};
+
+typedef struct CallGraph_ CallGraph;
+struct CallGraph_ {
+   CallNode** nodes; // Ordenados das chamadas para quem chama (componentes em ordem inversa)
+   int nNodes;
+   CallNode** byName; // Ordenados pelo nome da funcao
+};
+
+CallGraph* CallGraph_build( IR* program );
+void CallGraph_delete( CallGraph* graph );
+CallNode* CallGraph_find( CallGraph* graph, const char* name );
+
+#endif
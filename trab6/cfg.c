@@ -0,0 +1,425 @@
+/**
+ * @file    cfg.c
+ * @author  lhpelosi
+ */
+
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void Cfg_addEdge( CfgBlock* from, CfgBlock* to );
+static void Cfg_computeOrder( Cfg* cfg );
+static void Cfg_computeDominators( Cfg* cfg );
+static CfgBlock* Cfg_intersect( CfgBlock* b1, CfgBlock* b2 );
+static unsigned Cfg_hashLabel( const char* label );
+static void Cfg_addLabel( Cfg* cfg, CfgBlock* block );
+
+
+
+Cfg* Cfg_build( Function* function )
+{
+   Cfg* cfg = (Cfg*) calloc( 1, sizeof(Cfg) );
+   int capacity = 16;
+   int nLabels = 0;
+   CfgBlock* block = NULL;
+
+   cfg->function = function;
+   cfg->nLocals = Function_nLocals( function );
+   cfg->nVars = cfg->nLocals + Function_nTemps( function );
+   cfg->retVar = -1;
+   cfg->blocks = (CfgBlock**) malloc( capacity * sizeof(CfgBlock*) );
+
+   // Procura a temporaria que recebe o valor de retorno das chamadas
+   int iTemp = 0;
+   for ( Variable* v = function->temps ; v ; v = v->next, iTemp++ )
+      if ( strcmp( v->name, "$ret" ) == 0 )
+         cfg->retVar = cfg->nLocals + iTemp;
+
+   // Divide o codigo em blocos basicos
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      if ( block == NULL || instr->op == OP_LABEL || Instr_endsBlock( block->last ) )
+      {
+         if ( cfg->nBlocks == capacity )
+         {
+            capacity *= 2;
+            cfg->blocks = (CfgBlock**) realloc( cfg->blocks, capacity * sizeof(CfgBlock*) );
+         }
+         block = (CfgBlock*) calloc( 1, sizeof(CfgBlock) );
+         block->index = cfg->nBlocks;
+         block->first = instr;
+         block->rpo = -1;
+         cfg->blocks[ cfg->nBlocks++ ] = block;
+         if ( instr->op == OP_LABEL ) nLabels++;
+      }
+      block->last = instr;
+      block->nInstr++;
+   }
+
+   // Tabela de rotulos
+   cfg->labelTableSize = 16;
+   while ( cfg->labelTableSize < 2*nLabels ) cfg->labelTableSize *= 2;
+   cfg->labelTable = (CfgBlock**) calloc( cfg->labelTableSize, sizeof(CfgBlock*) );
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      if ( cfg->blocks[i]->first->op == OP_LABEL )
+         Cfg_addLabel( cfg, cfg->blocks[i] );
+
+   // Arestas
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* current = cfg->blocks[i];
+      CfgBlock* next = ( i+1 < cfg->nBlocks ) ? cfg->blocks[i+1] : NULL;
+      Instr* last = current->last;
+      Addr* target = Instr_jumpTarget( last );
+
+      if ( next && last->op != OP_GOTO && last->op != OP_RET && last->op != OP_RET_VAL )
+         Cfg_addEdge( current, next );
+      if ( target )
+      {
+         CfgBlock* targetBlock = Cfg_findLabel( cfg, target->str );
+         if ( targetBlock ) Cfg_addEdge( current, targetBlock );
+      }
+   }
+
+   Cfg_computeOrder( cfg );
+   Cfg_computeDominators( cfg );
+   return cfg;
+}
+
+
+
+void Cfg_delete( Cfg* cfg )
+{
+   if ( cfg == NULL ) return;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      free( cfg->blocks[i]->pred );
+      free( cfg->blocks[i]->liveIn );
+      free( cfg->blocks[i]->liveOut );
+      free( cfg->blocks[i] );
+   }
+   free( cfg->blocks );
+   free( cfg->labelTable );
+   free( cfg );
+}
+
+
+
+void Cfg_computeLiveness( Cfg* cfg )
+{
+   int nWords = Bitset_words( cfg->nVars );
+   unsigned** gen = (unsigned**) malloc( cfg->nBlocks * sizeof(unsigned*) );
+   unsigned** kill = (unsigned**) malloc( cfg->nBlocks * sizeof(unsigned*) );
+   int uses[3];
+
+   // Usos expostos e definicoes de cada bloco
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      gen[i] = (unsigned*) calloc( nWords+1, sizeof(unsigned) );
+      kill[i] = (unsigned*) calloc( nWords+1, sizeof(unsigned) );
+      free( block->liveIn );
+      free( block->liveOut );
+      block->liveIn = (unsigned*) calloc( nWords+1, sizeof(unsigned) );
+      block->liveOut = (unsigned*) calloc( nWords+1, sizeof(unsigned) );
+
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+      {
+         int nUses = Cfg_getUses( cfg, instr, uses );
+         for ( int u = 0 ; u < nUses ; u++ )
+            if ( !Bitset_has( kill[i], uses[u] ) )
+               Bitset_add( gen[i], uses[u] );
+         int def = Cfg_getDef( cfg, instr );
+         if ( def >= 0 ) Bitset_add( kill[i], def );
+      }
+   }
+
+   // Iteracao ate o ponto fixo, de tras para frente
+   int changed = 1;
+   while ( changed )
+   {
+      changed = 0;
+      for ( int i = cfg->nBlocks-1 ; i >= 0 ; i-- )
+      {
+         CfgBlock* block = cfg->blocks[i];
+         for ( int s = 0 ; s < block->nSucc ; s++ )
+            for ( int w = 0 ; w < nWords ; w++ )
+               block->liveOut[w] |= block->succ[s]->liveIn[w];
+         for ( int w = 0 ; w < nWords ; w++ )
+         {
+            unsigned in = gen[i][w] | ( block->liveOut[w] & ~kill[i][w] );
+            if ( in != block->liveIn[w] )
+            {
+               block->liveIn[w] = in;
+               changed = 1;
+            }
+         }
+      }
+   }
+
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      free( gen[i] );
+      free( kill[i] );
+   }
+   free( gen );
+   free( kill );
+}
+
+
+
+int Cfg_dominates( CfgBlock* a, CfgBlock* b )
+{
+   for ( ; b ; b = b->idom )
+      if ( a == b ) return 1;
+   return 0;
+}
+
+
+
+CfgBlock* Cfg_findLabel( Cfg* cfg, const char* label )
+{
+   unsigned mask = cfg->labelTableSize - 1;
+   for ( unsigned h = Cfg_hashLabel( label ) & mask ; cfg->labelTable[h] ; h = (h+1) & mask )
+      if ( strcmp( cfg->labelTable[h]->first->x.str, label ) == 0 )
+         return cfg->labelTable[h];
+   return NULL;
+}
+
+
+
+int Cfg_varIndex( Cfg* cfg, Addr addr )
+{
+   if ( addr.type == AD_LOCAL ) return addr.num;
+   if ( addr.type == AD_TEMP ) return cfg->nLocals + addr.num;
+   return -1;
+}
+
+
+
+int Cfg_getDef( Cfg* cfg, Instr* instr )
+{
+   if ( instr->op == OP_CALL ) return cfg->retVar;
+   if ( Instr_hasDef( instr ) ) return Cfg_varIndex( cfg, instr->x );
+   return -1;
+}
+
+
+
+int Cfg_getUses( Cfg* cfg, Instr* instr, int* uses )
+{
+   int n = 0;
+   int var;
+   switch ( instr->op )
+   {
+      case OP_PARAM:
+      case OP_IF:
+      case OP_IF_FALSE:
+      case OP_RET_VAL:
+      case OP_IDX_SET:
+      case OP_IDX_SET_BYTE:
+         if ( ( var = Cfg_varIndex( cfg, instr->x ) ) >= 0 ) uses[n++] = var;
+         if ( ( var = Cfg_varIndex( cfg, instr->y ) ) >= 0 ) uses[n++] = var;
+         if ( ( var = Cfg_varIndex( cfg, instr->z ) ) >= 0 ) uses[n++] = var;
+         break;
+
+      case OP_LABEL:
+      case OP_GOTO:
+      case OP_CALL:
+      case OP_RET:
+         break;
+
+      default:
+         if ( ( var = Cfg_varIndex( cfg, instr->y ) ) >= 0 ) uses[n++] = var;
+         if ( ( var = Cfg_varIndex( cfg, instr->z ) ) >= 0 ) uses[n++] = var;
+         break;
+   }
+   return n;
+}
+
+
+
+int Instr_hasDef( Instr* instr )
+{
+   // Instrucoes que escrevem no endereco x
+   switch ( instr->op )
+   {
+      case OP_SET:
+      case OP_SET_BYTE:
+      case OP_SET_IDX:
+      case OP_SET_IDX_BYTE:
+      case OP_NE:
+      case OP_EQ:
+      case OP_LT:
+      case OP_GT:
+      case OP_LE:
+      case OP_GE:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_DIV:
+      case OP_MUL:
+      case OP_NEG:
+      case OP_NEW:
+      case OP_NEW_BYTE:
+      case OP_NEW_FRAME:
+         return 1;
+
+      default:
+         return 0;
+   }
+}
+
+
+
+int Instr_isJump( Instr* instr )
+{
+   return instr->op == OP_GOTO || instr->op == OP_IF || instr->op == OP_IF_FALSE;
+}
+
+
+
+int Instr_endsBlock( Instr* instr )
+{
+   return Instr_isJump( instr ) || instr->op == OP_RET || instr->op == OP_RET_VAL;
+}
+
+
+
+Addr* Instr_jumpTarget( Instr* instr )
+{
+   if ( instr->op == OP_GOTO ) return &(instr->x);
+   if ( instr->op == OP_IF || instr->op == OP_IF_FALSE ) return &(instr->y);
+   return NULL;
+}
+
+
+
+static void Cfg_addEdge( CfgBlock* from, CfgBlock* to )
+{
+   // Um desvio condicional para o proprio bloco seguinte gera uma unica aresta
+   for ( int s = 0 ; s < from->nSucc ; s++ )
+      if ( from->succ[s] == to ) return;
+   from->succ[ from->nSucc++ ] = to;
+   to->pred = (CfgBlock**) realloc( to->pred, (to->nPred+1) * sizeof(CfgBlock*) );
+   to->pred[ to->nPred++ ] = from;
+}
+
+
+
+static void Cfg_computeOrder( Cfg* cfg )
+{
+   if ( cfg->nBlocks == 0 ) return;
+
+   // Busca em profundidade iterativa a partir da entrada
+   CfgBlock** stack = (CfgBlock**) malloc( cfg->nBlocks * sizeof(CfgBlock*) );
+   int* nextSucc = (int*) calloc( cfg->nBlocks, sizeof(int) );
+   char* visited = (char*) calloc( cfg->nBlocks, sizeof(char) );
+   int top = 0;
+   int order = cfg->nBlocks;
+
+   stack[ top++ ] = cfg->blocks[0];
+   visited[0] = 1;
+   while ( top > 0 )
+   {
+      CfgBlock* block = stack[ top-1 ];
+      if ( nextSucc[ block->index ] < block->nSucc )
+      {
+         CfgBlock* succ = block->succ[ nextSucc[ block->index ]++ ];
+         if ( !visited[ succ->index ] )
+         {
+            visited[ succ->index ] = 1;
+            stack[ top++ ] = succ;
+         }
+      }
+      else
+      {
+         block->rpo = --order;
+         top--;
+      }
+   }
+
+   // Renumera para que a ordem comece em zero
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      if ( cfg->blocks[i]->rpo >= 0 )
+         cfg->blocks[i]->rpo -= order;
+
+   free( stack );
+   free( nextSucc );
+   free( visited );
+}
+
+
+
+static void Cfg_computeDominators( Cfg* cfg )
+{
+   // Algoritmo iterativo de Cooper, Harvey e Kennedy
+   if ( cfg->nBlocks == 0 ) return;
+   CfgBlock** byRpo = (CfgBlock**) calloc( cfg->nBlocks, sizeof(CfgBlock*) );
+   int nReachable = 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      if ( cfg->blocks[i]->rpo >= 0 )
+      {
+         byRpo[ cfg->blocks[i]->rpo ] = cfg->blocks[i];
+         nReachable++;
+      }
+
+   CfgBlock* entry = cfg->blocks[0];
+   entry->idom = entry;
+   int changed = 1;
+   while ( changed )
+   {
+      changed = 0;
+      for ( int i = 1 ; i < nReachable ; i++ )
+      {
+         CfgBlock* block = byRpo[i];
+         CfgBlock* newIdom = NULL;
+         for ( int p = 0 ; p < block->nPred ; p++ )
+         {
+            CfgBlock* pred = block->pred[p];
+            if ( pred->idom == NULL ) continue;
+            newIdom = newIdom ? Cfg_intersect( pred, newIdom ) : pred;
+         }
+         if ( newIdom != block->idom )
+         {
+            block->idom = newIdom;
+            changed = 1;
+         }
+      }
+   }
+   entry->idom = NULL;
+   free( byRpo );
+}
+
+
+
+static CfgBlock* Cfg_intersect( CfgBlock* b1, CfgBlock* b2 )
+{
+   while ( b1 != b2 )
+   {
+      while ( b1->rpo > b2->rpo ) b1 = b1->idom;
+      while ( b2->rpo > b1->rpo ) b2 = b2->idom;
+   }
+   return b1;
+}
+
+
+
+static unsigned Cfg_hashLabel( const char* label )
+{
+   unsigned h = 5381;
+   for ( ; *label ; label++ )
+      h = h*33 + (unsigned char) *label;
+   return h;
+}
+
+
+
+static void Cfg_addLabel( Cfg* cfg, CfgBlock* block )
+{
+   unsigned mask = cfg->labelTableSize - 1;
+   unsigned h = Cfg_hashLabel( block->first->x.str ) & mask;
+   while ( cfg->labelTable[h] ) h = (h+1) & mask;
+   cfg->labelTable[h] = block;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file    cfg.h
+ * @author  lhpelosi
+ */
+
+#ifndef CFG_H
+#define CFG_H
+
+#include "ir.h"
+
+// Conjuntos de bits, indexados pelas variaveis (locais seguidas das temporarias)
+#define Bitset_words(_n) (((_n) + 31) / 32)
+#define Bitset_has(_s, _i) (((_s)[(_i) >> 5] >> ((_i) & 31)) & 1u)
+#define Bitset_add(_s, _i) ((_s)[(_i) >> 5] |= 1u << ((_i) & 31))
+#define Bitset_remove(_s, _i) ((_s)[(_i) >> 5] &= ~(1u << ((_i) & 31)))
+
+typedef struct CfgBlock_ CfgBlock;
+struct CfgBlock_ {
+   int index; // Posicao do bloco na ordem do codigo
+   Instr* first;
+   Instr* last;
+   int nInstr;
+
+   CfgBlock* succ[2];
+   int nSucc;
+   CfgBlock** pred;
+   int nPred;
+
+   int rpo; // Posicao na pos-ordem reversa, -1 se inalcancavel
+   CfgBlock* idom; // Dominador imediato, NULL na entrada e se inalcancavel
+
+   unsigned* liveIn;
+   unsigned* liveOut;
+};
+
+typedef struct Cfg_ Cfg;
+struct Cfg_ {
+   Function* function;
+   CfgBlock** blocks;
+   int nBlocks;
+
+   int nLocals;
+   int nVars; // Locais mais temporarias
+   int retVar; // Indice da temporaria $ret, definida pelas chamadas, ou -1
+
+   int labelTableSize;
+   CfgBlock** labelTable;
+};
+
+Cfg* Cfg_build( Function* function );
+void Cfg_delete( Cfg* cfg );
+void Cfg_computeLiveness( Cfg* cfg );
+int Cfg_dominates( CfgBlock* a, CfgBlock* b );
+CfgBlock* Cfg_findLabel( Cfg* cfg, const char* label );
+int Cfg_varIndex( Cfg* cfg, Addr addr );
+int Cfg_getDef( Cfg* cfg, Instr* instr );
+int Cfg_getUses( Cfg* cfg, Instr* instr, int* uses );
+
+int Instr_hasDef( Instr* instr );
+int Instr_isJump( Instr* instr );
+int Instr_endsBlock( Instr* instr );
+Addr* Instr_jumpTarget( Instr* instr );
+
+#endif
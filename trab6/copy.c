@@ -0,0 +1,617 @@
+/**
+ * @file    copy.c
+ * @author  lhpelosi
+ */
+
+#include "copy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+
+typedef struct Copy_ {
+   Instr* instr;
+   int dst;
+   int src; // Indice da variavel de origem, ou -1 se for constante
+   Addr value;
+} Copy;
+
+typedef struct Candidate_ {
+   Instr* instr;
+   int temp; // Temporaria que deixa de existir
+   int other;
+} Candidate;
+
+static int Copy_propagateOnce( Cfg* cfg );
+static int Copy_removeDead( Cfg* cfg );
+static int Copy_scanDead( Cfg* cfg, CfgBlock* block, unsigned* live, Instr** instrs, char* isDead );
+static int Copy_coalesceOnce( Cfg* cfg );
+static int Copy_find( int* parent, int var );
+static void Copy_compactTemps( Function* function );
+static int Copy_isCopy( Cfg* cfg, Instr* instr );
+static int Copy_isRemovable( Instr* instr );
+static int Copy_getUseAddrs( Instr* instr, Addr** addrs );
+static void Copy_unlink( Cfg* cfg, char* isDead );
+
+
+
+int Copy_propagate( Function* function )
+{
+   // As remocoes nao mudam o grafo, que eh construido uma vez so
+   Cfg* cfg = Cfg_build( function );
+   int nChanges = 0;
+   int changed = 1;
+   while ( changed )
+   {
+      changed = Copy_propagateOnce( cfg );
+      changed += Copy_removeDead( cfg );
+      nChanges += changed;
+   }
+   Cfg_delete( cfg );
+   return nChanges;
+}
+
+
+
+int Copy_coalesce( Function* function )
+{
+   Cfg* cfg = Cfg_build( function );
+   int nMerged = 0;
+   int merged;
+   while ( ( merged = Copy_coalesceOnce( cfg ) ) > 0 )
+      nMerged += merged;
+   Copy_removeDead( cfg );
+   Cfg_delete( cfg );
+   Copy_compactTemps( function );
+   return nMerged;
+}
+
+
+
+static int Copy_propagateOnce( Cfg* cfg )
+{
+   int nChanges = 0;
+
+   // Copias x = y, com y variavel ou constante
+   int nCopies = 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      Instr* instr = cfg->blocks[i]->first;
+      for ( int iInstr = 0 ; iInstr < cfg->blocks[i]->nInstr ; iInstr++, instr = instr->next )
+         if ( Copy_isCopy( cfg, instr ) ) nCopies++;
+   }
+   if ( nCopies == 0 ) return 0;
+   Copy* copies = (Copy*) malloc( nCopies * sizeof(Copy) );
+   nCopies = 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      Instr* instr = cfg->blocks[i]->first;
+      for ( int iInstr = 0 ; iInstr < cfg->blocks[i]->nInstr ; iInstr++, instr = instr->next )
+      {
+         if ( !Copy_isCopy( cfg, instr ) ) continue;
+         copies[ nCopies ].instr = instr;
+         copies[ nCopies ].dst = Cfg_varIndex( cfg, instr->x );
+         copies[ nCopies ].src = Cfg_varIndex( cfg, instr->y );
+         copies[ nCopies ].value = instr->y;
+         nCopies++;
+      }
+   }
+
+   // Copias afetadas pela definicao de cada variavel
+   int* nKills = (int*) calloc( cfg->nVars+1, sizeof(int) );
+   int** kills = (int**) calloc( cfg->nVars+1, sizeof(int*) );
+   for ( int c = 0 ; c < nCopies ; c++ )
+   {
+      int vars[2] = { copies[c].dst, copies[c].src };
+      for ( int v = 0 ; v < 2 ; v++ )
+      {
+         if ( vars[v] < 0 ) continue;
+         kills[ vars[v] ] = (int*) realloc( kills[ vars[v] ], (nKills[ vars[v] ]+1) * sizeof(int) );
+         kills[ vars[v] ][ nKills[ vars[v] ]++ ] = c;
+      }
+   }
+
+   // Copias disponiveis na entrada de cada bloco (intersecao nos predecessores)
+   int nWords = Bitset_words( nCopies );
+   unsigned** in = (unsigned**) malloc( cfg->nBlocks * sizeof(unsigned*) );
+   unsigned** out = (unsigned**) malloc( cfg->nBlocks * sizeof(unsigned*) );
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      in[i] = (unsigned*) calloc( nWords, sizeof(unsigned) );
+      out[i] = (unsigned*) malloc( nWords * sizeof(unsigned) );
+      memset( out[i], ( cfg->blocks[i]->rpo > 0 ) ? 0xff : 0, nWords * sizeof(unsigned) );
+   }
+   unsigned* current = (unsigned*) malloc( nWords * sizeof(unsigned) );
+   int changed = 1;
+   while ( changed )
+   {
+      changed = 0;
+      for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      {
+         CfgBlock* block = cfg->blocks[i];
+         if ( block->rpo < 0 ) continue;
+         // Nada esta disponivel na entrada da funcao
+         for ( int w = 0 ; w < nWords ; w++ )
+            current[w] = ( block->rpo > 0 ) ? ~0u : 0;
+         for ( int p = 0 ; p < block->nPred && block->rpo > 0 ; p++ )
+            for ( int w = 0 ; w < nWords ; w++ )
+               current[w] &= out[ block->pred[p]->index ][w];
+         memcpy( in[i], current, nWords * sizeof(unsigned) );
+
+         Instr* instr = block->first;
+         for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+         {
+            int def = Cfg_getDef( cfg, instr );
+            if ( def < 0 ) continue;
+            for ( int k = 0 ; k < nKills[def] ; k++ )
+               Bitset_remove( current, kills[def][k] );
+            if ( Copy_isCopy( cfg, instr ) )
+               for ( int k = 0 ; k < nKills[def] ; k++ )
+                  if ( copies[ kills[def][k] ].instr == instr )
+                     Bitset_add( current, kills[def][k] );
+         }
+         if ( memcmp( current, out[i], nWords * sizeof(unsigned) ) != 0 )
+         {
+            memcpy( out[i], current, nWords * sizeof(unsigned) );
+            changed = 1;
+         }
+      }
+   }
+
+   // Troca cada uso pela origem da copia disponivel, seguindo as cadeias
+   // x = y ; z = x de copias disponiveis ao mesmo tempo
+   Addr* addrs[3];
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      if ( block->rpo < 0 ) continue;
+      memcpy( current, in[i], nWords * sizeof(unsigned) );
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+      {
+         int nAddrs = Copy_getUseAddrs( instr, addrs );
+         for ( int a = 0 ; a < nAddrs ; a++ )
+         {
+            int var = Cfg_varIndex( cfg, *addrs[a] );
+            for ( int nSteps = 0 ; var >= 0 && nSteps < nCopies ; nSteps++ )
+            {
+               Copy* copy = NULL;
+               for ( int k = 0 ; k < nKills[var] && copy == NULL ; k++ )
+                  if ( copies[ kills[var][k] ].dst == var && Bitset_has( current, kills[var][k] ) )
+                     copy = &(copies[ kills[var][k] ]);
+               if ( copy == NULL ) break;
+               *addrs[a] = copy->value;
+               var = copy->src;
+               nChanges++;
+            }
+         }
+
+         int def = Cfg_getDef( cfg, instr );
+         if ( def < 0 ) continue;
+         for ( int k = 0 ; k < nKills[def] ; k++ )
+            Bitset_remove( current, kills[def][k] );
+         for ( int k = 0 ; k < nKills[def] ; k++ )
+            if ( copies[ kills[def][k] ].instr == instr )
+               Bitset_add( current, kills[def][k] );
+      }
+   }
+
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      free( in[i] );
+      free( out[i] );
+   }
+   for ( int v = 0 ; v < cfg->nVars ; v++ )
+      free( kills[v] );
+   free( in );
+   free( out );
+   free( current );
+   free( kills );
+   free( nKills );
+   free( copies );
+   return nChanges;
+}
+
+
+
+static int Copy_removeDead( Cfg* cfg )
+{
+   // Definicoes sem efeito colateral de variaveis mortas logo apos. Uma
+   // definicao morta nao torna vivos os seus operandos, entao a vivacidade
+   // calculada assim ja remove as cadeias de definicoes mortas de uma vez
+   int nWords = Bitset_words( cfg->nVars );
+   unsigned** liveIn = (unsigned**) malloc( cfg->nBlocks * sizeof(unsigned*) );
+   unsigned* live = (unsigned*) malloc( (nWords+1) * sizeof(unsigned) );
+   int capacity = 64;
+   int nInstrs = 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      liveIn[i] = (unsigned*) calloc( nWords+1, sizeof(unsigned) );
+      if ( cfg->blocks[i]->nInstr > capacity ) capacity = cfg->blocks[i]->nInstr;
+      nInstrs += cfg->blocks[i]->nInstr;
+   }
+   Instr** instrs = (Instr**) malloc( capacity * sizeof(Instr*) );
+
+   int changed = 1;
+   while ( changed )
+   {
+      changed = 0;
+      for ( int i = cfg->nBlocks-1 ; i >= 0 ; i-- )
+      {
+         CfgBlock* block = cfg->blocks[i];
+         memset( live, 0, nWords * sizeof(unsigned) );
+         for ( int s = 0 ; s < block->nSucc ; s++ )
+            for ( int w = 0 ; w < nWords ; w++ )
+               live[w] |= liveIn[ block->succ[s]->index ][w];
+         Copy_scanDead( cfg, block, live, instrs, NULL );
+         if ( memcmp( live, liveIn[i], nWords * sizeof(unsigned) ) != 0 )
+         {
+            memcpy( liveIn[i], live, nWords * sizeof(unsigned) );
+            changed = 1;
+         }
+      }
+   }
+
+   char* isDead = (char*) calloc( nInstrs+1, sizeof(char) );
+   int nDead = 0;
+   int pos = 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      memset( live, 0, nWords * sizeof(unsigned) );
+      for ( int s = 0 ; s < block->nSucc ; s++ )
+         for ( int w = 0 ; w < nWords ; w++ )
+            live[w] |= liveIn[ block->succ[s]->index ][w];
+      nDead += Copy_scanDead( cfg, block, live, instrs, isDead + pos );
+      pos += block->nInstr;
+   }
+
+   if ( nDead > 0 ) Copy_unlink( cfg, isDead );
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      free( liveIn[i] );
+   free( liveIn );
+   free( isDead );
+   free( instrs );
+   free( live );
+   return nDead;
+}
+
+
+
+static int Copy_scanDead( Cfg* cfg, CfgBlock* block, unsigned* live, Instr** instrs, char* isDead )
+{
+   // Percorre o bloco de tras para frente a partir das variaveis vivas na
+   // saida; isDead, se nao for NULL, recebe as definicoes mortas do bloco
+   int nDead = 0;
+   int uses[3];
+   Instr* instr = block->first;
+   for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+      instrs[iInstr] = instr;
+
+   for ( int iInstr = block->nInstr-1 ; iInstr >= 0 ; iInstr-- )
+   {
+      instr = instrs[iInstr];
+      int def = Cfg_getDef( cfg, instr );
+      if ( def >= 0 && Copy_isRemovable( instr ) &&
+           ( !Bitset_has( live, def ) || ( instr->op == OP_SET && Addr_eq( instr->x, instr->y ) ) ) )
+      {
+         if ( isDead ) isDead[iInstr] = 1;
+         nDead++;
+         continue;
+      }
+      if ( def >= 0 ) Bitset_remove( live, def );
+      int nUses = Cfg_getUses( cfg, instr, uses );
+      for ( int u = 0 ; u < nUses ; u++ )
+         Bitset_add( live, uses[u] );
+   }
+   return nDead;
+}
+
+
+
+static int Copy_coalesceOnce( Cfg* cfg )
+{
+   Function* function = cfg->function;
+   Cfg_computeLiveness( cfg );
+   int nMerged = 0;
+
+   // Copias entre uma temporaria e outra variavel
+   int nCandidates = 0;
+   Candidate* candidates = NULL;
+   Addr* addrOf = (Addr*) malloc( (cfg->nVars+1) * sizeof(Addr) );
+   int nWords = Bitset_words( cfg->nVars );
+   unsigned** interference = (unsigned**) calloc( cfg->nVars+1, sizeof(unsigned*) );
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      if ( instr->op != OP_SET ) continue;
+      int x = Cfg_varIndex( cfg, instr->x );
+      int y = Cfg_varIndex( cfg, instr->y );
+      if ( x < 0 || y < 0 || x == y || x == cfg->retVar || y == cfg->retVar ) continue;
+      if ( instr->x.type != AD_TEMP && instr->y.type != AD_TEMP ) continue;
+      candidates = (Candidate*) realloc( candidates, (nCandidates+1) * sizeof(Candidate) );
+      candidates[ nCandidates ].instr = instr;
+      candidates[ nCandidates ].temp = ( instr->y.type == AD_TEMP ) ? y : x;
+      candidates[ nCandidates ].other = ( instr->y.type == AD_TEMP ) ? x : y;
+      nCandidates++;
+      int vars[2] = { x, y };
+      for ( int v = 0 ; v < 2 ; v++ )
+      {
+         if ( interference[ vars[v] ] ) continue;
+         interference[ vars[v] ] = (unsigned*) calloc( nWords+1, sizeof(unsigned) );
+         addrOf[ vars[v] ] = ( v == 0 ) ? instr->x : instr->y;
+      }
+   }
+   if ( nCandidates == 0 )
+   {
+      free( interference );
+      free( addrOf );
+      return 0;
+   }
+
+   // Interferencia: uma variavel definida enquanto a outra esta viva,
+   // exceto na propria copia entre as duas. Cada definicao de uma variavel
+   // das copias junta as variaveis vivas na sua linha
+   unsigned* live = (unsigned*) malloc( (nWords+1) * sizeof(unsigned) );
+   int capacity = 64;
+   Instr** instrs = (Instr**) malloc( capacity * sizeof(Instr*) );
+   int uses[3];
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      if ( block->nInstr > capacity )
+      {
+         capacity = block->nInstr;
+         instrs = (Instr**) realloc( instrs, capacity * sizeof(Instr*) );
+      }
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+         instrs[iInstr] = instr;
+      memcpy( live, block->liveOut, nWords * sizeof(unsigned) );
+
+      for ( int iInstr = block->nInstr-1 ; iInstr >= 0 ; iInstr-- )
+      {
+         instr = instrs[iInstr];
+         int def = Cfg_getDef( cfg, instr );
+         if ( def >= 0 && interference[def] )
+         {
+            int src = ( instr->op == OP_SET ) ? Cfg_varIndex( cfg, instr->y ) : -1;
+            int isSrcLive = src >= 0 && Bitset_has( live, src );
+            if ( isSrcLive ) Bitset_remove( live, src );
+            for ( int w = 0 ; w < nWords ; w++ )
+               interference[def][w] |= live[w];
+            if ( isSrcLive ) Bitset_add( live, src );
+         }
+         if ( def >= 0 ) Bitset_remove( live, def );
+         int nUses = Cfg_getUses( cfg, instr, uses );
+         for ( int u = 0 ; u < nUses ; u++ )
+            Bitset_add( live, uses[u] );
+      }
+   }
+
+   // Todas as juncoes da rodada, em classes de variaveis: a linha de uma
+   // classe junta as das variaveis unidas, e duas classes interferem se a
+   // linha de uma tem alguma variavel da outra. Cada classe tem no maximo
+   // uma variavel que nao eh temporaria, que da o nome a todas
+   int* parent = (int*) malloc( (cfg->nVars+1) * sizeof(int) );
+   unsigned** members = (unsigned**) calloc( cfg->nVars+1, sizeof(unsigned*) );
+   for ( int v = 0 ; v < cfg->nVars ; v++ )
+   {
+      parent[v] = v;
+      if ( interference[v] == NULL ) continue;
+      members[v] = (unsigned*) calloc( nWords+1, sizeof(unsigned) );
+      Bitset_add( members[v], v );
+   }
+   for ( int c = 0 ; c < nCandidates ; c++ )
+   {
+      int a = Copy_find( parent, candidates[c].temp );
+      int b = Copy_find( parent, candidates[c].other );
+      if ( a == b ) continue;
+      if ( addrOf[a].type != AD_TEMP && addrOf[b].type != AD_TEMP ) continue;
+      int interferes = 0;
+      for ( int w = 0 ; w < nWords && !interferes ; w++ )
+         interferes = ( interference[a][w] & members[b][w] ) || ( interference[b][w] & members[a][w] );
+      if ( interferes ) continue;
+      if ( addrOf[a].type != AD_TEMP )
+      {
+         int t = a;
+         a = b;
+         b = t;
+      }
+      // A classe a, so de temporarias, passa a fazer parte da b
+      parent[a] = b;
+      for ( int w = 0 ; w < nWords ; w++ )
+      {
+         interference[b][w] |= interference[a][w];
+         members[b][w] |= members[a][w];
+      }
+      nMerged++;
+   }
+
+   // Uma passada renomeia todas as variaveis unidas
+   if ( nMerged > 0 )
+      for ( Instr* instr = function->code ; instr ; instr = instr->next )
+      {
+         Addr* addrs[3] = { &(instr->x), &(instr->y), &(instr->z) };
+         for ( int a = 0 ; a < 3 ; a++ )
+         {
+            int var = Cfg_varIndex( cfg, *addrs[a] );
+            if ( var < 0 || interference[var] == NULL ) continue;
+            int root = Copy_find( parent, var );
+            if ( root != var ) *addrs[a] = addrOf[ root ];
+         }
+      }
+
+   for ( int v = 0 ; v < cfg->nVars ; v++ )
+   {
+      free( interference[v] );
+      free( members[v] );
+   }
+   free( interference );
+   free( members );
+   free( parent );
+   free( instrs );
+   free( live );
+   free( candidates );
+   free( addrOf );
+   // As copias x = x que sobram sao removidas
+   if ( nMerged > 0 ) Copy_removeDead( cfg );
+   return nMerged;
+}
+
+
+
+static int Copy_find( int* parent, int var )
+{
+   // Raiz da classe, encurtando o caminho
+   while ( parent[var] != var )
+   {
+      parent[var] = parent[ parent[var] ];
+      var = parent[var];
+   }
+   return var;
+}
+
+
+
+static void Copy_compactTemps( Function* function )
+{
+   // Remove as temporarias sem uso e renumera as demais
+   int nTemps = Function_nTemps( function );
+   int* newNum = (int*) malloc( (nTemps+1) * sizeof(int) );
+   char* isUsed = (char*) calloc( nTemps+1, sizeof(char) );
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      if ( instr->x.type == AD_TEMP ) isUsed[ instr->x.num ] = 1;
+      if ( instr->y.type == AD_TEMP ) isUsed[ instr->y.num ] = 1;
+      if ( instr->z.type == AD_TEMP ) isUsed[ instr->z.num ] = 1;
+   }
+
+   Variable* kept = NULL;
+   Variable* keptLast = NULL;
+   int num = 0;
+   int t = 0;
+   for ( Variable* v = function->temps ; v ; t++ )
+   {
+      Variable* next = v->next;
+      v->next = NULL;
+      newNum[t] = -1;
+      if ( isUsed[t] )
+      {
+         newNum[t] = num++;
+         if ( keptLast )
+            keptLast->next = v;
+         else
+            kept = v;
+         keptLast = v;
+      }
+      v = next;
+   }
+   function->temps = kept;
+
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      if ( instr->x.type == AD_TEMP ) instr->x.num = newNum[ instr->x.num ];
+      if ( instr->y.type == AD_TEMP ) instr->y.num = newNum[ instr->y.num ];
+      if ( instr->z.type == AD_TEMP ) instr->z.num = newNum[ instr->z.num ];
+   }
+   free( newNum );
+   free( isUsed );
+}
+
+
+
+static int Copy_isCopy( Cfg* cfg, Instr* instr )
+{
+   if ( instr->op != OP_SET || Cfg_varIndex( cfg, instr->x ) < 0 ) return 0;
+   if ( Addr_eq( instr->x, instr->y ) ) return 0;
+   return instr->y.type == AD_NUMBER || Cfg_varIndex( cfg, instr->y ) >= 0;
+}
+
+
+
+static int Copy_isRemovable( Instr* instr )
+{
+   // Divisao pode gerar excecao, acessos a vetor e alocacoes ficam
+   switch ( instr->op )
+   {
+      case OP_SET:
+      case OP_SET_BYTE:
+      case OP_NE:
+      case OP_EQ:
+      case OP_LT:
+      case OP_GT:
+      case OP_LE:
+      case OP_GE:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_NEG:
+         return 1;
+
+      default:
+         return 0;
+   }
+}
+
+
+
+static int Copy_getUseAddrs( Instr* instr, Addr** addrs )
+{
+   // Mesmos operandos lidos que em Cfg_getUses
+   switch ( instr->op )
+   {
+      case OP_PARAM:
+      case OP_IF:
+      case OP_IF_FALSE:
+      case OP_RET_VAL:
+      case OP_IDX_SET:
+      case OP_IDX_SET_BYTE:
+         addrs[0] = &(instr->x);
+         addrs[1] = &(instr->y);
+         addrs[2] = &(instr->z);
+         return 3;
+
+      case OP_LABEL:
+      case OP_GOTO:
+      case OP_CALL:
+      case OP_RET:
+         return 0;
+
+      default:
+         addrs[0] = &(instr->y);
+         addrs[1] = &(instr->z);
+         return 2;
+   }
+}
+
+
+
+static void Copy_unlink( Cfg* cfg, char* isDead )
+{
+   // As instrucoes removidas nunca sao rotulos nem desvios, entao os blocos
+   // e as arestas continuam valendo; so o inicio e o tamanho dos blocos mudam
+   Instr** link = &(cfg->function->code);
+   int pos = 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      int nInstr = block->nInstr;
+      block->first = NULL;
+      block->last = NULL;
+      block->nInstr = 0;
+      for ( int iInstr = 0 ; iInstr < nInstr ; iInstr++, pos++ )
+      {
+         Instr* instr = *link;
+         if ( isDead[pos] )
+         {
+            *link = instr->next;
+            continue;
+         }
+         if ( block->first == NULL ) block->first = instr;
+         block->last = instr;
+         block->nInstr++;
+         link = &(instr->next);
+      }
+   }
+}
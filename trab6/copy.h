@@ -0,0 +1,14 @@
+/**
+ * @file    copy.h
+ * @author  lhpelosi
+ */
+
+#ifndef COPY_H
+#define COPY_H
+
+#include "ir.h"
+
+int Copy_propagate( Function* function );
+int Copy_coalesce( Function* function );
+
+#endif
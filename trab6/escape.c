@@ -0,0 +1,314 @@
+/**
+ * @file    escape.c
+ * @author  lhpelosi
+ */
+
+#include "escape.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+
+typedef struct Site_ {
+   Instr* instr; // new ou new byte
+   int var; // Variavel que recebe o endereco
+   int isClassLive; // Algum apontador da classe ainda vivo antes da alocacao
+   int isRetLive; // $ret vivo antes da alocacao
+} Site;
+
+static int Escape_propagates( Instr* instr );
+static int Escape_find( int* parent, int var );
+static Site* Escape_findSites( Cfg* cfg, int* parent, int* nSites );
+static void Escape_insertFrees( Function* function, Cfg* cfg, Addr* freeVars, int nFreeVars );
+static Instr* Escape_freeCalls( Addr* freeVars, int nFreeVars );
+
+
+
+int Escape_optimize( Function* function, EscapeOptions* options )
+{
+   Cfg* cfg = Cfg_build( function );
+   Cfg_computeLiveness( cfg );
+   int nVars = cfg->nVars;
+   char* isPointer = (char*) calloc( nVars+1, sizeof(char) );
+   char* escapes = (char*) calloc( nVars+1, sizeof(char) );
+   int* nDefs = (int*) calloc( nVars+1, sizeof(int) );
+   int* nNewDefs = (int*) calloc( nVars+1, sizeof(int) );
+   int* parent = (int*) malloc( (nVars+1) * sizeof(int) );
+   int uses[3];
+
+   // Variaveis que podem guardar enderecos vindos de new, inclusive deslocados
+   for ( int var = 0 ; var < nVars ; var++ )
+      parent[var] = var;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      Instr* instr = cfg->blocks[i]->first;
+      for ( int iInstr = 0 ; iInstr < cfg->blocks[i]->nInstr ; iInstr++, instr = instr->next )
+      {
+         int def = Cfg_getDef( cfg, instr );
+         if ( def >= 0 ) nDefs[def]++;
+         if ( def >= 0 && ( instr->op == OP_NEW || instr->op == OP_NEW_BYTE ) )
+         {
+            isPointer[def] = 1;
+            nNewDefs[def]++;
+         }
+      }
+   }
+   int changed = 1;
+   while ( changed )
+   {
+      changed = 0;
+      for ( Instr* instr = function->code ; instr ; instr = instr->next )
+      {
+         int def = Cfg_getDef( cfg, instr );
+         if ( def < 0 || isPointer[def] || !Escape_propagates( instr ) ) continue;
+         int nUses = Cfg_getUses( cfg, instr, uses );
+         for ( int u = 0 ; u < nUses ; u++ )
+            if ( isPointer[ uses[u] ] )
+            {
+               isPointer[def] = 1;
+               changed = 1;
+            }
+      }
+   }
+
+   // Classes de apontadores que podem indicar o mesmo vetor, e as que escapam
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      int def = Cfg_getDef( cfg, instr );
+      int nUses = Cfg_getUses( cfg, instr, uses );
+      if ( !Escape_propagates( instr ) ) continue;
+      for ( int u = 0 ; u < nUses ; u++ )
+      {
+         if ( !isPointer[ uses[u] ] ) continue;
+         if ( def < 0 )
+            escapes[ uses[u] ] = 1; // Atribuicao a global
+         else
+            parent[ Escape_find( parent, uses[u] ) ] = Escape_find( parent, def );
+      }
+   }
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      int var = -1;
+      if ( instr->op == OP_PARAM || instr->op == OP_RET_VAL )
+         var = Cfg_varIndex( cfg, instr->x );
+      else if ( instr->op == OP_IDX_SET || instr->op == OP_IDX_SET_BYTE )
+         var = Cfg_varIndex( cfg, instr->z ); // Endereco guardado na memoria
+      if ( var >= 0 && isPointer[var] ) escapes[var] = 1;
+   }
+   for ( int var = 0 ; var < nVars ; var++ )
+      if ( escapes[var] ) escapes[ Escape_find( parent, var ) ] = 1;
+
+   // Vetores de tamanho constante vao para o registro; os demais, se
+   // o endereco so fica em uma variavel, sao liberados automaticamente
+   int nSites = 0;
+   Site* sites = Escape_findSites( cfg, parent, &nSites );
+   Addr* freeVars = (Addr*) malloc( (nSites+1) * sizeof(Addr) );
+   int nFreeVars = 0;
+   int frameBytes = 0;
+   int nOptimized = 0;
+   for ( int s = 0 ; s < nSites ; s++ )
+   {
+      Instr* instr = sites[s].instr;
+      int root = Escape_find( parent, sites[s].var );
+      int elemSize = ( instr->op == OP_NEW ) ? 4 : 1;
+      if ( escapes[root] || sites[s].isClassLive || instr->y.type != AD_NUMBER || instr->y.num < 0 ||
+           frameBytes + elemSize * instr->y.num > options->maxFrameBytes )
+         continue;
+
+      int bytes = ( elemSize * instr->y.num + 3 ) & ~3;
+      frameBytes += bytes;
+      instr->op = OP_NEW_FRAME;
+      instr->y = Addr_litNum( bytes );
+      nNewDefs[ sites[s].var ] = -1; // Nao pode ser liberada com free
+      if ( options->stats )
+         fprintf( options->stats, "Alocacao no registro: %s em %s, %d bytes\n",
+                                  instr->x.str, function->name, bytes );
+      nOptimized++;
+   }
+   for ( int s = 0 ; s < nSites ; s++ )
+   {
+      Instr* instr = sites[s].instr;
+      int var = sites[s].var;
+      int root = Escape_find( parent, var );
+      if ( instr->op == OP_NEW_FRAME || nNewDefs[var] != nDefs[var] ) continue;
+
+      // Todas as definicoes da variavel sao alocacoes, e nenhuma
+      // acontece com o vetor anterior ainda em uso
+      int nMembers = 0;
+      for ( int v = 0 ; v < nVars ; v++ )
+         if ( Escape_find( parent, v ) == root ) nMembers++;
+      if ( escapes[root] || nMembers != 1 || var < function->nArgs ||
+           sites[s].isClassLive || sites[s].isRetLive )
+         nNewDefs[var] = -1;
+   }
+   for ( int s = 0 ; s < nSites ; s++ )
+   {
+      Instr* instr = sites[s].instr;
+      int var = sites[s].var;
+      if ( instr->op == OP_NEW_FRAME || nNewDefs[var] != nDefs[var] ) continue;
+      nNewDefs[var] = 0; // Uma liberacao por variavel
+      freeVars[ nFreeVars++ ] = instr->x;
+      if ( options->stats )
+         fprintf( options->stats, "Liberacao automatica: %s em %s\n",
+                                  instr->x.str, function->name );
+      nOptimized++;
+   }
+   if ( nFreeVars > 0 )
+      Escape_insertFrees( function, cfg, freeVars, nFreeVars );
+
+   free( freeVars );
+   free( sites );
+   free( parent );
+   free( nNewDefs );
+   free( nDefs );
+   free( escapes );
+   free( isPointer );
+   Cfg_delete( cfg );
+   return nOptimized;
+}
+
+
+
+static int Escape_propagates( Instr* instr )
+{
+   // Operacoes cujo resultado pode ser um endereco derivado dos operandos
+   switch ( instr->op )
+   {
+      case OP_SET:
+      case OP_SET_BYTE:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_DIV:
+      case OP_NEG:
+         return 1;
+
+      default:
+         return 0;
+   }
+}
+
+
+
+static int Escape_find( int* parent, int var )
+{
+   while ( parent[var] != var )
+   {
+      parent[var] = parent[ parent[var] ];
+      var = parent[var];
+   }
+   return var;
+}
+
+
+
+static Site* Escape_findSites( Cfg* cfg, int* parent, int* nSites )
+{
+   int nWords = Bitset_words( cfg->nVars );
+   unsigned* live = (unsigned*) malloc( (nWords+1) * sizeof(unsigned) );
+   Instr** instrs = NULL;
+   Site* sites = NULL;
+   int uses[3];
+
+   // Vivas antes de cada alocacao, percorrendo os blocos de tras para frente
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      instrs = (Instr**) realloc( instrs, (block->nInstr+1) * sizeof(Instr*) );
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+         instrs[iInstr] = instr;
+      memcpy( live, block->liveOut, nWords * sizeof(unsigned) );
+
+      for ( int iInstr = block->nInstr-1 ; iInstr >= 0 ; iInstr-- )
+      {
+         instr = instrs[iInstr];
+         int def = Cfg_getDef( cfg, instr );
+         if ( def >= 0 ) Bitset_remove( live, def );
+         int nUses = Cfg_getUses( cfg, instr, uses );
+         for ( int u = 0 ; u < nUses ; u++ )
+            Bitset_add( live, uses[u] );
+         if ( def < 0 || ( instr->op != OP_NEW && instr->op != OP_NEW_BYTE ) ) continue;
+
+         Site* site;
+         sites = (Site*) realloc( sites, (*nSites+1) * sizeof(Site) );
+         site = &(sites[ (*nSites)++ ]);
+         site->instr = instr;
+         site->var = def;
+         site->isClassLive = 0;
+         site->isRetLive = cfg->retVar >= 0 && Bitset_has( live, cfg->retVar );
+         for ( int var = 0 ; var < cfg->nVars ; var++ )
+            if ( Bitset_has( live, var ) && Escape_find( parent, var ) == Escape_find( parent, def ) )
+               site->isClassLive = 1;
+      }
+   }
+
+   free( instrs );
+   free( live );
+   return sites;
+}
+
+
+
+static void Escape_insertFrees( Function* function, Cfg* cfg, Addr* freeVars, int nFreeVars )
+{
+   // A saida pelo fim do codigo ganha um ret, que tambem libera os vetores
+   Instr* last = function->code;
+   while ( last->next ) last = last->next;
+   if ( last->op != OP_RET && last->op != OP_RET_VAL && last->op != OP_GOTO )
+      last->next = Instr_new( OP_RET );
+
+   // Antes de cada nova alocacao e de cada retorno, libera o vetor anterior
+   Instr** link = &(function->code);
+   while ( *link )
+   {
+      Instr* instr = *link;
+      Instr* calls = NULL;
+      if ( instr->op == OP_NEW || instr->op == OP_NEW_BYTE )
+      {
+         for ( int f = 0 ; f < nFreeVars ; f++ )
+            if ( Addr_eq( instr->x, freeVars[f] ) )
+               calls = Escape_freeCalls( &(freeVars[f]), 1 );
+      }
+      else if ( instr->op == OP_RET || instr->op == OP_RET_VAL )
+      {
+         // A chamada a free sobrescreve $ret
+         if ( instr->op == OP_RET_VAL && cfg->retVar >= 0 && Cfg_varIndex( cfg, instr->x ) == cfg->retVar )
+         {
+            Addr temp = Function_newTemp( function );
+            calls = Instr_new( OP_SET, temp, instr->x );
+            instr->x = temp;
+         }
+         calls = Instr_link( calls, Escape_freeCalls( freeVars, nFreeVars ) );
+      }
+
+      if ( calls )
+      {
+         Instr* last = calls;
+         while ( last->next ) last = last->next;
+         last->next = instr;
+         *link = calls;
+      }
+      link = &(instr->next);
+   }
+
+   // Sem alocacao anterior, free recebe zero
+   Instr* init = NULL;
+   for ( int f = 0 ; f < nFreeVars ; f++ )
+      init = Instr_link( init, Instr_new( OP_SET, freeVars[f], Addr_litNum( 0 ) ) );
+   function->code = Instr_link( init, function->code );
+}
+
+
+
+static Instr* Escape_freeCalls( Addr* freeVars, int nFreeVars )
+{
+   Instr* calls = NULL;
+   for ( int f = 0 ; f < nFreeVars ; f++ )
+   {
+      calls = Instr_link( calls, Instr_new( OP_PARAM, freeVars[f] ) );
+      calls = Instr_link( calls, Instr_new( OP_CALL, Addr_function( strdup( "free" ) ), Addr_litNum( 1 ) ) );
+   }
+   return calls;
+}
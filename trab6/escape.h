@@ -0,0 +1,19 @@
+/**
+ * @file    escape.h
+ * @author  lhpelosi
+ */
+
+#ifndef ESCAPE_H
+#define ESCAPE_H
+
+#include <stdio.h>
+#include "ir.h"
+
+typedef struct EscapeOptions_ {
+   int maxFrameBytes; // Maximo de bytes de vetores no registro de ativacao
+   FILE* stats; // Relatorio das alocacoes tratadas, NULL para nenhum
+} EscapeOptions;
+
+int Escape_optimize( Function* function, EscapeOptions* options );
+
+#endif
@@ -0,0 +1,258 @@
+/**
+ * @file    frame.c
+ * @author  lhpelosi
+ */
+
+#include "frame.h"
+
+#include <stdlib.h>
+
+#include "cfg.h"
+#include "remark.h"
+
+typedef struct Interval_ {
+   int var;
+   int start;
+   int end;
+} Interval;
+
+static void Frame_extend( Interval* intervals, int var, int pos );
+static int Frame_assignSlots( Interval* intervals, int nIntervals, int* slot, Function* function );
+static void Frame_remarkSpills( Function* function, int nVars, int nRegArgs );
+static const char* Frame_varName( Function* function, int var );
+static int Frame_compareStart( const void* a, const void* b );
+static void Frame_placeArrays( Frame* frame, Function* function );
+
+
+
+Frame* Frame_build( Function* function, int share, int nRegArgs )
+{
+   Frame* frame = (Frame*) malloc( sizeof(Frame) );
+   int nArgs = function->nArgs;
+   int nLocals = Function_nLocals( function );
+   frame->nVars = nLocals + Function_nTemps( function );
+   frame->offset = (int*) calloc( frame->nVars+1, sizeof(int) );
+   frame->isByte = (char*) calloc( frame->nVars+1, sizeof(char) );
+
+   // Argumentos empilhados ficam no registro de quem chama; os recebidos
+   // em registradores sao guardados no registro desta funcao
+   if ( nRegArgs > nArgs ) nRegArgs = nArgs;
+   for ( int var = nRegArgs ; var < nArgs ; var++ )
+      frame->offset[var] = 4 * (var - nRegArgs + 2); // +2 pelo %ebp e pelo endereco de retorno
+
+   // Sem compartilhamento: uma posicao de 4 bytes por variavel
+   if ( !share )
+   {
+      int slot = 0;
+      for ( int var = 0 ; var < frame->nVars ; var++ )
+         if ( var < nRegArgs || var >= nArgs )
+            frame->offset[var] = -4 * (++slot);
+      frame->size = 4 * slot;
+      Frame_placeArrays( frame, function );
+      Remark_emit( REMARK_MISSED, "share-slots", function, 0, "%d variaveis em %d bytes: compartilhamento desligado",
+                   slot, frame->size );
+      Frame_remarkSpills( function, frame->nVars, nRegArgs );
+      return frame;
+   }
+
+   // Intervalo de vida de cada variavel na ordem linear do codigo
+   Cfg* cfg = Cfg_build( function );
+   Cfg_computeLiveness( cfg );
+   Interval* intervals = (Interval*) malloc( (frame->nVars+1) * sizeof(Interval) );
+   char* wordDef = (char*) calloc( frame->nVars+1, sizeof(char) );
+   char* byteDef = (char*) calloc( frame->nVars+1, sizeof(char) );
+   for ( int var = 0 ; var < frame->nVars ; var++ )
+   {
+      intervals[var].var = var;
+      intervals[var].start = -1;
+      intervals[var].end = -1;
+   }
+   // Argumentos em registradores sao guardados no prologo
+   for ( int var = 0 ; var < nRegArgs ; var++ )
+      Frame_extend( intervals, var, 0 );
+
+   int pos = 0;
+   int uses[3];
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      int blockStart = pos;
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next, pos++ )
+      {
+         int nUses = Cfg_getUses( cfg, instr, uses );
+         for ( int u = 0 ; u < nUses ; u++ )
+            Frame_extend( intervals, uses[u], pos );
+         int def = Cfg_getDef( cfg, instr );
+         if ( def < 0 ) continue;
+         Frame_extend( intervals, def, pos );
+         if ( instr->op == OP_SET_BYTE || instr->op == OP_SET_IDX_BYTE )
+            byteDef[def] = 1;
+         else
+            wordDef[def] = 1;
+      }
+      for ( int var = 0 ; var < frame->nVars ; var++ )
+      {
+         if ( Bitset_has( block->liveIn, var ) ) Frame_extend( intervals, var, blockStart );
+         if ( Bitset_has( block->liveOut, var ) ) Frame_extend( intervals, var, pos-1 );
+      }
+   }
+
+   // Valores sempre vindos de bytes ocupam um so byte
+   int nWords = 0;
+   int nBytes = 0;
+   Interval* words = (Interval*) malloc( (frame->nVars+1) * sizeof(Interval) );
+   Interval* bytes = (Interval*) malloc( (frame->nVars+1) * sizeof(Interval) );
+   for ( int var = 0 ; var < frame->nVars ; var++ )
+   {
+      if ( ( var >= nRegArgs && var < nArgs ) || intervals[var].start < 0 ) continue;
+      frame->isByte[var] = var >= nArgs && byteDef[var] && !wordDef[var];
+      if ( frame->isByte[var] )
+         bytes[ nBytes++ ] = intervals[var];
+      else
+         words[ nWords++ ] = intervals[var];
+   }
+
+   int* slot = (int*) malloc( (frame->nVars+1) * sizeof(int) );
+   int nWordSlots = Frame_assignSlots( words, nWords, slot, function );
+   for ( int i = 0 ; i < nWords ; i++ )
+      frame->offset[ words[i].var ] = -4 * (slot[i] + 1);
+   int nByteSlots = Frame_assignSlots( bytes, nBytes, slot, function );
+   for ( int i = 0 ; i < nBytes ; i++ )
+      frame->offset[ bytes[i].var ] = -4 * nWordSlots - (slot[i] + 1);
+   frame->size = 4 * nWordSlots + 4 * ( (nByteSlots + 3) / 4 );
+   Frame_placeArrays( frame, function );
+   Remark_emit( REMARK_ANALYSIS, "share-slots", function, 0, "%d variaveis em %d posicoes, %d bytes",
+                nWords + nBytes, nWordSlots + nByteSlots, frame->size );
+   Frame_remarkSpills( function, nWords + nBytes + nArgs - nRegArgs, nRegArgs );
+
+   free( slot );
+   free( words );
+   free( bytes );
+   free( wordDef );
+   free( byteDef );
+   free( intervals );
+   Cfg_delete( cfg );
+   return frame;
+}
+
+
+
+void Frame_delete( Frame* frame )
+{
+   if ( frame == NULL ) return;
+   free( frame->offset );
+   free( frame->isByte );
+   free( frame->arrays );
+   free( frame->arrayOffset );
+   free( frame );
+}
+
+
+
+int Frame_arrayOffset( Frame* frame, Instr* instr )
+{
+   for ( int a = 0 ; a < frame->nArrays ; a++ )
+      if ( frame->arrays[a] == instr )
+         return frame->arrayOffset[a];
+   return 0;
+}
+
+
+
+int Frame_classicSize( Function* function )
+{
+   // Locais e temporarias; os argumentos ficam no registro de quem chama
+   int nVariables = Function_nLocals( function ) + Function_nTemps( function ) - function->nArgs;
+   return 4 * nVariables;
+}
+
+
+
+static void Frame_extend( Interval* intervals, int var, int pos )
+{
+   if ( intervals[var].start < 0 || pos < intervals[var].start ) intervals[var].start = pos;
+   if ( pos > intervals[var].end ) intervals[var].end = pos;
+}
+
+
+
+static int Frame_assignSlots( Interval* intervals, int nIntervals, int* slot, Function* function )
+{
+   // Coloracao do grafo de intervalos: em ordem de inicio, cada intervalo
+   // reaproveita uma posicao cujo ultimo ocupante ja terminou
+   qsort( intervals, nIntervals, sizeof(Interval), Frame_compareStart );
+   int nSlots = 0;
+   int* slotEnd = (int*) malloc( (nIntervals+1) * sizeof(int) );
+   int* slotVar = (int*) malloc( (nIntervals+1) * sizeof(int) );
+   for ( int i = 0 ; i < nIntervals ; i++ )
+   {
+      int s = 0;
+      while ( s < nSlots && slotEnd[s] >= intervals[i].start ) s++;
+      if ( s == nSlots )
+         nSlots++;
+      else if ( Remark_wants( function ) )
+         Remark_emit( REMARK_PASSED, "share-slots", function, intervals[i].start, "%s reaproveita a posicao de %s",
+                      Frame_varName( function, intervals[i].var ), Frame_varName( function, slotVar[s] ) );
+      slotEnd[s] = intervals[i].end;
+      slotVar[s] = intervals[i].var;
+      slot[i] = s;
+   }
+   free( slotEnd );
+   free( slotVar );
+   return nSlots;
+}
+
+
+
+static void Frame_remarkSpills( Function* function, int nVars, int nRegArgs )
+{
+   // Nao ha alocacao de registradores: toda variavel fica no registro
+   if ( !Remark_wants( function ) ) return;
+   Remark_emit( REMARK_ANALYSIS, "spill", function, 0, "%d variaveis na pilha, nenhuma em registrador", nVars );
+   for ( int var = 0 ; var < nRegArgs && var < function->nArgs ; var++ )
+      Remark_emit( REMARK_MISSED, "spill", function, 0, "argumento %s chega em registrador e e guardado na pilha",
+                   Frame_varName( function, var ) );
+}
+
+
+
+static const char* Frame_varName( Function* function, int var )
+{
+   // Locais seguidas das temporarias
+   int nLocals = Function_nLocals( function );
+   Variable* v = ( var < nLocals ) ? function->locals : function->temps;
+   for ( int i = ( var < nLocals ) ? var : var - nLocals ; i > 0 ; i-- )
+      v = v->next;
+   return v->name;
+}
+
+
+
+static int Frame_compareStart( const void* a, const void* b )
+{
+   const Interval* ia = (const Interval*) a;
+   const Interval* ib = (const Interval*) b;
+   if ( ia->start != ib->start ) return ia->start - ib->start;
+   return ia->var - ib->var;
+}
+
+
+
+static void Frame_placeArrays( Frame* frame, Function* function )
+{
+   // Vetores de new frame ficam abaixo das variaveis, um para cada alocacao
+   frame->arrays = NULL;
+   frame->arrayOffset = NULL;
+   frame->nArrays = 0;
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      if ( instr->op != OP_NEW_FRAME ) continue;
+      frame->arrays = (Instr**) realloc( frame->arrays, (frame->nArrays+1) * sizeof(Instr*) );
+      frame->arrayOffset = (int*) realloc( frame->arrayOffset, (frame->nArrays+1) * sizeof(int) );
+      frame->size += ( instr->y.num + 3 ) & ~3;
+      frame->arrays[ frame->nArrays ] = instr;
+      frame->arrayOffset[ frame->nArrays ] = -frame->size;
+      frame->nArrays++;
+   }
+}
@@ -0,0 +1,26 @@
+/**
+ * @file    frame.h
+ * @author  lhpelosi
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "ir.h"
+
+typedef struct Frame_ {
+   int nVars; // Locais seguidas das temporarias
+   int* offset; // Deslocamento de cada variavel em relacao a %ebp
+   char* isByte; // Variavel guardada em um unico byte
+   int size; // Bytes reservados abaixo de %ebp
+   Instr** arrays; // Vetores alocados no registro (new frame)
+   int* arrayOffset; // Deslocamento do inicio de cada vetor
+   int nArrays;
+} Frame;
+
+Frame* Frame_build( Function* function, int share, int nRegArgs );
+void Frame_delete( Frame* frame );
+int Frame_arrayOffset( Frame* frame, Instr* instr );
+int Frame_classicSize( Function* function );
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "ir.h"
 #include "token.h"
+#include "timing.h"
 
 #define YYDEBUG 1
 
@@ -14,6 +15,23 @@ extern int yylineno;
 IR* ir;
 Function* fun;
 
+/* Instructions of a command that did not get a line take the line of its first token */
+static Instr* Instr_setLine(Instr* ins, int line) {
+	for (Instr* i = ins; i; i = i->next) {
+		if (i->line == 0) i->line = line;
+	}
+	return ins;
+}
+
+/* commands is left recursive: each command is appended after the last one, keeping the parser stack shallow */
+static void Commands_append(Token* commands, Instr* code) {
+	if (!code) return;
+	if (commands->last) commands->last->next = code;
+	else commands->ins = code;
+	while (code->next) code = code->next;
+	commands->last = code;
+}
+
 %}
 
 %token ERROR
@@ -65,15 +83,15 @@ more_args	: ',' args { $$.vars = $2.vars; }
 arg		: ID { $$.vars = Variable_new($1.asString); }
 		;
 
-commands	: label command nl commands { $$.ins = Instr_link($1.ins, Instr_link($2.ins, $4.ins)); }
-		| { $$.ins = NULL; }
+commands	: commands label command nl { $$ = $1; Commands_append(&$$, $2.ins); Commands_append(&$$, Instr_setLine($3.ins, $3.line)); }
+		| { $$.ins = NULL; $$.last = NULL; }
 		;
 
-label		: LABEL ':' opt_nl label { $$.ins = Instr_link(Instr_new(OP_LABEL, Addr_label($1.asString)), $4.ins); }
+label		: LABEL ':' opt_nl label { $$.ins = Instr_link(Instr_setLine(Instr_new(OP_LABEL, Addr_label($1.asString)), $1.line), $4.ins); }
 		| { $$.ins = NULL; }
 		;
 
-id		: ID { $$.addr = Addr_resolve($1.asString, ir, fun); }
+id		: ID { Timing_start(TIMING_RESOLVE); $$.addr = Addr_resolve($1.asString, ir, fun); Timing_stop(TIMING_RESOLVE); }
 		;
 
 rval		: LITNUM { $$.addr = Addr_litNum($1.asInteger); }
@@ -116,14 +134,14 @@ unop		: '-' { $$.op = OP_NEG; }
 call		: params
                   /* In case of functions with a return value,
                      assume that this is stored in special temporary $ret */ 
-		  CALL ID LITNUM { $$.ins = Instr_link($1.ins, Instr_new(OP_CALL, Addr_function($3.asString), Addr_litNum($4.asInteger))); }
+		  CALL ID LITNUM { $$.ins = Instr_link($1.ins, Instr_setLine(Instr_new(OP_CALL, Addr_function($3.asString), Addr_litNum($4.asInteger)), $2.line)); }
                 ;
 
 params		: param nl params { $$.ins = Instr_link($1.ins, $3.ins); }
 		| { $$.ins = NULL; }
 		;
 
-param		: PARAM rval { $$.ins = Instr_new(OP_PARAM, $2.addr); }
+param		: PARAM rval { $$.ins = Instr_setLine(Instr_new(OP_PARAM, $2.addr), $1.line); }
 		;
 
 
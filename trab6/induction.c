@@ -0,0 +1,444 @@
+/**
+ * @file    induction.c
+ * @author  lhpelosi
+ */
+
+#include "induction.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include "loop.h"
+
+// Valor da forma scale*basica + offset + constant, com offset invariante no laco
+typedef struct Induction_ {
+   int basis; // Indice da variavel basica, -1 se o valor nao eh de inducao
+   int scale;
+   Addr offset; // AD_UNSET se nao houver
+   int constant;
+} Induction;
+
+// Variavel nova que acompanha uma inducao derivada
+typedef struct Reduced_ {
+   Induction iv;
+   Addr var;
+} Reduced;
+
+typedef struct Context_ {
+   Cfg* cfg;
+   LoopInfo* info;
+   Instr** basicDef; // Definicao i = i + c de cada variavel basica, ou NULL
+   int* step;
+   Induction* current; // Inducoes derivadas validas no bloco corrente
+   int* touched;
+   int nTouched;
+   char* isTouched;
+   Reduced* reduced;
+   int nReduced;
+} Context;
+
+static int Induction_reduceLoop( Cfg* cfg, Loop* loop, void* data );
+static void Induction_findBasic( Context* ctx );
+static void Induction_scanBlock( Context* ctx, CfgBlock* block );
+static Induction Induction_of( Context* ctx, Addr addr );
+static Induction Induction_invalid();
+static int Induction_equal( Induction a, Induction b );
+static Addr Induction_getVar( Context* ctx, Induction iv );
+static Instr* Induction_linearCode( Addr dest, Addr basis, Induction iv );
+static int Induction_replaceTest( Context* ctx, int basis, Instr** preheader );
+static void Induction_setCurrent( Context* ctx, int var, Induction iv );
+static int Induction_fitsInt( long long value );
+
+
+
+int Induction_reduce( Function* function )
+{
+   return Loop_forEach( function, Induction_reduceLoop, NULL, 1 );
+}
+
+
+
+static int Induction_reduceLoop( Cfg* cfg, Loop* loop, void* data )
+{
+   Context ctx;
+   Instr* preheader = NULL;
+   int nChanges = 0;
+
+   ctx.cfg = cfg;
+   ctx.info = Loop_analyze( cfg, loop );
+   ctx.basicDef = (Instr**) calloc( cfg->nVars+1, sizeof(Instr*) );
+   ctx.step = (int*) calloc( cfg->nVars+1, sizeof(int) );
+   ctx.current = (Induction*) malloc( (cfg->nVars+1) * sizeof(Induction) );
+   ctx.touched = (int*) malloc( (cfg->nVars+1) * sizeof(int) );
+   ctx.nTouched = 0;
+   ctx.isTouched = (char*) calloc( cfg->nVars+1, sizeof(char) );
+   ctx.reduced = NULL;
+   ctx.nReduced = 0;
+   for ( int v = 0 ; v < cfg->nVars ; v++ )
+      ctx.current[v] = Induction_invalid();
+
+   Induction_findBasic( &ctx );
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      if ( Loop_contains( loop, cfg->blocks[i] ) )
+         Induction_scanBlock( &ctx, cfg->blocks[i] );
+   nChanges = ctx.nReduced;
+
+   if ( ctx.nReduced > 0 )
+   {
+      // Valores iniciais no pre-cabecalho
+      for ( int r = 0 ; r < ctx.nReduced ; r++ )
+      {
+         Induction iv = ctx.reduced[r].iv;
+         preheader = Instr_link( preheader, Induction_linearCode( ctx.reduced[r].var,
+                                                                  ctx.basicDef[ iv.basis ]->x, iv ) );
+      }
+
+      // Incrementos junto a cada variavel basica
+      for ( int b = 0 ; b < cfg->nVars ; b++ )
+      {
+         Instr* def = ctx.basicDef[b];
+         if ( def == NULL ) continue;
+         int replaced = Induction_replaceTest( &ctx, b, &preheader );
+         nChanges += replaced;
+         for ( int r = ctx.nReduced-1 ; r >= 0 ; r-- )
+         {
+            Reduced* red = &(ctx.reduced[r]);
+            if ( red->iv.basis != b ) continue;
+            Instr* inc = Instr_new( OP_ADD, red->var, red->var,
+                                    Addr_litNum( red->iv.scale * ctx.step[b] ) );
+            if ( replaced )
+            {
+               // O contador original deixou de ser usado: seu incremento da lugar ao novo
+               Instr* next = def->next;
+               *def = *inc;
+               def->next = next;
+               free( inc );
+               replaced = 0;
+            }
+            else
+            {
+               inc->next = def->next;
+               def->next = inc;
+            }
+         }
+      }
+
+      Loop_insertPreheader( cfg, loop, preheader );
+   }
+
+   free( ctx.basicDef );
+   free( ctx.step );
+   free( ctx.current );
+   free( ctx.touched );
+   free( ctx.isTouched );
+   free( ctx.reduced );
+   Loop_deleteInfo( ctx.info );
+   return nChanges;
+}
+
+
+
+static void Induction_findBasic( Context* ctx )
+{
+   Cfg* cfg = ctx->cfg;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      if ( !Loop_contains( ctx->info->loop, block ) ) continue;
+
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+      {
+         // Somente i = i + c, i = c + i e i = i - c, com uma unica definicao no laco
+         int var = Cfg_getDef( cfg, instr );
+         if ( var < 0 || var >= cfg->nVars || ctx->info->defCount[ var ] != 1 ) continue;
+         if ( instr->op == OP_ADD && Addr_eq( instr->y, instr->x ) && instr->z.type == AD_NUMBER )
+            ctx->step[ var ] = instr->z.num;
+         else if ( instr->op == OP_ADD && Addr_eq( instr->z, instr->x ) && instr->y.type == AD_NUMBER )
+            ctx->step[ var ] = instr->y.num;
+         else if ( instr->op == OP_SUB && Addr_eq( instr->y, instr->x ) && instr->z.type == AD_NUMBER )
+            ctx->step[ var ] = -instr->z.num;
+         else
+            continue;
+         ctx->basicDef[ var ] = instr;
+      }
+   }
+}
+
+
+
+static void Induction_scanBlock( Context* ctx, CfgBlock* block )
+{
+   Cfg* cfg = ctx->cfg;
+
+   // As derivadas so sao conhecidas dentro do bloco em que foram calculadas
+   for ( int t = 0 ; t < ctx->nTouched ; t++ )
+   {
+      ctx->current[ ctx->touched[t] ] = Induction_invalid();
+      ctx->isTouched[ ctx->touched[t] ] = 0;
+   }
+   ctx->nTouched = 0;
+
+   Instr* instr = block->first;
+   for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+   {
+      int size = ( instr->op == OP_SET_IDX_BYTE || instr->op == OP_IDX_SET_BYTE ) ? 1 : 4;
+      Addr* base = NULL;
+      Addr* index = NULL;
+      if ( instr->op == OP_SET_IDX || instr->op == OP_SET_IDX_BYTE )
+      {
+         base = &(instr->y);
+         index = &(instr->z);
+      }
+      else if ( instr->op == OP_IDX_SET || instr->op == OP_IDX_SET_BYTE )
+      {
+         base = &(instr->x);
+         index = &(instr->y);
+      }
+
+      // Acesso a vetor com indice de inducao vira um ponteiro incrementado
+      if ( base && index->type != AD_NUMBER && Loop_isInvariant( ctx->info, *base ) )
+      {
+         Induction iv = Induction_of( ctx, *index );
+         if ( iv.basis >= 0 && iv.offset.type == AD_UNSET )
+         {
+            iv.scale *= size;
+            iv.constant *= size;
+            iv.offset = *base;
+            *base = Induction_getVar( ctx, iv );
+            *index = Addr_litNum( 0 );
+         }
+      }
+
+      int var = Cfg_getDef( cfg, instr );
+      if ( var < 0 || var >= cfg->nVars ) continue;
+
+      // Variavel basica redefinida: as derivadas dela deixam de valer
+      if ( ctx->basicDef[ var ] == instr )
+      {
+         for ( int t = 0 ; t < ctx->nTouched ; t++ )
+            if ( ctx->current[ ctx->touched[t] ].basis == var )
+               ctx->current[ ctx->touched[t] ] = Induction_invalid();
+         continue;
+      }
+      if ( ctx->basicDef[ var ] ) continue;
+
+      Induction iv = Induction_invalid();
+      Induction y = Induction_of( ctx, instr->y );
+      Induction z = Induction_of( ctx, instr->z );
+      switch ( instr->op )
+      {
+         case OP_MUL:
+         {
+            // Multiplicacao substituida pela variavel reduzida
+            Induction source = ( y.basis >= 0 ) ? y : z;
+            Addr factor = ( y.basis >= 0 ) ? instr->z : instr->y;
+            if ( source.basis >= 0 && factor.type == AD_NUMBER && source.offset.type == AD_UNSET )
+            {
+               iv = source;
+               iv.scale *= factor.num;
+               iv.constant *= factor.num;
+               instr->op = OP_SET;
+               instr->y = Induction_getVar( ctx, iv );
+               instr->z.type = AD_UNSET;
+            }
+            break;
+         }
+
+         case OP_ADD:
+         {
+            Induction source = ( y.basis >= 0 ) ? y : z;
+            Addr other = ( y.basis >= 0 ) ? instr->z : instr->y;
+            if ( source.basis < 0 || ( y.basis >= 0 && z.basis >= 0 ) ) break;
+            if ( other.type == AD_NUMBER )
+            {
+               iv = source;
+               iv.constant += other.num;
+            }
+            else if ( source.offset.type == AD_UNSET && Loop_isInvariant( ctx->info, other ) )
+            {
+               iv = source;
+               iv.offset = other;
+            }
+            break;
+         }
+
+         case OP_SUB:
+            if ( y.basis >= 0 && instr->z.type == AD_NUMBER )
+            {
+               iv = y;
+               iv.constant -= instr->z.num;
+            }
+            break;
+
+         default:
+            break;
+      }
+      Induction_setCurrent( ctx, var, iv );
+   }
+}
+
+
+
+static Induction Induction_of( Context* ctx, Addr addr )
+{
+   int var = Cfg_varIndex( ctx->cfg, addr );
+   if ( var < 0 || var >= ctx->cfg->nVars ) return Induction_invalid();
+   if ( ctx->basicDef[ var ] )
+   {
+      Induction iv = Induction_invalid();
+      iv.basis = var;
+      iv.scale = 1;
+      return iv;
+   }
+   return ctx->current[ var ];
+}
+
+
+
+static Induction Induction_invalid()
+{
+   Induction iv;
+   iv.basis = -1;
+   iv.scale = 0;
+   iv.offset.type = AD_UNSET;
+   iv.offset.str = NULL;
+   iv.offset.num = 0;
+   iv.constant = 0;
+   return iv;
+}
+
+
+
+static int Induction_equal( Induction a, Induction b )
+{
+   return a.basis == b.basis && a.scale == b.scale && a.constant == b.constant &&
+          Addr_eq( a.offset, b.offset );
+}
+
+
+
+static Addr Induction_getVar( Context* ctx, Induction iv )
+{
+   for ( int r = 0 ; r < ctx->nReduced ; r++ )
+      if ( Induction_equal( ctx->reduced[r].iv, iv ) )
+         return ctx->reduced[r].var;
+
+   ctx->reduced = (Reduced*) realloc( ctx->reduced, (ctx->nReduced+1) * sizeof(Reduced) );
+   ctx->reduced[ ctx->nReduced ].iv = iv;
+   ctx->reduced[ ctx->nReduced ].var = Function_newTemp( ctx->cfg->function );
+   return ctx->reduced[ ctx->nReduced++ ].var;
+}
+
+
+
+static Instr* Induction_linearCode( Addr dest, Addr basis, Induction iv )
+{
+   // dest = scale*basis + offset + constant
+   Instr* code;
+   if ( iv.scale == 1 )
+      code = Instr_new( OP_SET, dest, basis );
+   else
+      code = Instr_new( OP_MUL, dest, basis, Addr_litNum( iv.scale ) );
+   if ( iv.offset.type != AD_UNSET )
+      code = Instr_link( code, Instr_new( OP_ADD, dest, dest, iv.offset ) );
+   if ( iv.constant != 0 )
+      code = Instr_link( code, Instr_new( OP_ADD, dest, dest, Addr_litNum( iv.constant ) ) );
+   return code;
+}
+
+
+
+static int Induction_replaceTest( Context* ctx, int basis, Instr** preheader )
+{
+   Cfg* cfg = ctx->cfg;
+   Loop* loop = ctx->info->loop;
+   Instr* test = NULL;
+   int uses[3];
+
+   // O contador deve estar morto na saida e ser usado apenas pelo teste
+   for ( int e = 0 ; e < ctx->info->nExits ; e++ )
+      if ( Bitset_has( ctx->info->exitTo[e]->liveIn, basis ) )
+         return 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      if ( !Loop_contains( loop, block ) ) continue;
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+      {
+         if ( instr == ctx->basicDef[ basis ] ) continue;
+         int nUses = Cfg_getUses( cfg, instr, uses );
+         for ( int u = 0 ; u < nUses ; u++ )
+         {
+            if ( uses[u] != basis ) continue;
+            if ( test != NULL && test != instr ) return 0;
+            test = instr;
+         }
+      }
+   }
+   if ( test == NULL ) return 0;
+
+   int isRelational = 0;
+   switch ( test->op )
+   {
+      case OP_LT: case OP_GT: case OP_LE: case OP_GE: isRelational = 1; break;
+      case OP_EQ: case OP_NE: break;
+      default: return 0;
+   }
+   int basisIsY = ( Cfg_varIndex( cfg, test->y ) == basis );
+   Addr* counter = basisIsY ? &(test->y) : &(test->z);
+   Addr* bound = basisIsY ? &(test->z) : &(test->y);
+   if ( Cfg_varIndex( cfg, *bound ) == basis || !Loop_isInvariant( ctx->info, *bound ) ) return 0;
+
+   // Comparacoes sao com sinal: ponteiros so servem para testes de igualdade
+   Reduced* chosen = NULL;
+   for ( int r = 0 ; r < ctx->nReduced ; r++ )
+   {
+      Induction iv = ctx->reduced[r].iv;
+      if ( iv.basis != basis || iv.scale == 0 ) continue;
+      if ( isRelational && ( iv.scale < 0 || iv.offset.type != AD_UNSET ) ) continue;
+      if ( chosen == NULL || iv.offset.type == AD_UNSET ) chosen = &(ctx->reduced[r]);
+   }
+   if ( chosen == NULL ) return 0;
+
+   Induction iv = chosen->iv;
+   if ( bound->type == AD_NUMBER && iv.offset.type == AD_UNSET )
+   {
+      // O novo limite, e o valor da variavel reduzida quando o contador
+      // passa do limite por ate um passo, devem caber em 32 bits
+      long long newBound = (long long) iv.scale * bound->num + iv.constant;
+      long long overshoot = (long long) iv.scale * ( (long long) bound->num + ctx->step[ basis ] ) + iv.constant;
+      if ( isRelational && ( !Induction_fitsInt( newBound ) || !Induction_fitsInt( overshoot ) ) ) return 0;
+      *bound = Addr_litNum( (int) newBound );
+   }
+   else
+   {
+      // Sem limite constante nao ha como provar que scale*limite nao transborda
+      if ( isRelational ) return 0;
+      Addr limit = Function_newTemp( cfg->function );
+      *preheader = Instr_link( *preheader, Induction_linearCode( limit, *bound, iv ) );
+      *bound = limit;
+   }
+   *counter = chosen->var;
+   return 1;
+}
+
+
+
+static int Induction_fitsInt( long long value )
+{
+   return value >= INT_MIN && value <= INT_MAX;
+}
+
+
+
+static void Induction_setCurrent( Context* ctx, int var, Induction iv )
+{
+   if ( !ctx->isTouched[ var ] )
+   {
+      ctx->isTouched[ var ] = 1;
+      ctx->touched[ ctx->nTouched++ ] = var;
+   }
+   ctx->current[ var ] = iv;
+}
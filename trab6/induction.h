@@ -0,0 +1,13 @@
+/**
+ * @file    induction.h
+ * @author  lhpelosi
+ */
+
+#ifndef INDUCTION_H
+#define INDUCTION_H
+
+#include "ir.h"
+
+int Induction_reduce( Function* function );
+
+#endif
@@ -0,0 +1,264 @@
+/**
+ * @file    inline.c
+ * @author  lhpelosi
+ */
+
+#include "inline.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "callgraph.h"
+#include "remark.h"
+
+#define INLINE_HOT_FRACTION 10 // Chamadas quentes executam ao menos 1/10 da mais executada
+
+typedef struct Renaming_ {
+   Function* caller;
+   Function* callee;
+   Addr* locals; // Novos nomes das locais da funcao chamada
+   int nLocals;
+   Addr* temps;
+   int nTemps;
+   Addr* oldLabels;
+   Addr* newLabels;
+   int nLabels;
+   Addr ret; // $ret de quem chama
+} Renaming;
+
+static Instr* Inline_expand( IR* program, Function* caller, Function* callee, Instr** params );
+static Addr Inline_rename( Renaming* renaming, Addr addr );
+static int Inline_sizeLimit( Instr* call, long long maxCount, InlineOptions* options );
+static const char* Inline_refusal( CallNode* node, CallNode* callee, Instr* call, int nParams,
+                                   long long maxCount, int* depth, InlineOptions* options );
+
+
+
+int Inline_functions( IR* program, InlineOptions* options )
+{
+   CallGraph* graph = CallGraph_build( program );
+   int* depth = (int*) calloc( graph->nNodes+1, sizeof(int) );
+   int nInlined = 0;
+   long long maxCount = 0;
+   for ( Function* function = program->functions ; function ; function = function->next )
+      for ( Instr* instr = function->code ; instr ; instr = instr->next )
+         if ( instr->op == OP_CALL && instr->count > maxCount )
+            maxCount = instr->count;
+
+   // As funcoes chamadas sao tratadas antes de quem as chama
+   for ( int n = 0 ; n < graph->nNodes ; n++ )
+   {
+      CallNode* node = graph->nodes[n];
+      Function* caller = node->function;
+      Instr** link = &(caller->code);
+      Instr** paramStart = NULL;
+      int nParams = 0;
+      int index = 0; // Posicao de *link no codigo atual de quem chama
+
+      while ( *link )
+      {
+         Instr* instr = *link;
+         if ( instr->op == OP_PARAM )
+         {
+            if ( nParams == 0 ) paramStart = link;
+            nParams++;
+            link = &(instr->next);
+            index++;
+            continue;
+         }
+
+         CallNode* callee = ( instr->op == OP_CALL ) ? CallGraph_find( graph, instr->x.str ) : NULL;
+         const char* refusal = callee ? Inline_refusal( node, callee, instr, nParams, maxCount, depth, options ) : NULL;
+         if ( callee && refusal == NULL )
+         {
+            Remark_emit( REMARK_PASSED, "inline", caller, index, "%s expandida, %d instrucoes",
+                         callee->function->name, callee->size );
+            // Substitui params e call pelo corpo da funcao chamada
+            Instr** start = ( nParams > 0 ) ? paramStart : link;
+            Instr* params = ( nParams > 0 ) ? *paramStart : NULL;
+            Instr* expanded = Inline_expand( program, caller, callee->function, nParams > 0 ? &params : NULL );
+            Instr* last = expanded;
+            index -= nParams;
+            while ( last->next )
+            {
+               last = last->next;
+               index++;
+            }
+            index++;
+            last->next = instr->next;
+            *start = expanded;
+            link = &(last->next);
+
+            if ( depth[ callee->order ] + 1 > depth[ node->order ] )
+               depth[ node->order ] = depth[ callee->order ] + 1;
+            if ( options->stats )
+               fprintf( options->stats, "Expansao: %s em %s, %d instrucoes\n",
+                                        callee->function->name, caller->name, callee->size );
+            nInlined++;
+         }
+         else
+         {
+            if ( callee )
+               Remark_emit( REMARK_MISSED, "inline", caller, index, "%s nao expandida, %d instrucoes: %s",
+                            callee->function->name, callee->size, refusal );
+            link = &(instr->next);
+            index++;
+         }
+         nParams = 0;
+      }
+
+      node->size = 0;
+      for ( Instr* instr = caller->code ; instr ; instr = instr->next )
+         node->size++;
+   }
+
+   free( depth );
+   CallGraph_delete( graph );
+   return nInlined;
+}
+
+
+
+static Instr* Inline_expand( IR* program, Function* caller, Function* callee, Instr** params )
+{
+   Renaming renaming;
+   Instr* code = NULL;
+   Instr* end = Instr_new( OP_LABEL, Addr_newLabel() );
+
+   renaming.caller = caller;
+   renaming.callee = callee;
+   renaming.nLocals = Function_nLocals( callee );
+   renaming.nTemps = Function_nTemps( callee );
+   renaming.locals = (Addr*) calloc( renaming.nLocals+1, sizeof(Addr) );
+   renaming.temps = (Addr*) calloc( renaming.nTemps+1, sizeof(Addr) );
+   renaming.oldLabels = NULL;
+   renaming.newLabels = NULL;
+   renaming.nLabels = 0;
+   renaming.ret = Addr_resolve( strdup( "$ret" ), program, caller );
+
+   for ( Instr* instr = callee->code ; instr ; instr = instr->next )
+   {
+      if ( instr->op != OP_LABEL ) continue;
+      renaming.oldLabels = (Addr*) realloc( renaming.oldLabels, (renaming.nLabels+1) * sizeof(Addr) );
+      renaming.newLabels = (Addr*) realloc( renaming.newLabels, (renaming.nLabels+1) * sizeof(Addr) );
+      renaming.oldLabels[ renaming.nLabels ] = instr->x;
+      renaming.newLabels[ renaming.nLabels ] = Addr_newLabel();
+      renaming.nLabels++;
+   }
+
+   // Os parametros sao empilhados do ultimo para o primeiro argumento
+   if ( params )
+   {
+      Instr* param = *params;
+      for ( int arg = callee->nArgs-1 ; arg >= 0 ; arg-- )
+      {
+         Addr local;
+         local.type = AD_LOCAL;
+         local.num = arg;
+         code = Instr_link( code, Instr_new( OP_SET, Inline_rename( &renaming, local ), param->x ) );
+         param = param->next;
+      }
+   }
+
+   // Copia do corpo, com ret trocado por atribuicao a $ret e desvio para o fim
+   for ( Instr* instr = callee->code ; instr ; instr = instr->next )
+   {
+      if ( instr->op == OP_RET_VAL )
+      {
+         code = Instr_link( code, Instr_new( OP_SET, renaming.ret, Inline_rename( &renaming, instr->x ) ) );
+         code = Instr_link( code, Instr_new( OP_GOTO, end->x ) );
+         continue;
+      }
+      if ( instr->op == OP_RET )
+      {
+         code = Instr_link( code, Instr_new( OP_GOTO, end->x ) );
+         continue;
+      }
+      Instr* clone = Instr_clone( instr );
+      clone->x = Inline_rename( &renaming, clone->x );
+      clone->y = Inline_rename( &renaming, clone->y );
+      clone->z = Inline_rename( &renaming, clone->z );
+      code = Instr_link( code, clone );
+   }
+   code = Instr_link( code, end );
+
+   free( renaming.locals );
+   free( renaming.temps );
+   free( renaming.oldLabels );
+   free( renaming.newLabels );
+   return code;
+}
+
+
+
+static int Inline_sizeLimit( Instr* call, long long maxCount, InlineOptions* options )
+{
+   // Com perfil, chamadas que nunca executaram nao sao expandidas
+   // e as mais executadas aceitam funcoes maiores
+   if ( call->count == 0 ) return -1;
+   if ( call->count > 0 && call->count * INLINE_HOT_FRACTION >= maxCount ) return options->hotSize;
+   return options->maxSize;
+}
+
+
+
+static const char* Inline_refusal( CallNode* node, CallNode* callee, Instr* call, int nParams,
+                                   long long maxCount, int* depth, InlineOptions* options )
+{
+   // Motivo para nao expandir a chamada, NULL se puder
+   if ( nParams != call->y.num || callee->function->nArgs != call->y.num )
+      return "params diferentes dos argumentos";
+   if ( callee->isRecursive || callee == node )
+      return "funcao recursiva";
+   int limit = Inline_sizeLimit( call, maxCount, options );
+   if ( limit < 0 )
+      return "chamada nunca executada segundo o perfil";
+   if ( callee->size > limit )
+      return "maior que o limite de tamanho";
+   if ( depth[ callee->order ] >= options->maxDepth )
+      return "limite de profundidade de expansao";
+   return NULL;
+}
+
+
+
+static Addr Inline_rename( Renaming* renaming, Addr addr )
+{
+   switch ( addr.type )
+   {
+      case AD_LOCAL :
+      {
+         Addr* local = &(renaming->locals[ addr.num ]);
+         if ( local->type == AD_UNSET )
+         {
+            Variable* v = renaming->callee->locals;
+            for ( int i = 0 ; i < addr.num ; i++ ) v = v->next;
+            *local = Function_newLocal( renaming->caller, v->name );
+         }
+         return *local;
+      }
+
+      case AD_TEMP :
+      {
+         Addr* temp = &(renaming->temps[ addr.num ]);
+         if ( temp->type == AD_UNSET )
+         {
+            // Chamadas feitas pelo corpo expandido escrevem no $ret de quem chama
+            if ( strcmp( addr.str, "$ret" ) == 0 )
+               *temp = renaming->ret;
+            else
+               *temp = Function_newTemp( renaming->caller );
+         }
+         return *temp;
+      }
+
+      case AD_LABEL :
+         for ( int l = 0 ; l < renaming->nLabels ; l++ )
+            if ( strcmp( addr.str, renaming->oldLabels[l].str ) == 0 )
+               return renaming->newLabels[l];
+         return addr;
+
+      default:
+         return addr;
+   }
+}
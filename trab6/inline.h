@@ -0,0 +1,21 @@
+/**
+ * @file    inline.h
+ * @author  lhpelosi
+ */
+
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdio.h>
+#include "ir.h"
+
+typedef struct InlineOptions_ {
+   int maxSize; // Tamanho maximo da funcao expandida, em instrucoes
+   int maxDepth; // Niveis de expansao de chamadas umas dentro das outras
+   int hotSize; // Tamanho maximo nas chamadas mais executadas segundo o perfil
+   FILE* stats; // Relatorio das chamadas expandidas, NULL para nenhum
+} InlineOptions;
+
+int Inline_functions( IR* program, InlineOptions* options );
+
+#endif
@@ -172,7 +172,18 @@ Use this function to compare two Addrs.
 This way no string comparison is necessary.
 */
 bool Addr_eq(Addr a1, Addr a2) {
-	return (a1.type == a1.type && a1.num == a1.num);
+	return (a1.type == a2.type && a1.num == a2.num);
+}
+
+/*
+Create an Addr entry for a fresh label, not used anywhere else in the program.
+Labels are global to the output file, so a single counter is used.
+*/
+Addr Addr_newLabel() {
+	static int nLabels = 0;
+	char* str = malloc(24);
+	snprintf(str, 24, ".LOpt_%d", ++nLabels);
+	return Addr_label(str);
 }
 
 // -------------------- Instr --------------------
@@ -188,12 +199,14 @@ Instr* Instr_new(Opcode op, ...) {
 	Instr* ins = calloc(1, sizeof(Instr));
 	ins->op = op;
    ins->usageInfo = NULL;
+   ins->count = -1;
 	switch (op) {
 		// instructions with x only
 		case OP_LABEL:
 		case OP_GOTO:
 		case OP_PARAM:
 		case OP_RET_VAL:
+		case OP_COUNT:
 		{
 			ins->x = va_arg(ap, Addr);
 			break;
@@ -206,6 +219,7 @@ Instr* Instr_new(Opcode op, ...) {
 		case OP_NEG:
 		case OP_NEW:
 		case OP_NEW_BYTE:
+		case OP_NEW_FRAME:
 		case OP_CALL:
 		{
 			ins->x = va_arg(ap, Addr);
@@ -243,6 +257,18 @@ Instr* Instr_new(Opcode op, ...) {
 	return ins;
 }
 
+/*
+Allocate a copy of an Instr. The copy is not linked to any list
+and carries no next-use information.
+*/
+Instr* Instr_clone(Instr* ins) {
+	Instr* copy = calloc(1, sizeof(Instr));
+	*copy = *ins;
+	copy->next = NULL;
+	copy->usageInfo = NULL;
+	return copy;
+}
+
 /*
 Output an instruction to the given file descriptor.
 */
@@ -279,6 +305,8 @@ static void Instr_dump(Instr* ins, FILE* fd) {
 		case OP_NEG:		fmt = "\t%s = - %s\n";		break;
 		case OP_NEW:		fmt = "\t%s = new %s\n";	break;
 		case OP_NEW_BYTE:	fmt = "\t%s = new byte %s\n";	break;
+		case OP_NEW_FRAME:	fmt = "\t%s = new frame %s\n";	break;
+		case OP_COUNT:		fmt = "\tcount %s\n";		break;
 	}
 	fprintf(fd, fmt, x, y, z);
 }
@@ -333,6 +361,59 @@ int Function_nTemps( Function* function )
    return n;
 }
 
+/*
+Create a new temp in the function, with a name that cannot clash
+with the temps generated by the frontend, and return an Addr for it.
+*/
+Addr Function_newTemp(Function* fun) {
+	static int nTemps = 0;
+	char* name = malloc(24);
+	snprintf(name, 24, "$_%d", ++nTemps);
+	Variable* v = Variable_new(name);
+	int i = 0;
+	if (!fun->temps) {
+		fun->temps = v;
+	} else {
+		Variable* last = fun->temps;
+		for (i = 1; last->next; i++) {
+			last = last->next;
+		}
+		last->next = v;
+	}
+	Addr addr;
+	addr.type = AD_TEMP;
+	addr.str = name;
+	addr.num = i;
+	return addr;
+}
+
+/*
+Create a new local in the function, named after the given name but
+with a prefix that cannot clash with the locals of the input program.
+*/
+Addr Function_newLocal(Function* fun, const char* name) {
+	static int nLocals = 0;
+	int len = strlen(name) + 24;
+	char* str = malloc(len);
+	snprintf(str, len, "_%d_%s", ++nLocals, name);
+	Variable* v = Variable_new(str);
+	int i = 0;
+	if (!fun->locals) {
+		fun->locals = v;
+	} else {
+		Variable* last = fun->locals;
+		for (i = 1; last->next; i++) {
+			last = last->next;
+		}
+		last->next = v;
+	}
+	Addr addr;
+	addr.type = AD_LOCAL;
+	addr.str = str;
+	addr.num = i;
+	return addr;
+}
+
 // -------------------- IR --------------------
 
 /*
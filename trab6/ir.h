@@ -2,6 +2,7 @@
 #ifndef IR_H
 #define IR_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 /*
@@ -35,6 +36,16 @@ typedef enum Opcode_ {
 	OP_NEG,
 	OP_NEW,
 	OP_NEW_BYTE,
+	/*
+	Not produced by the parser: an array of y bytes that lives
+	in the activation record, created by the escape analysis.
+	*/
+	OP_NEW_FRAME,
+	/*
+	Not produced by the parser: increments the profile counter
+	x, inserted by -fprofile-generate.
+	*/
+	OP_COUNT,
 } Opcode;
 
 /*
@@ -99,6 +110,19 @@ struct Instr_ {
    Eh possivel que o valor positivo ultrapasse o bloco, indicando seu uso fora dele.
    */
    int* usageInfo;
+
+   /*
+   Numero de execucoes do bloco desta instrucao segundo o perfil
+   lido com -fprofile-use, ou -1 se desconhecido.
+   */
+   long long count;
+
+   /*
+   Linha do arquivo .m0.ir de onde veio a instrucao, ou 0 se ela
+   foi criada por uma otimizacao. Copias feitas por Instr_clone
+   mantem a linha do original.
+   */
+   int line;
 };
 
 /*
@@ -187,15 +211,20 @@ Variable* Variable_new(char* name);
 #define Variable_link(_l1, _l2) ((Variable*)List_link((List*)(_l1), (List*)(_l2)))
 
 Instr* Instr_new(Opcode op, ...);
+Instr* Instr_clone(Instr* ins);
 #define Instr_link(_l1, _l2) ((Instr*)List_link((List*)(_l1), (List*)(_l2)))
 
 Addr Addr_litNum(int num);
 Addr Addr_label(char* label);
 Addr Addr_function(char* name);
 Addr Addr_resolve(char* name, IR* ir, Function* fun);
+Addr Addr_newLabel();
+bool Addr_eq(Addr a1, Addr a2);
 
 Function* Function_new(char* name, Variable* args);
 int Function_nLocals( Function* function );
 int Function_nTemps( Function* function );
+Addr Function_newTemp(Function* fun);
+Addr Function_newLocal(Function* fun, const char* name);
 
 #endif
@@ -0,0 +1,313 @@
+/**
+ * @file    layout.c
+ * @author  lhpelosi
+ */
+
+#include "layout.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "loop.h"
+
+#define LAYOUT_MAX_TEST 6 // Instrucoes do teste do laco que podem ser duplicadas
+
+static int Layout_rotateLoops( Function* function );
+static int Layout_rotateLoop( Cfg* cfg, Loop* loop, Instr** previous );
+static int Layout_chainBlocks( Function* function );
+static int Layout_simplifyJumps( Function* function );
+static CfgBlock* Layout_nextInChain( Cfg* cfg, CfgBlock* block, char* isPlaced );
+static int Layout_fallsThrough( Instr* instr );
+static long long Layout_weight( CfgBlock* block );
+static int Layout_isCold( CfgBlock* block );
+static int Layout_isSplit( Instr* instr, Instr* next );
+static int Layout_isBefore( Instr* instr, const char* label );
+
+
+
+int Layout_blocks( Function* function )
+{
+   int nChanges = Layout_rotateLoops( function );
+   nChanges += Layout_chainBlocks( function );
+   nChanges += Layout_simplifyJumps( function );
+   return nChanges;
+}
+
+
+
+static int Layout_rotateLoops( Function* function )
+{
+   // Todas as rotacoes sobre o mesmo grafo, dos lacos internos para os
+   // externos. previous[i] e a instrucao que precede o bloco i no codigo,
+   // atualizada a cada rotacao
+   Cfg* cfg = Cfg_build( function );
+   Loop* loops = Loop_find( cfg );
+   Instr** previous = (Instr**) malloc( (cfg->nBlocks+1) * sizeof(Instr*) );
+   int nChanges = 0;
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      previous[i] = ( i > 0 ) ? cfg->blocks[i-1]->last : NULL;
+
+   for ( Loop* loop = loops ; loop ; loop = loop->next )
+      if ( loop->header->first->op == OP_LABEL )
+         nChanges += Layout_rotateLoop( cfg, loop, previous );
+
+   free( previous );
+   Loop_delete( loops );
+   Cfg_delete( cfg );
+   return nChanges;
+}
+
+
+
+static int Layout_rotateLoop( Cfg* cfg, Loop* loop, Instr** previous )
+{
+   Function* function = cfg->function;
+   CfgBlock* header = loop->header;
+   if ( header->index + loop->nBlocks > cfg->nBlocks || loop->nBlocks < 2 ) return 0;
+   for ( int i = header->index ; i < header->index + loop->nBlocks ; i++ )
+      if ( !Loop_contains( loop, cfg->blocks[i] ) ) return 0;
+   CfgBlock* latch = cfg->blocks[ header->index + loop->nBlocks - 1 ];
+
+   // Cabecalho: rotulo, teste curto e desvio para fora do laco
+   Instr* branch = header->last;
+   if ( branch->op != OP_IF && branch->op != OP_IF_FALSE ) return 0;
+   if ( header->nInstr - 1 > LAYOUT_MAX_TEST ) return 0;
+   CfgBlock* exit = Cfg_findLabel( cfg, branch->y.str );
+   if ( exit == NULL || Loop_contains( loop, exit ) ) return 0;
+   for ( Instr* instr = header->first->next ; instr != branch ; instr = instr->next )
+      if ( instr->op == OP_CALL || instr->op == OP_PARAM ||
+           instr->op == OP_NEW || instr->op == OP_NEW_BYTE || instr->op == OP_NEW_FRAME )
+         return 0;
+   // Ultimo bloco volta ao cabecalho com um goto
+   Instr* back = latch->last;
+   if ( back->op != OP_GOTO || strcmp( back->x.str, header->first->x.str ) != 0 ) return 0;
+
+   // Na entrada fica uma copia do teste; o original passa para o fim do
+   // corpo, com o desvio invertido voltando para o inicio do corpo
+   Instr* entryTest = NULL;
+   for ( Instr* instr = header->first->next ; instr != branch->next ; instr = instr->next )
+      entryTest = Instr_link( entryTest, Instr_clone( instr ) );
+   Instr* bodyLabel = Instr_new( OP_LABEL, Addr_newLabel() );
+   Instr* beforeHeader = previous[ header->index ];
+   Instr* beforeBack = previous[ latch->index ];
+   for ( Instr* instr = latch->first ; instr != back ; instr = instr->next )
+      beforeBack = instr;
+   Instr* afterBack = back->next;
+
+   // Lacos internos ja girados deixam o seu teste de entrada logo apos o
+   // desvio, no lugar do primeiro bloco do corpo
+   entryTest = Instr_link( entryTest, bodyLabel );
+   bodyLabel->next = branch->next;
+   if ( beforeHeader )
+      beforeHeader->next = entryTest;
+   else
+      function->code = entryTest;
+
+   Addr exitLabel = branch->y;
+   branch->op = ( branch->op == OP_IF ) ? OP_IF_FALSE : OP_IF;
+   branch->y = bodyLabel->x;
+   beforeBack->next = header->first;
+   branch->next = afterBack;
+   if ( !Layout_isBefore( afterBack, exitLabel.str ) )
+      branch->next = Instr_link( Instr_new( OP_GOTO, exitLabel ), afterBack );
+
+   previous[ header->index ] = beforeBack;
+   previous[ header->index+1 ] = bodyLabel;
+   if ( latch->index+1 < cfg->nBlocks )
+      previous[ latch->index+1 ] = ( branch->next != afterBack ) ? branch->next : branch;
+   return 1;
+}
+
+
+
+static int Layout_chainBlocks( Function* function )
+{
+   Cfg* cfg = Cfg_build( function );
+   if ( cfg->nBlocks < 2 )
+   {
+      Cfg_delete( cfg );
+      return 0;
+   }
+   char* isPlaced = (char*) calloc( cfg->nBlocks, sizeof(char) );
+   CfgBlock** order = (CfgBlock**) malloc( cfg->nBlocks * sizeof(CfgBlock*) );
+   int nPlaced = 0;
+   int nMoved = 0;
+
+   // Cadeias de blocos: cada bloco e seguido pelo destino do seu desvio
+   // quando este so e alcancado por desvios, senao pelo proximo na ordem.
+   // Os blocos que o perfil diz nunca executar ficam todos no fim
+   CfgBlock* block = cfg->blocks[0];
+   while ( nPlaced < cfg->nBlocks )
+   {
+      isPlaced[ block->index ] = 1;
+      order[ nPlaced++ ] = block;
+      CfgBlock* next = Layout_nextInChain( cfg, block, isPlaced );
+      if ( next == NULL )
+      {
+         int i = 0;
+         while ( i < cfg->nBlocks && ( isPlaced[i] || Layout_isCold( cfg->blocks[i] ) ) ) i++;
+         if ( i == cfg->nBlocks )
+            for ( i = 0 ; i < cfg->nBlocks && isPlaced[i] ; i++ );
+         if ( i == cfg->nBlocks ) break;
+         next = cfg->blocks[i];
+      }
+      block = next;
+   }
+
+   // Blocos que caiam no seguinte e foram separados dele ganham um goto,
+   // assim como os que cairiam de um bloco quente em um frio
+   for ( int k = 0 ; k < nPlaced ; k++ )
+   {
+      block = order[k];
+      if ( block != cfg->blocks[k] ) nMoved++;
+      if ( !Layout_fallsThrough( block->last ) ) continue;
+      CfgBlock* follow = ( block->index+1 < cfg->nBlocks ) ? cfg->blocks[ block->index+1 ] : NULL;
+      CfgBlock* placedAfter = ( k+1 < nPlaced ) ? order[k+1] : NULL;
+      int isSplit = placedAfter && Layout_isCold( placedAfter ) != Layout_isCold( block );
+      if ( follow == placedAfter && !isSplit ) continue;
+      Instr* jump = Instr_new( OP_RET );
+      if ( follow )
+      {
+         if ( follow->first->op != OP_LABEL )
+         {
+            Instr* label = Instr_new( OP_LABEL, Addr_newLabel() );
+            label->next = follow->first;
+            follow->first = label;
+         }
+         jump = Instr_new( OP_GOTO, follow->first->x );
+      }
+      block->last->next = jump;
+      block->last = jump;
+   }
+   for ( int k = 0 ; k < nPlaced ; k++ )
+   {
+      // Instrucoes novas herdam a contagem do seu bloco
+      long long weight = Layout_weight( order[k] );
+      if ( weight >= 0 )
+         for ( Instr* instr = order[k]->first ; instr != order[k]->last->next ; instr = instr->next )
+            instr->count = weight;
+   }
+   for ( int k = 0 ; k < nPlaced ; k++ )
+      order[k]->last->next = ( k+1 < nPlaced ) ? order[k+1]->first : NULL;
+   function->code = order[0]->first;
+
+   free( order );
+   free( isPlaced );
+   Cfg_delete( cfg );
+   return nMoved;
+}
+
+
+
+static int Layout_simplifyJumps( Function* function )
+{
+   int nChanges = 0;
+   Instr** link = &(function->code);
+   while ( *link )
+   {
+      Instr* instr = *link;
+      Instr* next = instr->next;
+
+      // Codigo depois de goto ou ret, ate o proximo rotulo, nunca executa
+      if ( ( instr->op == OP_GOTO || instr->op == OP_RET || instr->op == OP_RET_VAL ) &&
+           next && next->op != OP_LABEL )
+      {
+         instr->next = next->next;
+         nChanges++;
+         continue;
+      }
+      // Desvio para o proprio ponto seguinte, se nao passa de bloco quente para frio
+      if ( ( ( instr->op == OP_GOTO && Layout_isBefore( next, instr->x.str ) ) ||
+             ( ( instr->op == OP_IF || instr->op == OP_IF_FALSE ) && Layout_isBefore( next, instr->y.str ) ) ) &&
+           !Layout_isSplit( instr, next ) )
+      {
+         *link = next;
+         nChanges++;
+         continue;
+      }
+      // if t goto A; goto B; A:  vira  ifFalse t goto B; A:
+      if ( ( instr->op == OP_IF || instr->op == OP_IF_FALSE ) && next && next->op == OP_GOTO &&
+           Layout_isBefore( next->next, instr->y.str ) && !Layout_isSplit( instr, next->next ) )
+      {
+         instr->op = ( instr->op == OP_IF ) ? OP_IF_FALSE : OP_IF;
+         instr->y = next->x;
+         instr->next = next->next;
+         nChanges++;
+         continue;
+      }
+      link = &(instr->next);
+   }
+   return nChanges;
+}
+
+
+
+static CfgBlock* Layout_nextInChain( Cfg* cfg, CfgBlock* block, char* isPlaced )
+{
+   CfgBlock* follow = ( block->index+1 < cfg->nBlocks ) ? cfg->blocks[ block->index+1 ] : NULL;
+   Addr* target = Instr_jumpTarget( block->last );
+   CfgBlock* targetBlock = target ? Cfg_findLabel( cfg, target->str ) : NULL;
+   // Blocos quentes e frios ficam em cadeias separadas
+   if ( follow && ( isPlaced[ follow->index ] || Layout_isCold( follow ) != Layout_isCold( block ) ) )
+      follow = NULL;
+   if ( targetBlock && ( isPlaced[ targetBlock->index ] || Layout_isCold( targetBlock ) != Layout_isCold( block ) ) )
+      targetBlock = NULL;
+
+   // Com perfil, o if continua pelo lado mais executado
+   if ( targetBlock && Layout_weight( targetBlock ) >= 0 &&
+        ( block->last->op == OP_IF || block->last->op == OP_IF_FALSE ) &&
+        ( follow == NULL || Layout_weight( targetBlock ) > Layout_weight( follow ) ) )
+      return targetBlock;
+   // Quem cai no bloco seguinte continua nele
+   if ( Layout_fallsThrough( block->last ) && follow ) return follow;
+   // Destino alcancado so por desvios pode vir logo depois, sem custo
+   // na sua posicao original
+   if ( targetBlock && targetBlock->index > 0 &&
+        !Layout_fallsThrough( cfg->blocks[ targetBlock->index-1 ]->last ) )
+      return targetBlock;
+   return NULL;
+}
+
+
+
+static int Layout_fallsThrough( Instr* instr )
+{
+   return instr->op != OP_GOTO && instr->op != OP_RET && instr->op != OP_RET_VAL;
+}
+
+
+
+static long long Layout_weight( CfgBlock* block )
+{
+   // Contagem do perfil, -1 se o bloco so tem instrucoes novas
+   for ( Instr* instr = block->first ; instr != block->last->next ; instr = instr->next )
+      if ( instr->count >= 0 )
+         return instr->count;
+   return -1;
+}
+
+
+
+static int Layout_isCold( CfgBlock* block )
+{
+   return Layout_weight( block ) == 0;
+}
+
+
+
+static int Layout_isSplit( Instr* instr, Instr* next )
+{
+   return next && ( instr->count == 0 ) != ( next->count == 0 );
+}
+
+
+
+static int Layout_isBefore( Instr* instr, const char* label )
+{
+   // Se o rotulo esta entre os rotulos que comecam em instr
+   for ( ; instr && instr->op == OP_LABEL ; instr = instr->next )
+      if ( strcmp( instr->x.str, label ) == 0 )
+         return 1;
+   return 0;
+}
+
@@ -0,0 +1,13 @@
+/**
+ * @file    layout.h
+ * @author  lhpelosi
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "ir.h"
+
+int Layout_blocks( Function* function );
+
+#endif
@@ -0,0 +1,524 @@
+/**
+ * @file    loop.c
+ * @author  lhpelosi
+ */
+
+#include "loop.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct HoistedAddr_ {
+   Addr base;
+   Addr index;
+   int isByte;
+   Addr pointer;
+} HoistedAddr;
+
+
+static Loop* Loop_new( Cfg* cfg, CfgBlock* header );
+static void Loop_addBody( Cfg* cfg, Loop* loop, CfgBlock* tail );
+static Loop* Loop_sort( Loop* loops );
+static int Loop_canHoist( LoopInfo* info, CfgBlock* block, Instr* instr );
+static int Loop_hoistLoop( Cfg* cfg, Loop* loop, void* data );
+static Addr Loop_hoistAddr( Function* function, Addr base, Addr index, int isByte,
+                            HoistedAddr** addrs, int* nAddrs, Instr** hoisted );
+static int Loop_comparePointers( const void* a, const void* b );
+
+
+
+Loop* Loop_find( Cfg* cfg )
+{
+   Loop* loops = NULL;
+
+   // Arestas de retorno: o destino domina a origem
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* tail = cfg->blocks[i];
+      if ( tail->rpo < 0 ) continue;
+      for ( int s = 0 ; s < tail->nSucc ; s++ )
+      {
+         CfgBlock* header = tail->succ[s];
+         if ( !Cfg_dominates( header, tail ) ) continue;
+
+         // Lacos com o mesmo cabecalho sao unidos
+         Loop* loop = loops;
+         while ( loop && loop->header != header ) loop = loop->next;
+         if ( loop == NULL )
+         {
+            loop = Loop_new( cfg, header );
+            loop->next = loops;
+            loops = loop;
+         }
+         Loop_addBody( cfg, loop, tail );
+      }
+   }
+
+   // Do mais interno para o mais externo
+   loops = Loop_sort( loops );
+   for ( Loop* loop = loops ; loop ; loop = loop->next )
+   {
+      for ( Loop* outer = loop->next ; outer ; outer = outer->next )
+         if ( outer != loop && Loop_contains( outer, loop->header ) )
+         {
+            loop->parent = outer;
+            break;
+         }
+   }
+   for ( Loop* loop = loops ; loop ; loop = loop->next )
+      for ( Loop* outer = loop->parent ; outer ; outer = outer->parent )
+         loop->depth++;
+
+   return loops;
+}
+
+
+
+void Loop_delete( Loop* loops )
+{
+   while ( loops )
+   {
+      Loop* next = loops->next;
+      free( loops->body );
+      free( loops );
+      loops = next;
+   }
+}
+
+
+
+int Loop_contains( Loop* loop, CfgBlock* block )
+{
+   return loop->body[ block->index ];
+}
+
+
+
+void Loop_insertPreheader( Cfg* cfg, Loop* loop, Instr* code )
+{
+   Function* function = cfg->function;
+   CfgBlock* header = loop->header;
+   Instr* headerLabel = header->first;
+   Instr* preheader = Instr_new( OP_LABEL, Addr_newLabel() );
+   Instr* prev = NULL;
+
+   // Desvios de fora do laco passam a ir para o pre-cabecalho
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      if ( Loop_contains( loop, cfg->blocks[i] ) ) continue;
+      Addr* target = Instr_jumpTarget( cfg->blocks[i]->last );
+      if ( target && strcmp( target->str, headerLabel->x.str ) == 0 )
+         *target = preheader->x;
+   }
+
+   for ( Instr* instr = function->code ; instr != headerLabel ; instr = instr->next )
+      prev = instr;
+
+   // Se o laco cai no cabecalho pelo bloco anterior, ele deve pular o pre-cabecalho
+   if ( prev && header->index > 0 &&
+        Loop_contains( loop, cfg->blocks[ header->index-1 ] ) &&
+        prev->op != OP_GOTO && prev->op != OP_RET && prev->op != OP_RET_VAL )
+   {
+      preheader = Instr_link( Instr_new( OP_GOTO, headerLabel->x ), preheader );
+   }
+
+   preheader = Instr_link( preheader, Instr_link( code, headerLabel ) );
+   if ( prev )
+      prev->next = preheader;
+   else
+      function->code = preheader;
+}
+
+
+
+int Loop_forEach( Function* function, int (*transform)( Cfg* cfg, Loop* loop, void* data ), void* data, int liveness )
+{
+   int nChanges = 0;
+   int nDone = 0;
+   Instr** done = NULL; // Rotulos dos cabecalhos ja tratados
+   int nDeferred = 1;
+
+   // Cada laco eh tratado uma vez, do mais interno para o mais externo, todos
+   // sobre o mesmo grafo. Uma transformacao so muda o proprio laco e o codigo
+   // logo antes dele, que pertence aos lacos externos; esses ficam para a
+   // rodada seguinte, com o grafo refeito. Ha no maximo uma rodada por nivel
+   // de aninhamento. Para os lacos disjuntos a vivacidade antiga continua
+   // valida ou tem variaveis vivas a mais, o que so impede transformacoes
+   while ( nDeferred > 0 )
+   {
+      Cfg* cfg = Cfg_build( function );
+      Loop* loops = Loop_find( cfg );
+      if ( liveness ) Cfg_computeLiveness( cfg );
+      char* stale = (char*) calloc( cfg->nBlocks, sizeof(char) ); // Cabecalhos de lacos desatualizados
+      nDeferred = 0;
+
+      // Os lacos do grafo novo herdam as marcas pelos rotulos dos cabecalhos
+      if ( nDone > 0 )
+      {
+         qsort( done, nDone, sizeof(Instr*), Loop_comparePointers );
+         for ( Loop* loop = loops ; loop ; loop = loop->next )
+            loop->done = ( bsearch( &(loop->header->first), done, nDone, sizeof(Instr*), Loop_comparePointers ) != NULL );
+      }
+
+      for ( Loop* loop = loops ; loop ; loop = loop->next )
+      {
+         if ( loop->done || loop->header->first->op != OP_LABEL ) continue;
+         if ( stale[ loop->header->index ] )
+         {
+            nDeferred++;
+            continue;
+         }
+         loop->done = 1;
+         done = (Instr**) realloc( done, (nDone+1) * sizeof(Instr*) );
+         done[ nDone++ ] = loop->header->first;
+
+         int changes = transform( cfg, loop, data );
+         if ( changes == 0 ) continue;
+         nChanges += changes;
+         for ( Loop* outer = loop->parent ; outer ; outer = outer->parent )
+            stale[ outer->header->index ] = 1;
+      }
+
+      free( stale );
+      Loop_delete( loops );
+      Cfg_delete( cfg );
+   }
+
+   free( done );
+   return nChanges;
+}
+
+
+
+int Loop_hoistInvariants( Function* function )
+{
+   return Loop_forEach( function, Loop_hoistLoop, NULL, 1 );
+}
+
+
+
+static Loop* Loop_new( Cfg* cfg, CfgBlock* header )
+{
+   Loop* loop = (Loop*) calloc( 1, sizeof(Loop) );
+   loop->header = header;
+   loop->body = (char*) calloc( cfg->nBlocks, sizeof(char) );
+   loop->body[ header->index ] = 1;
+   loop->nBlocks = 1;
+   return loop;
+}
+
+
+
+static void Loop_addBody( Cfg* cfg, Loop* loop, CfgBlock* tail )
+{
+   // Sobe pelos predecessores a partir da origem da aresta de retorno
+   CfgBlock** stack = (CfgBlock**) malloc( cfg->nBlocks * sizeof(CfgBlock*) );
+   int top = 0;
+   if ( !loop->body[ tail->index ] )
+   {
+      loop->body[ tail->index ] = 1;
+      loop->nBlocks++;
+      stack[ top++ ] = tail;
+   }
+   while ( top > 0 )
+   {
+      CfgBlock* block = stack[ --top ];
+      for ( int p = 0 ; p < block->nPred ; p++ )
+      {
+         CfgBlock* pred = block->pred[p];
+         if ( pred->rpo < 0 || loop->body[ pred->index ] ) continue;
+         loop->body[ pred->index ] = 1;
+         loop->nBlocks++;
+         stack[ top++ ] = pred;
+      }
+   }
+   free( stack );
+}
+
+
+
+static Loop* Loop_sort( Loop* loops )
+{
+   // Insercao ordenada pelo numero de blocos
+   Loop* sorted = NULL;
+   while ( loops )
+   {
+      Loop* loop = loops;
+      loops = loops->next;
+      Loop** pos = &sorted;
+      while ( *pos && (*pos)->nBlocks <= loop->nBlocks ) pos = &((*pos)->next);
+      loop->next = *pos;
+      *pos = loop;
+   }
+   return sorted;
+}
+
+
+
+LoopInfo* Loop_analyze( Cfg* cfg, Loop* loop )
+{
+   LoopInfo* info = (LoopInfo*) calloc( 1, sizeof(LoopInfo) );
+   info->cfg = cfg;
+   info->loop = loop;
+   info->defCount = (int*) calloc( cfg->nVars+1, sizeof(int) );
+   info->exitFrom = (CfgBlock**) malloc( 2 * cfg->nBlocks * sizeof(CfgBlock*) );
+   info->exitTo = (CfgBlock**) malloc( 2 * cfg->nBlocks * sizeof(CfgBlock*) );
+
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      if ( !Loop_contains( loop, block ) ) continue;
+
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+      {
+         int def = Cfg_getDef( cfg, instr );
+         if ( def >= 0 ) info->defCount[ def ]++;
+         if ( instr->op == OP_CALL || ( Instr_hasDef( instr ) && instr->x.type == AD_GLOBAL ) )
+            info->globalsChange = 1;
+      }
+
+      for ( int s = 0 ; s < block->nSucc ; s++ )
+         if ( !Loop_contains( loop, block->succ[s] ) )
+         {
+            info->exitFrom[ info->nExits ] = block;
+            info->exitTo[ info->nExits ] = block->succ[s];
+            info->nExits++;
+         }
+   }
+   return info;
+}
+
+
+
+void Loop_deleteInfo( LoopInfo* info )
+{
+   free( info->defCount );
+   free( info->exitFrom );
+   free( info->exitTo );
+   free( info );
+}
+
+
+
+int Loop_isInvariant( LoopInfo* info, Addr addr )
+{
+   switch ( addr.type )
+   {
+      case AD_NUMBER:
+      case AD_STRING:
+         return 1;
+
+      case AD_GLOBAL:
+         return !info->globalsChange;
+
+      case AD_LOCAL:
+      case AD_TEMP:
+      {
+         int var = Cfg_varIndex( info->cfg, addr );
+         // Temporarias criadas apos a construcao do grafo so existem no pre-cabecalho
+         return var >= info->cfg->nVars || info->defCount[ var ] == 0;
+      }
+
+      default:
+         return 0;
+   }
+}
+
+
+
+static int Loop_canHoist( LoopInfo* info, CfgBlock* block, Instr* instr )
+{
+   switch ( instr->op )
+   {
+      case OP_SET:
+      case OP_SET_BYTE:
+      case OP_NEG:
+         if ( !Loop_isInvariant( info, instr->y ) ) return 0;
+         break;
+
+      case OP_DIV:
+         // Divisoes so sao antecipadas quando nao podem gerar excecao
+         if ( instr->z.type != AD_NUMBER || instr->z.num == 0 || instr->z.num == -1 ) return 0;
+         // Continua como as demais operacoes binarias
+      case OP_NE:
+      case OP_EQ:
+      case OP_LT:
+      case OP_GT:
+      case OP_LE:
+      case OP_GE:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+         if ( !Loop_isInvariant( info, instr->y ) || !Loop_isInvariant( info, instr->z ) ) return 0;
+         break;
+
+      default:
+         return 0;
+   }
+
+   // O destino deve ter uma unica definicao no laco e nenhum uso que a preceda
+   int var = Cfg_varIndex( info->cfg, instr->x );
+   if ( var < 0 || var >= info->cfg->nVars ) return 0;
+   if ( info->defCount[ var ] != 1 ) return 0;
+   if ( Bitset_has( info->loop->header->liveIn, var ) ) return 0;
+
+   // Em cada saida o valor deve estar morto ou a definicao deve ser sempre executada
+   for ( int e = 0 ; e < info->nExits ; e++ )
+      if ( Bitset_has( info->exitTo[e]->liveIn, var ) && !Cfg_dominates( block, info->exitFrom[e] ) )
+         return 0;
+
+   return 1;
+}
+
+
+
+static int Loop_hoistLoop( Cfg* cfg, Loop* loop, void* data )
+{
+   LoopInfo* info = Loop_analyze( cfg, loop );
+   Instr* hoisted = NULL; // Codigo do pre-cabecalho
+   Instr** moved = NULL; // Instrucoes retiradas do laco
+   int nMoved = 0;
+   HoistedAddr* addrs = NULL;
+   int nAddrs = 0;
+   int changed = 1;
+
+   while ( changed )
+   {
+      changed = 0;
+      for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      {
+         CfgBlock* block = cfg->blocks[i];
+         if ( !Loop_contains( loop, block ) ) continue;
+
+         Instr* instr = block->first;
+         for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+         {
+            int isMoved = 0;
+            for ( int m = 0 ; m < nMoved && !isMoved ; m++ )
+               isMoved = ( moved[m] == instr );
+            if ( isMoved ) continue;
+
+            if ( Loop_canHoist( info, block, instr ) )
+            {
+               moved = (Instr**) realloc( moved, (nMoved+1) * sizeof(Instr*) );
+               moved[ nMoved++ ] = instr;
+               info->defCount[ Cfg_varIndex( cfg, instr->x ) ]--;
+               changed = 1;
+               continue;
+            }
+
+            // Calculo de endereco com base e indice invariantes
+            int isByte = ( instr->op == OP_SET_IDX_BYTE || instr->op == OP_IDX_SET_BYTE );
+            if ( instr->op == OP_SET_IDX || instr->op == OP_SET_IDX_BYTE )
+            {
+               if ( instr->z.type != AD_NUMBER &&
+                    Loop_isInvariant( info, instr->y ) && Loop_isInvariant( info, instr->z ) )
+               {
+                  instr->y = Loop_hoistAddr( cfg->function, instr->y, instr->z, isByte,
+                                             &addrs, &nAddrs, &hoisted );
+                  instr->z = Addr_litNum( 0 );
+                  changed = 1;
+               }
+            }
+            else if ( instr->op == OP_IDX_SET || instr->op == OP_IDX_SET_BYTE )
+            {
+               if ( instr->y.type != AD_NUMBER &&
+                    Loop_isInvariant( info, instr->x ) && Loop_isInvariant( info, instr->y ) )
+               {
+                  instr->x = Loop_hoistAddr( cfg->function, instr->x, instr->y, isByte,
+                                             &addrs, &nAddrs, &hoisted );
+                  instr->y = Addr_litNum( 0 );
+                  changed = 1;
+               }
+            }
+         }
+      }
+
+   }
+
+   if ( nMoved == 0 && nAddrs == 0 )
+   {
+      Loop_deleteInfo( info );
+      return 0;
+   }
+
+   // Retira as instrucoes da lista do laco
+   Instr** sorted = (Instr**) malloc( (nMoved+1) * sizeof(Instr*) );
+   memcpy( sorted, moved, nMoved * sizeof(Instr*) );
+   qsort( sorted, nMoved, sizeof(Instr*), Loop_comparePointers );
+   Instr* prev = NULL;
+   for ( Instr* instr = cfg->function->code ; instr ; )
+   {
+      Instr* next = instr->next;
+      if ( nMoved > 0 && bsearch( &instr, sorted, nMoved, sizeof(Instr*), Loop_comparePointers ) )
+      {
+         if ( prev ) prev->next = next;
+         else cfg->function->code = next;
+      }
+      else
+      {
+         prev = instr;
+      }
+      instr = next;
+   }
+   free( sorted );
+
+   // Monta o pre-cabecalho: instrucoes movidas, depois os enderecos
+   Instr* code = NULL;
+   for ( int m = nMoved-1 ; m >= 0 ; m-- )
+   {
+      moved[m]->next = code;
+      code = moved[m];
+   }
+   code = Instr_link( code, hoisted );
+   Loop_insertPreheader( cfg, loop, code );
+
+   free( moved );
+   free( addrs );
+   Loop_deleteInfo( info );
+   return nMoved + nAddrs;
+}
+
+
+
+static Addr Loop_hoistAddr( Function* function, Addr base, Addr index, int isByte,
+                            HoistedAddr** addrs, int* nAddrs, Instr** hoisted )
+{
+   // Reaproveita o endereco se o mesmo acesso ja foi antecipado
+   for ( int i = 0 ; i < *nAddrs ; i++ )
+   {
+      HoistedAddr* a = &((*addrs)[i]);
+      if ( a->isByte == isByte && Addr_eq( a->base, base ) && Addr_eq( a->index, index ) )
+         return a->pointer;
+   }
+
+   Addr offset = index;
+   Addr pointer = Function_newTemp( function );
+   Instr* code = NULL;
+   if ( !isByte )
+   {
+      offset = Function_newTemp( function );
+      code = Instr_new( OP_MUL, offset, index, Addr_litNum( 4 ) );
+   }
+   code = Instr_link( code, Instr_new( OP_ADD, pointer, base, offset ) );
+
+   *hoisted = Instr_link( *hoisted, code );
+
+   *addrs = (HoistedAddr*) realloc( *addrs, (*nAddrs+1) * sizeof(HoistedAddr) );
+   (*addrs)[ *nAddrs ].base = base;
+   (*addrs)[ *nAddrs ].index = index;
+   (*addrs)[ *nAddrs ].isByte = isByte;
+   (*addrs)[ *nAddrs ].pointer = pointer;
+   (*nAddrs)++;
+   return pointer;
+}
+
+
+
+static int Loop_comparePointers( const void* a, const void* b )
+{
+   const Instr* ia = *(const Instr**) a;
+   const Instr* ib = *(const Instr**) b;
+   return ( ia > ib ) - ( ia < ib );
+}
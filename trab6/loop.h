@@ -0,0 +1,43 @@
+/**
+ * @file    loop.h
+ * @author  lhpelosi
+ */
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "cfg.h"
+
+typedef struct Loop_ Loop;
+struct Loop_ {
+   Loop* next;
+   CfgBlock* header;
+   char* body; // body[i] indica se o bloco de indice i pertence ao laco
+   int nBlocks;
+   Loop* parent; // Laco imediatamente externo
+   int depth;
+   int done; // Ja tratado por Loop_forEach
+};
+
+typedef struct LoopInfo_ LoopInfo;
+struct LoopInfo_ {
+   Cfg* cfg;
+   Loop* loop;
+   int* defCount; // Definicoes de cada variavel dentro do laco
+   int globalsChange; // Se alguma global pode mudar dentro do laco
+   CfgBlock** exitFrom; // Arestas de saida do laco
+   CfgBlock** exitTo;
+   int nExits;
+};
+
+Loop* Loop_find( Cfg* cfg );
+void Loop_delete( Loop* loops );
+int Loop_contains( Loop* loop, CfgBlock* block );
+void Loop_insertPreheader( Cfg* cfg, Loop* loop, Instr* code );
+int Loop_forEach( Function* function, int (*transform)( Cfg* cfg, Loop* loop, void* data ), void* data, int liveness );
+LoopInfo* Loop_analyze( Cfg* cfg, Loop* loop );
+void Loop_deleteInfo( LoopInfo* info );
+int Loop_isInvariant( LoopInfo* info, Addr addr );
+int Loop_hoistInvariants( Function* function );
+
+#endif
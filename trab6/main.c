@@ -5,6 +5,13 @@
 
 #include "ir.h"
 #include "asm.h"
+#include "unroll.h"
+#include "inline.h"
+#include "escape.h"
+#include "pass.h"
+#include "profile.h"
+#include "remark.h"
+#include "timing.h"
 
 extern FILE* yyin;
 extern int yyparse();
@@ -16,27 +23,168 @@ int main(int argc, char** argv) {
 	int err;
 	FILE* outputFile;
 	char outputFileName[256];
+	char* inputFileName = NULL;
+	UnrollOptions unroll = { 4, 64, NULL };
+	InlineOptions inlining = { -1, 2, -1, NULL };
+	EscapeOptions escape = { 1024, NULL };
+	AsmOptions asmOptions = { 0, 0, NULL, 0, 0, 0, 0, NULL, 0, 0, NULL, NULL };
+	PassOptions passes = { PASS_O0, &inlining, &unroll, &escape, &asmOptions, NULL, NULL };
+	int omitFramePointer = -1;
+	int registerArgs = -1;
+	const char* profileGenerate = NULL;
+	const char* profileUse = NULL;
+	int timeReport = -1;
+	int remarks = -1;
+	const char* remarksFilter = NULL;
+	int debugLines = 0;
+	int badOption = 0;
 
-	if (argc < 2) {
-		fprintf(stderr, "Uso: %s arquivo.m0.ir\n", argv[0]);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-g") == 0) {
+			debugLines = 1;
+		} else if (strcmp(argv[i], "-O") == 0 || strcmp(argv[i], "-O2") == 0) {
+			passes.level = PASS_O2;
+		} else if (strcmp(argv[i], "-O0") == 0) {
+			passes.level = PASS_O0;
+		} else if (strcmp(argv[i], "-O1") == 0) {
+			passes.level = PASS_O1;
+		} else if (strcmp(argv[i], "-Os") == 0) {
+			passes.level = PASS_OS;
+		} else if (strncmp(argv[i], "-fenable-pass=", 14) == 0) {
+			Pass_toggle(argv[i] + 14, 1);
+		} else if (strncmp(argv[i], "-fdisable-pass=", 15) == 0) {
+			Pass_toggle(argv[i] + 15, 0);
+		} else if (strcmp(argv[i], "-fpass-stats") == 0) {
+			passes.stats = stderr;
+		} else if (strncmp(argv[i], "-fdump-after=", 13) == 0) {
+			passes.dumpAfter = argv[i] + 13;
+		} else if (strncmp(argv[i], "-funroll=", 9) == 0) {
+			unroll.factor = atoi(argv[i] + 9);
+		} else if (strncmp(argv[i], "-funroll-budget=", 16) == 0) {
+			unroll.budget = atoi(argv[i] + 16);
+		} else if (strcmp(argv[i], "-funroll-stats") == 0) {
+			unroll.stats = stderr;
+		} else if (strcmp(argv[i], "-fomit-frame-pointer") == 0) {
+			omitFramePointer = 2;
+		} else if (strcmp(argv[i], "-fno-omit-frame-pointer") == 0) {
+			omitFramePointer = 0;
+		} else if (strcmp(argv[i], "-fregister-args") == 0) {
+			registerArgs = 1;
+		} else if (strcmp(argv[i], "-fno-register-args") == 0) {
+			registerArgs = 0;
+		} else if (strcmp(argv[i], "-fruntime-alloc") == 0) {
+			asmOptions.runtimeAlloc = 1;
+		} else if (strcmp(argv[i], "-fframe-stats") == 0) {
+			asmOptions.frameStats = stderr;
+		} else if (strncmp(argv[i], "-finline-size=", 14) == 0) {
+			inlining.maxSize = atoi(argv[i] + 14);
+		} else if (strncmp(argv[i], "-finline-depth=", 15) == 0) {
+			inlining.maxDepth = atoi(argv[i] + 15);
+		} else if (strncmp(argv[i], "-finline-hot-size=", 18) == 0) {
+			inlining.hotSize = atoi(argv[i] + 18);
+		} else if (strcmp(argv[i], "-finline-stats") == 0) {
+			inlining.stats = stderr;
+		} else if (strncmp(argv[i], "-fstack-new-limit=", 18) == 0) {
+			escape.maxFrameBytes = atoi(argv[i] + 18);
+		} else if (strcmp(argv[i], "-fescape-stats") == 0) {
+			escape.stats = stderr;
+		} else if (strcmp(argv[i], "-ftime-report") == 0) {
+			timeReport = 0;
+		} else if (strcmp(argv[i], "-ftime-report=json") == 0) {
+			timeReport = 1;
+		} else if (strcmp(argv[i], "-fremarks") == 0 || strcmp(argv[i], "-fremarks=yaml") == 0) {
+			remarks = 0;
+		} else if (strcmp(argv[i], "-fremarks=json") == 0) {
+			remarks = 1;
+		} else if (strncmp(argv[i], "-fremarks-filter=", 17) == 0) {
+			remarksFilter = argv[i] + 17;
+		} else if (strcmp(argv[i], "-falloc-profile") == 0) {
+			asmOptions.allocProfile = "mini0.alloc";
+		} else if (strncmp(argv[i], "-falloc-profile=", 16) == 0) {
+			asmOptions.allocProfile = argv[i] + 16;
+		} else if (strcmp(argv[i], "-fprofile-generate") == 0) {
+			profileGenerate = "mini0.prof";
+		} else if (strncmp(argv[i], "-fprofile-generate=", 19) == 0) {
+			profileGenerate = argv[i] + 19;
+		} else if (strcmp(argv[i], "-fprofile-use") == 0) {
+			profileUse = "mini0.prof";
+		} else if (strncmp(argv[i], "-fprofile-use=", 14) == 0) {
+			profileUse = argv[i] + 14;
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "Opcao desconhecida: %s\n", argv[i]);
+			badOption = 1;
+		} else {
+			inputFileName = argv[i];
+		}
+	}
+	if (!inputFileName || badOption) {
+		fprintf(stderr, "Uso: %s [-O|-O0|-O1|-O2|-Os] [-fenable-pass=passos] [-fdisable-pass=passos] [-fpass-stats] [-fdump-after=passo] [-g] [-funroll=N] [-funroll-budget=N] [-funroll-stats] [-finline-size=N] [-finline-depth=N] [-finline-stats] [-fstack-new-limit=N] [-fescape-stats] [-fframe-stats] [-f[no-]omit-frame-pointer] [-f[no-]register-args] [-fruntime-alloc] [-fprofile-generate[=arquivo]] [-fprofile-use[=arquivo]] [-finline-hot-size=N] [-ftime-report[=json]] [-fremarks[=yaml|json]] [-fremarks-filter=padrao] [-falloc-profile[=arquivo]] arquivo.m0.ir\n", argv[0]);
+		exit(1);
+	}
+	if (debugLines) {
+		asmOptions.sourceFile = inputFileName;
+	}
+	if (timeReport >= 0) {
+		Timing_enable();
+	}
+	if (remarks >= 0) {
+		Remark_enable(stderr, remarks, remarksFilter);
+	}
+	yyin = fopen(inputFileName, "r");
+	if (!yyin) {
+		fprintf(stderr, "Nao foi possivel abrir %s\n", inputFileName);
 		exit(1);
 	}
-	yyin = fopen(argv[1], "r");
+	Timing_start(TIMING_PARSE);
 	err = yyparse();
+	Timing_stop(TIMING_PARSE);
 	fclose(yyin);
 	if (err != 0) {
 		fprintf(stderr, "Error reading input file.\n");
 		exit(1);
 	}
 
-   strcpy( outputFileName, argv[1] );
-   strcpy( &(outputFileName[ strlen(argv[1])-6 ]), ".s" );
+   // Perfil do codigo lido, antes das otimizacoes, para que os blocos
+   // contados e os anotados sejam os mesmos
+   Timing_start( TIMING_PROFILE );
+   if ( profileGenerate )
+      asmOptions.profile = Profile_instrument( ir, profileGenerate );
+   if ( profileUse )
+   {
+      Profile* profile = Profile_read( profileUse );
+      if ( profile )
+      {
+         Profile_annotate( ir, profile );
+         Profile_delete( profile );
+         asmOptions.splitCold = 1;
+      }
+      else
+         fprintf( stderr, "Aviso: perfil %s nao encontrado\n", profileUse );
+   }
+   Timing_stop( TIMING_PROFILE );
+
+   // Otimizacoes sobre o codigo intermediario; as opcoes explicitas do
+   // Asm valem sobre as do nivel
+   Pass_configure( &passes );
+   if ( registerArgs >= 0 )
+      asmOptions.registerArgs = registerArgs;
+   if ( omitFramePointer >= 0 )
+      asmOptions.omitFramePointer = omitFramePointer;
+   Pass_run( ir, &passes );
+
+   strcpy( outputFileName, inputFileName );
+   strcpy( &(outputFileName[ strlen(inputFileName)-6 ]), ".s" );
    outputFile = fopen( outputFileName, "w" );
 
 	//IR_dump( ir, stdout );
-	Asm_write( ir, outputFile );
+	Asm_write( ir, &asmOptions, outputFile );
 	
    fclose( outputFile );
+   Remark_finish();
+   if ( passes.stats )
+      Pass_report( passes.stats );
+   if ( timeReport >= 0 )
+      Timing_report( stderr, timeReport );
 	return 0;
 }
 
@@ -0,0 +1,366 @@
+/**
+ * @file    pass.c
+ * @author  lhpelosi
+ */
+
+#include "pass.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cfg.h"
+#include "loop.h"
+#include "induction.h"
+#include "tailcall.h"
+#include "copy.h"
+#include "layout.h"
+#include "timing.h"
+
+#define PASS_OS_INLINE_SIZE 4 // Mais ou menos o custo da propria chamada
+#define PASS_INLINE_SIZE 30
+
+#define Pass_in(_level) ( 1 << (_level) )
+
+typedef struct PassInfo_ {
+   const char* name;
+   int levels; // Niveis em que o passo roda
+   TimingPhase phase;
+   int (*runProgram)( IR* program, PassOptions* options );
+   int (*runFunction)( Function* function, PassOptions* options ); // NULL nos passos do Asm
+   int enabled; // -fenable-pass e -fdisable-pass, -1 segue o nivel
+   int nRuns;
+   int nChanges;
+   double time;
+} PassInfo;
+
+static int Pass_inline( IR* program, PassOptions* options );
+static int Pass_tailCall( Function* function, PassOptions* options );
+static int Pass_copy( Function* function, PassOptions* options );
+static int Pass_licm( Function* function, PassOptions* options );
+static int Pass_induction( Function* function, PassOptions* options );
+static int Pass_unroll( Function* function, PassOptions* options );
+static int Pass_escape( Function* function, PassOptions* options );
+static int Pass_layout( Function* function, PassOptions* options );
+
+#define PASS_ALL ( Pass_in( PASS_O1 ) | Pass_in( PASS_O2 ) | Pass_in( PASS_OS ) )
+#define PASS_FULL ( Pass_in( PASS_O2 ) | Pass_in( PASS_OS ) )
+
+// Passos sobre o codigo intermediario seguidos dos que o Asm faz ao
+// gerar o codigo de maquina
+static PassInfo Pass_table[] = {
+   { "inline",             PASS_FULL,           TIMING_INLINE,    Pass_inline, NULL,            -1 },
+   { "tailcall",           PASS_ALL,            TIMING_TAILCALL,  NULL,        Pass_tailCall,   -1 },
+   { "copy",               PASS_ALL,            TIMING_COPY,      NULL,        Pass_copy,       -1 },
+   { "licm",               PASS_ALL,            TIMING_LICM,      NULL,        Pass_licm,       -1 },
+   { "induction",          PASS_FULL,           TIMING_INDUCTION, NULL,        Pass_induction,  -1 },
+   { "unroll",             Pass_in( PASS_O2 ),  TIMING_UNROLL,    NULL,        Pass_unroll,     -1 },
+   { "escape",             PASS_ALL,            TIMING_ESCAPE,    NULL,        Pass_escape,     -1 },
+   { "layout",             PASS_ALL,            TIMING_LAYOUT,    NULL,        Pass_layout,     -1 },
+   { "sibcall",            PASS_ALL,            TIMING_EMIT,      NULL,        NULL,            -1 },
+   { "share-slots",        PASS_ALL,            TIMING_EMIT,      NULL,        NULL,            -1 },
+   { "omit-frame-pointer", PASS_ALL,            TIMING_EMIT,      NULL,        NULL,            -1 },
+   { "register-args",      PASS_ALL,            TIMING_EMIT,      NULL,        NULL,            -1 },
+   { "align-loops",        Pass_in( PASS_O2 ),  TIMING_EMIT,      NULL,        NULL,            -1 },
+   { "split-cold",         PASS_FULL,           TIMING_EMIT,      NULL,        NULL,            -1 },
+   { "branch-fusion",      PASS_ALL,            TIMING_EMIT,      NULL,        NULL,            -1 },
+};
+#define PASS_N_PASSES (int) ( sizeof(Pass_table) / sizeof(PassInfo) )
+
+// Ordem de execucao; copy roda de novo depois dos passos de laco
+static const char* Pass_pipeline[] = {
+   "inline", "tailcall", "copy", "licm", "induction", "unroll", "copy", "escape", "layout"
+};
+#define PASS_PIPELINE_SIZE (int) ( sizeof(Pass_pipeline) / sizeof(char*) )
+
+static PassLevel Pass_level = PASS_O0;
+
+static PassInfo* Pass_find( const char* name, int length );
+static int Pass_enabled( PassInfo* pass );
+static void Pass_runOne( IR* program, PassInfo* pass, PassOptions* options );
+static void Pass_verify( Function* function, const char* pass );
+static void Pass_fail( Function* function, const char* pass, const char* message, const char* what );
+static int Pass_compareNames( const void* a, const void* b );
+static double Pass_now();
+
+
+
+int Pass_toggle( const char* names, int enabled )
+{
+   // Lista separada por virgulas
+   int nUnknown = 0;
+   while ( *names )
+   {
+      int length = strcspn( names, "," );
+      PassInfo* pass = Pass_find( names, length );
+      if ( pass )
+         pass->enabled = enabled;
+      else
+      {
+         fprintf( stderr, "Aviso: passo %.*s desconhecido\n", length, names );
+         nUnknown++;
+      }
+      names += length;
+      if ( *names == ',' ) names++;
+   }
+   return nUnknown == 0;
+}
+
+
+
+int Pass_isEnabled( const char* name )
+{
+   PassInfo* pass = Pass_find( name, strlen( name ) );
+   return pass && Pass_enabled( pass );
+}
+
+
+
+void Pass_configure( PassOptions* options )
+{
+   Pass_level = options->level;
+
+   // Tamanhos de inline que nao vieram da linha de comando
+   InlineOptions* inlining = options->inlining;
+   if ( inlining->maxSize < 0 )
+      inlining->maxSize = ( options->level == PASS_OS ) ? PASS_OS_INLINE_SIZE : PASS_INLINE_SIZE;
+   if ( inlining->hotSize < 0 )
+      inlining->hotSize = ( options->level == PASS_OS ) ? inlining->maxSize : 4 * inlining->maxSize;
+
+   AsmOptions* asmOptions = options->asmOptions;
+   asmOptions->tailCalls = Pass_isEnabled( "sibcall" );
+   asmOptions->shareSlots = Pass_isEnabled( "share-slots" );
+   asmOptions->omitFramePointer = Pass_isEnabled( "omit-frame-pointer" );
+   asmOptions->registerArgs = Pass_isEnabled( "register-args" );
+   asmOptions->alignLoops = Pass_isEnabled( "align-loops" );
+   // O Asm divide a funcao no primeiro rotulo frio; so o layout garante que
+   // os blocos frios vem depois de todos os quentes e que nenhum quente cai num frio
+   asmOptions->splitCold = asmOptions->splitCold && Pass_isEnabled( "split-cold" ) && Pass_isEnabled( "layout" );
+   asmOptions->fuseBranches = Pass_isEnabled( "branch-fusion" );
+}
+
+
+
+void Pass_run( IR* program, PassOptions* options )
+{
+   // Cada passo roda em todas as funcoes antes do seguinte, para que o
+   // codigo escrito por -fdump-after seja o do programa inteiro
+   for ( int p = 0 ; p < PASS_PIPELINE_SIZE ; p++ )
+   {
+      PassInfo* pass = Pass_find( Pass_pipeline[p], strlen( Pass_pipeline[p] ) );
+      if ( !Pass_enabled( pass ) ) continue;
+      Pass_runOne( program, pass, options );
+      if ( options->dumpAfter && strcmp( options->dumpAfter, pass->name ) == 0 )
+      {
+         printf( "# depois de %s\n", pass->name );
+         IR_dump( program, stdout );
+      }
+   }
+   Timing_function( NULL );
+}
+
+
+
+void Pass_report( FILE* output )
+{
+   fprintf( output, "%-20s %6s %10s %10s %12s\n", "Passo", "ativo", "execucoes", "mudancas", "tempo (ms)" );
+   for ( int i = 0 ; i < PASS_N_PASSES ; i++ )
+   {
+      PassInfo* pass = &(Pass_table[i]);
+      if ( pass->runProgram || pass->runFunction )
+         fprintf( output, "%-20s %6s %10d %10d %12.3f\n", pass->name, Pass_enabled( pass ) ? "sim" : "nao",
+                  pass->nRuns, pass->nChanges, 1e3 * pass->time );
+      else
+         fprintf( output, "%-20s %6s %10s %10s %12s\n", pass->name,
+                  Pass_enabled( pass ) ? "sim" : "nao", "-", "-", "-" );
+   }
+}
+
+
+
+static int Pass_inline( IR* program, PassOptions* options )
+{
+   return Inline_functions( program, options->inlining );
+}
+
+
+
+static int Pass_tailCall( Function* function, PassOptions* options )
+{
+   return TailCall_eliminate( function );
+}
+
+
+
+static int Pass_copy( Function* function, PassOptions* options )
+{
+   int nChanges = Copy_propagate( function );
+   return nChanges + Copy_coalesce( function );
+}
+
+
+
+static int Pass_licm( Function* function, PassOptions* options )
+{
+   return Loop_hoistInvariants( function );
+}
+
+
+
+static int Pass_induction( Function* function, PassOptions* options )
+{
+   return Induction_reduce( function );
+}
+
+
+
+static int Pass_unroll( Function* function, PassOptions* options )
+{
+   return Unroll_loops( function, options->unroll );
+}
+
+
+
+static int Pass_escape( Function* function, PassOptions* options )
+{
+   return Escape_optimize( function, options->escape );
+}
+
+
+
+static int Pass_layout( Function* function, PassOptions* options )
+{
+   return Layout_blocks( function );
+}
+
+
+
+static PassInfo* Pass_find( const char* name, int length )
+{
+   for ( int i = 0 ; i < PASS_N_PASSES ; i++ )
+      if ( strncmp( Pass_table[i].name, name, length ) == 0 && Pass_table[i].name[ length ] == '\0' )
+         return &(Pass_table[i]);
+   return NULL;
+}
+
+
+
+static int Pass_enabled( PassInfo* pass )
+{
+   if ( pass->enabled >= 0 ) return pass->enabled;
+   return ( pass->levels & Pass_in( Pass_level ) ) != 0;
+}
+
+
+
+static void Pass_runOne( IR* program, PassInfo* pass, PassOptions* options )
+{
+   if ( pass->runProgram )
+   {
+      double start = Pass_now();
+      Timing_function( NULL );
+      Timing_start( pass->phase );
+      pass->nChanges += pass->runProgram( program, options );
+      Timing_stop( pass->phase );
+      pass->time += Pass_now() - start;
+      pass->nRuns++;
+#ifndef NDEBUG
+      for ( Function* fun = program->functions ; fun ; fun = fun->next )
+         Pass_verify( fun, pass->name );
+#endif
+      return;
+   }
+
+   for ( Function* fun = program->functions ; fun ; fun = fun->next )
+   {
+      double start = Pass_now();
+      Timing_function( fun );
+      Timing_start( pass->phase );
+      pass->nChanges += pass->runFunction( fun, options );
+      Timing_stop( pass->phase );
+      pass->time += Pass_now() - start;
+      pass->nRuns++;
+#ifndef NDEBUG
+      Pass_verify( fun, pass->name );
+#endif
+   }
+}
+
+
+
+static void Pass_verify( Function* function, const char* pass )
+{
+   int nLocals = Function_nLocals( function );
+   int nTemps = Function_nTemps( function );
+   int nLabels = 0;
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+      nLabels += ( instr->op == OP_LABEL );
+   const char** labels = (const char**) malloc( ( nLabels+1 ) * sizeof(char*) );
+   nLabels = 0;
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+      if ( instr->op == OP_LABEL )
+         labels[ nLabels++ ] = instr->x.str;
+   qsort( labels, nLabels, sizeof(char*), Pass_compareNames );
+   for ( int i = 1 ; i < nLabels ; i++ )
+      if ( strcmp( labels[i-1], labels[i] ) == 0 )
+         Pass_fail( function, pass, "rotulo repetido", labels[i] );
+
+   int nParams = 0;
+   for ( Instr* instr = function->code ; instr ; instr = instr->next )
+   {
+      // Variaveis dentro das listas da funcao
+      Addr* addrs[3] = { &(instr->x), &(instr->y), &(instr->z) };
+      for ( int a = 0 ; a < 3 ; a++ )
+      {
+         if ( addrs[a]->type == AD_LOCAL && ( addrs[a]->num < 0 || addrs[a]->num >= nLocals ) )
+            Pass_fail( function, pass, "local fora da funcao", addrs[a]->str );
+         if ( addrs[a]->type == AD_TEMP && ( addrs[a]->num < 0 || addrs[a]->num >= nTemps ) )
+            Pass_fail( function, pass, "temporaria fora da funcao", addrs[a]->str );
+      }
+
+      // Desvios para rotulos da propria funcao
+      Addr* target = Instr_jumpTarget( instr );
+      if ( target && !bsearch( &(target->str), labels, nLabels, sizeof(char*), Pass_compareNames ) )
+         Pass_fail( function, pass, "desvio para rotulo inexistente", target->str );
+
+      // Os param vem logo antes da sua chamada
+      if ( instr->op == OP_PARAM )
+         nParams++;
+      else if ( instr->op == OP_CALL )
+      {
+         if ( nParams != instr->y.num )
+            Pass_fail( function, pass, "numero de param diferente do da chamada", instr->x.str );
+         nParams = 0;
+      }
+      else if ( nParams > 0 )
+         Pass_fail( function, pass, "param sem chamada", NULL );
+   }
+   if ( nParams > 0 )
+      Pass_fail( function, pass, "param sem chamada", NULL );
+   free( labels );
+}
+
+
+
+static void Pass_fail( Function* function, const char* pass, const char* message, const char* what )
+{
+   fprintf( stderr, "Erro: codigo invalido depois de %s em %s: %s%s%s\n", pass, function->name,
+            message, what ? " " : "", what ? what : "" );
+   exit( 1 );
+}
+
+
+
+static int Pass_compareNames( const void* a, const void* b )
+{
+   return strcmp( *(const char**) a, *(const char**) b );
+}
+
+
+
+static double Pass_now()
+{
+   struct timespec t;
+   clock_gettime( CLOCK_MONOTONIC, &t );
+   return t.tv_sec + 1e-9 * t.tv_nsec;
+}
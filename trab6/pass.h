@@ -0,0 +1,39 @@
+/**
+ * @file    pass.h
+ * @author  lhpelosi
+ */
+
+#ifndef PASS_H
+#define PASS_H
+
+#include <stdio.h>
+#include "ir.h"
+#include "asm.h"
+#include "inline.h"
+#include "unroll.h"
+#include "escape.h"
+
+typedef enum PassLevel_ {
+   PASS_O0,
+   PASS_O1, // Passos baratos, sem aumentar o codigo
+   PASS_O2,
+   PASS_OS, // Como -O2, sem o que aumenta o codigo
+} PassLevel;
+
+typedef struct PassOptions_ {
+   PassLevel level;
+   InlineOptions* inlining;
+   UnrollOptions* unroll;
+   EscapeOptions* escape;
+   AsmOptions* asmOptions;
+   FILE* stats; // Tempo e mudancas de cada passo, NULL para nenhum
+   const char* dumpAfter; // Passo depois do qual o codigo e escrito, NULL para nenhum
+} PassOptions;
+
+int Pass_toggle( const char* names, int enabled );
+int Pass_isEnabled( const char* name );
+void Pass_configure( PassOptions* options );
+void Pass_run( IR* program, PassOptions* options );
+void Pass_report( FILE* output );
+
+#endif
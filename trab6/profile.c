@@ -0,0 +1,177 @@
+/**
+ * @file    profile.c
+ * @author  lhpelosi
+ */
+
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+
+#define PROFILE_NAME_SIZE 256
+
+static ProfileSite* Profile_addSite( Profile* profile, char* name, int counter );
+static char* Profile_siteName( const char* function, int block, const char* callee );
+static long long Profile_find( Profile* profile, const char* function, int block, const char* callee );
+static int Profile_compareSites( const void* a, const void* b );
+
+
+
+Profile* Profile_instrument( IR* program, const char* fileName )
+{
+   Profile* profile = (Profile*) calloc( 1, sizeof(Profile) );
+   profile->fileName = fileName;
+
+   for ( Function* function = program->functions ; function ; function = function->next )
+   {
+      Cfg* cfg = Cfg_build( function );
+      Instr** link = &(function->code);
+      for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      {
+         CfgBlock* block = cfg->blocks[i];
+         int counter = profile->nCounters++;
+         Profile_addSite( profile, Profile_siteName( function->name, i, NULL ), counter );
+         for ( Instr* instr = block->first ; instr != block->last->next ; instr = instr->next )
+            if ( instr->op == OP_CALL )
+               Profile_addSite( profile, Profile_siteName( function->name, i, instr->x.str ), counter );
+
+         // O contador vem logo depois do rotulo do bloco
+         Instr* count = Instr_new( OP_COUNT, Addr_litNum( counter ) );
+         Instr* last = block->last;
+         if ( block->first->op == OP_LABEL )
+         {
+            count->next = block->first->next;
+            block->first->next = count;
+            if ( last == block->first ) last = count;
+         }
+         else
+         {
+            count->next = block->first;
+            *link = count;
+         }
+         link = &(last->next);
+      }
+      Cfg_delete( cfg );
+   }
+   return profile;
+}
+
+
+
+Profile* Profile_read( const char* fileName )
+{
+   FILE* file = fopen( fileName, "r" );
+   if ( file == NULL ) return NULL;
+   Profile* profile = (Profile*) calloc( 1, sizeof(Profile) );
+   profile->fileName = fileName;
+
+   // Linhas "b funcao bloco contagem" e "c funcao bloco chamada contagem"
+   char kind[2];
+   char function[ PROFILE_NAME_SIZE ];
+   char callee[ PROFILE_NAME_SIZE ];
+   int block;
+   long long count;
+   while ( fscanf( file, "%1s %255s %d", kind, function, &block ) == 3 )
+   {
+      int isCall = ( kind[0] == 'c' );
+      if ( isCall && fscanf( file, "%255s", callee ) != 1 ) break;
+      if ( fscanf( file, "%lld", &count ) != 1 ) break;
+      ProfileSite* site = Profile_addSite( profile, Profile_siteName( function, block, isCall ? callee : NULL ), -1 );
+      site->count = count;
+   }
+   fclose( file );
+
+   qsort( profile->sites, profile->nSites, sizeof(ProfileSite), Profile_compareSites );
+   return profile;
+}
+
+
+
+int Profile_annotate( IR* program, Profile* profile )
+{
+   int nAnnotated = 0;
+   for ( Function* function = program->functions ; function ; function = function->next )
+   {
+      Cfg* cfg = Cfg_build( function );
+      int isAnnotated = 0;
+      for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+      {
+         CfgBlock* block = cfg->blocks[i];
+         long long count = Profile_find( profile, function->name, i, NULL );
+         if ( count < 0 ) continue;
+         for ( Instr* instr = block->first ; instr != block->last->next ; instr = instr->next )
+         {
+            instr->count = count;
+            if ( instr->op == OP_CALL )
+            {
+               long long calls = Profile_find( profile, function->name, i, instr->x.str );
+               if ( calls >= 0 ) instr->count = calls;
+            }
+         }
+         isAnnotated = 1;
+      }
+      nAnnotated += isAnnotated;
+      Cfg_delete( cfg );
+   }
+   return nAnnotated;
+}
+
+
+
+void Profile_delete( Profile* profile )
+{
+   for ( int i = 0 ; i < profile->nSites ; i++ )
+      free( profile->sites[i].name );
+   free( profile->sites );
+   free( profile );
+}
+
+
+
+static ProfileSite* Profile_addSite( Profile* profile, char* name, int counter )
+{
+   if ( profile->nSites == profile->capacity )
+   {
+      profile->capacity = profile->capacity ? 2 * profile->capacity : 64;
+      profile->sites = (ProfileSite*) realloc( profile->sites, profile->capacity * sizeof(ProfileSite) );
+   }
+   ProfileSite* site = &(profile->sites[ profile->nSites++ ]);
+   site->name = name;
+   site->counter = counter;
+   site->count = 0;
+   return site;
+}
+
+
+
+static char* Profile_siteName( const char* function, int block, const char* callee )
+{
+   char* name = (char*) malloc( strlen( function ) + ( callee ? strlen( callee ) : 0 ) + 32 );
+   if ( callee )
+      sprintf( name, "c %s %d %s", function, block, callee );
+   else
+      sprintf( name, "b %s %d", function, block );
+   return name;
+}
+
+
+
+static long long Profile_find( Profile* profile, const char* function, int block, const char* callee )
+{
+   ProfileSite key;
+   key.name = Profile_siteName( function, block, callee );
+   ProfileSite* site = (ProfileSite*) bsearch( &key, profile->sites, profile->nSites,
+                                               sizeof(ProfileSite), Profile_compareSites );
+   free( key.name );
+   return site ? site->count : -1;
+}
+
+
+
+static int Profile_compareSites( const void* a, const void* b )
+{
+   return strcmp( ((ProfileSite*) a)->name, ((ProfileSite*) b)->name );
+}
@@ -0,0 +1,32 @@
+/**
+ * @file    profile.h
+ * @author  lhpelosi
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "ir.h"
+
+// Um contador por bloco do codigo lido, antes das otimizacoes; as
+// chamadas do bloco usam o mesmo contador, pois executam com ele
+typedef struct ProfileSite_ {
+   char* name; // "b funcao bloco" ou "c funcao bloco chamada"
+   int counter;
+   long long count;
+} ProfileSite;
+
+typedef struct Profile_ {
+   const char* fileName;
+   ProfileSite* sites;
+   int nSites;
+   int capacity;
+   int nCounters;
+} Profile;
+
+Profile* Profile_instrument( IR* program, const char* fileName );
+Profile* Profile_read( const char* fileName );
+int Profile_annotate( IR* program, Profile* profile );
+void Profile_delete( Profile* profile );
+
+#endif
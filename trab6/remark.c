@@ -0,0 +1,130 @@
+/**
+ * @file    remark.c
+ * @author  lhpelosi
+ */
+
+#include "remark.h"
+
+#include <fnmatch.h>
+#include <stdarg.h>
+
+#define REMARK_MESSAGE_SIZE 512
+
+int Remark_enabled = 0;
+
+static const char* Remark_kindNames[] = { "Passed", "Missed", "Analysis" };
+
+static FILE* Remark_output;
+static int Remark_json;
+static const char* Remark_filter; // Padrao de nomes de funcao, NULL para todas
+static int Remark_count;
+static Function* Remark_lastFunction; // Ultima instrucao procurada, pois as
+static Instr* Remark_lastInstr;       // observacoes seguem a ordem do codigo
+static int Remark_lastIndex;
+
+static void Remark_writeString( const char* s );
+
+
+
+void Remark_enable( FILE* output, int json, const char* filter )
+{
+   Remark_enabled = 1;
+   Remark_output = output;
+   Remark_json = json;
+   Remark_filter = filter;
+}
+
+
+
+int Remark_wants( Function* function )
+{
+   if ( !Remark_enabled ) return 0;
+   return Remark_filter == NULL || fnmatch( Remark_filter, function->name, 0 ) == 0;
+}
+
+
+
+int Remark_index( Function* function, Instr* instr )
+{
+   // Continua de onde a busca anterior parou, se a instrucao vier depois
+   Instr* start = function->code;
+   int index = 0;
+   if ( function == Remark_lastFunction && Remark_lastInstr )
+   {
+      start = Remark_lastInstr;
+      index = Remark_lastIndex;
+   }
+   for ( int k = 0 ; k < 2 ; k++ )
+   {
+      for ( Instr* i = start ; i ; i = i->next, index++ )
+      {
+         if ( i != instr ) continue;
+         Remark_lastFunction = function;
+         Remark_lastInstr = instr;
+         Remark_lastIndex = index;
+         return index;
+      }
+      start = function->code;
+      index = 0;
+   }
+   return -1;
+}
+
+
+
+void Remark_emit( RemarkKind kind, const char* pass, Function* function, int index, const char* format, ... )
+{
+   if ( !Remark_wants( function ) ) return;
+   char message[ REMARK_MESSAGE_SIZE ];
+   va_list ap;
+   va_start( ap, format );
+   vsnprintf( message, REMARK_MESSAGE_SIZE, format, ap );
+   va_end( ap );
+
+   if ( Remark_json )
+   {
+      fprintf( Remark_output, "%s\n  {\"kind\": \"%s\", \"pass\": ", Remark_count ? "," : "[", Remark_kindNames[kind] );
+      Remark_writeString( pass );
+      fprintf( Remark_output, ", \"function\": " );
+      Remark_writeString( function->name );
+      fprintf( Remark_output, ", \"instr\": %d, \"message\": ", index );
+      Remark_writeString( message );
+      fprintf( Remark_output, "}" );
+   }
+   else
+   {
+      fprintf( Remark_output, "--- !%s\nPass: ", Remark_kindNames[kind] );
+      Remark_writeString( pass );
+      fprintf( Remark_output, "\nFunction: " );
+      Remark_writeString( function->name );
+      fprintf( Remark_output, "\nInstr: %d\nMessage: ", index );
+      Remark_writeString( message );
+      fprintf( Remark_output, "\n...\n" );
+   }
+   Remark_count++;
+}
+
+
+
+void Remark_finish()
+{
+   if ( !Remark_enabled || !Remark_json ) return;
+   fprintf( Remark_output, "%s]\n", Remark_count ? "\n" : "[" );
+}
+
+
+
+static void Remark_writeString( const char* s )
+{
+   // Entre aspas duplas no JSON e simples no YAML
+   fputc( Remark_json ? '"' : '\'', Remark_output );
+   for ( ; *s ; s++ )
+   {
+      if ( Remark_json && ( *s == '"' || *s == '\\' ) )
+         fputc( '\\', Remark_output );
+      else if ( !Remark_json && *s == '\'' )
+         fputc( '\'', Remark_output );
+      fputc( *s, Remark_output );
+   }
+   fputc( Remark_json ? '"' : '\'', Remark_output );
+}
@@ -0,0 +1,27 @@
+/**
+ * @file    remark.h
+ * @author  lhpelosi
+ */
+
+#ifndef REMARK_H
+#define REMARK_H
+
+#include <stdio.h>
+#include "ir.h"
+
+// Otimizacao feita, deixada de fazer e informacao sobre o codigo
+typedef enum RemarkKind_ {
+   REMARK_PASSED,
+   REMARK_MISSED,
+   REMARK_ANALYSIS
+} RemarkKind;
+
+extern int Remark_enabled;
+
+void Remark_enable( FILE* output, int json, const char* filter );
+int Remark_wants( Function* function );
+int Remark_index( Function* function, Instr* instr );
+void Remark_emit( RemarkKind kind, const char* pass, Function* function, int index, const char* format, ... );
+void Remark_finish();
+
+#endif
@@ -0,0 +1,169 @@
+/**
+ * @file    runtime.c
+ * @author  lhpelosi
+ *
+ * Alocador ligado ao codigo gerado com -fruntime-alloc. Blocos pequenos
+ * saem de regioes grandes por incremento de um apontador; blocos
+ * liberados voltam para a lista livre da sua classe de tamanho.
+ *
+ * Tambem grava, no fim da execucao, os contadores do codigo gerado
+ * com -fprofile-generate e o relatorio por ponto de alocacao de
+ * -falloc-profile.
+ */
+
+#include "runtime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+char* Runtime_heapNext = NULL;
+char* Runtime_heapLimit = NULL;
+void* Runtime_freeLists[ RUNTIME_N_CLASSES ];
+
+static const char* Runtime_profileFile;
+static unsigned long long* Runtime_profileCounters;
+static RuntimeProfileSite* Runtime_profileSites;
+static int Runtime_profileNSites;
+
+static const char* Runtime_allocFile;
+static RuntimeAllocSite* Runtime_allocSites;
+static int Runtime_allocNSites;
+static int Runtime_allocUseRuntime; // Aloca com Runtime_new em vez do malloc
+
+static void Runtime_writeProfile();
+static void Runtime_writeAllocProfile();
+static int Runtime_compareAllocSites( const void* a, const void* b );
+
+
+
+void* Runtime_alloc( int bytes )
+{
+   if ( bytes < 0 ) return NULL;
+   unsigned size = Runtime_blockSize( bytes );
+
+   // Blocos grandes vem do malloc, com o mesmo cabecalho
+   if ( size > RUNTIME_MAX_SMALL )
+   {
+      char* block = (char*) malloc( size );
+      if ( block == NULL ) return NULL;
+      *(int*) block = size;
+      return block + 4;
+   }
+
+   // Reaproveita um bloco liberado da mesma classe
+   int class = size / RUNTIME_GRANULE;
+   if ( Runtime_freeLists[ class ] )
+   {
+      void** block = (void**) Runtime_freeLists[ class ];
+      Runtime_freeLists[ class ] = *block;
+      *(int*) block = size;
+      return (char*) block + 4;
+   }
+
+   // A sobra da regiao anterior e descartada
+   if ( (unsigned long) ( Runtime_heapLimit - Runtime_heapNext ) < size )
+   {
+      char* chunk = (char*) malloc( RUNTIME_CHUNK_SIZE );
+      if ( chunk == NULL ) return NULL;
+      Runtime_heapNext = chunk;
+      Runtime_heapLimit = chunk + RUNTIME_CHUNK_SIZE;
+   }
+   char* block = Runtime_heapNext;
+   Runtime_heapNext += size;
+   *(int*) block = size;
+   return block + 4;
+}
+
+
+
+void Runtime_free( void* p )
+{
+   if ( p == NULL ) return;
+   char* block = (char*) p - 4;
+   unsigned size = *(int*) block;
+   if ( size > RUNTIME_MAX_SMALL )
+   {
+      free( block );
+      return;
+   }
+   // O cabecalho passa a guardar o proximo da lista
+   int class = size / RUNTIME_GRANULE;
+   *(void**) block = Runtime_freeLists[ class ];
+   Runtime_freeLists[ class ] = block;
+}
+
+
+
+
+void Runtime_startProfile( const char* fileName, unsigned long long* counters, RuntimeProfileSite* sites, int nSites )
+{
+   Runtime_profileFile = fileName;
+   Runtime_profileCounters = counters;
+   Runtime_profileSites = sites;
+   Runtime_profileNSites = nSites;
+   atexit( Runtime_writeProfile );
+}
+
+
+
+void Runtime_startAllocProfile( const char* fileName, RuntimeAllocSite* sites, int nSites, int useRuntime )
+{
+   Runtime_allocFile = fileName;
+   Runtime_allocSites = sites;
+   Runtime_allocNSites = nSites;
+   Runtime_allocUseRuntime = useRuntime;
+   atexit( Runtime_writeAllocProfile );
+}
+
+
+
+void* Runtime_profiledAlloc( int bytes, RuntimeAllocSite* site )
+{
+   site->count++;
+   site->bytes += bytes;
+   return Runtime_allocUseRuntime ? Runtime_new( bytes ) : malloc( bytes );
+}
+
+
+
+static void Runtime_writeProfile()
+{
+   FILE* file = fopen( Runtime_profileFile, "w" );
+   if ( file == NULL ) return;
+   for ( int i = 0 ; i < Runtime_profileNSites ; i++ )
+      fprintf( file, "%s %llu\n", Runtime_profileSites[i].name,
+                                  Runtime_profileCounters[ Runtime_profileSites[i].counter ] );
+   fclose( file );
+}
+
+
+
+static void Runtime_writeAllocProfile()
+{
+   // Pontos que alocaram, dos que mais alocaram bytes para os que menos
+   FILE* file = fopen( Runtime_allocFile, "w" );
+   if ( file == NULL ) return;
+   RuntimeAllocSite** sorted = (RuntimeAllocSite**) malloc( ( Runtime_allocNSites+1 ) * sizeof(RuntimeAllocSite*) );
+   int n = 0;
+   for ( int i = 0 ; i < Runtime_allocNSites ; i++ )
+      if ( Runtime_allocSites[i].count > 0 )
+         sorted[ n++ ] = &(Runtime_allocSites[i]);
+   qsort( sorted, n, sizeof(RuntimeAllocSite*), Runtime_compareAllocSites );
+
+   fprintf( file, "# bytes alocacoes funcao instrucao\n" );
+   for ( int i = 0 ; i < n ; i++ )
+      fprintf( file, "%llu %llu %s\n", sorted[i]->bytes, sorted[i]->count, sorted[i]->name );
+   free( sorted );
+   fclose( file );
+}
+
+
+
+static int Runtime_compareAllocSites( const void* a, const void* b )
+{
+   const RuntimeAllocSite* sa = *(const RuntimeAllocSite**) a;
+   const RuntimeAllocSite* sb = *(const RuntimeAllocSite**) b;
+   if ( sa->bytes != sb->bytes ) return ( sa->bytes > sb->bytes ) ? -1 : 1;
+   if ( sa->count != sb->count ) return ( sa->count > sb->count ) ? -1 : 1;
+   return 0;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file    runtime.h
+ * @author  lhpelosi
+ */
+
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+// Cada bloco tem um cabecalho de 4 bytes com o seu tamanho total,
+// arredondado para RUNTIME_GRANULE, usado pela lista livre da classe
+#define RUNTIME_GRANULE 8
+#define RUNTIME_MAX_SMALL 256
+#define RUNTIME_N_CLASSES ( RUNTIME_MAX_SMALL / RUNTIME_GRANULE + 1 )
+#define RUNTIME_CHUNK_SIZE ( 1 << 20 )
+
+#define Runtime_blockSize(_bytes) ( ( (_bytes) + 4 + RUNTIME_GRANULE - 1 ) & ~( RUNTIME_GRANULE - 1 ) )
+
+// Regiao atual de alocacao por incremento; o codigo gerado le e
+// atualiza estas variaveis diretamente
+extern char* Runtime_heapNext;
+extern char* Runtime_heapLimit;
+extern void* Runtime_freeLists[ RUNTIME_N_CLASSES ];
+
+void* Runtime_alloc( int bytes );
+void Runtime_free( void* p );
+
+// Tabela gerada com -fprofile-generate: o nome de cada ponto do perfil
+// e o contador de 64 bits que ele usa
+typedef struct RuntimeProfileSite_ {
+   const char* name;
+   int counter;
+} RuntimeProfileSite;
+
+void Runtime_startProfile( const char* fileName, unsigned long long* counters, RuntimeProfileSite* sites, int nSites );
+
+// Tabela gerada com -falloc-profile: um registro por new, com o nome
+// "funcao instrucao" e os totais acumulados durante a execucao
+typedef struct RuntimeAllocSite_ {
+   const char* name;
+   unsigned long long count;
+   unsigned long long bytes;
+} RuntimeAllocSite;
+
+void Runtime_startAllocProfile( const char* fileName, RuntimeAllocSite* sites, int nSites, int useRuntime );
+void* Runtime_profiledAlloc( int bytes, RuntimeAllocSite* site );
+
+// Mesmo caminho rapido que o backend gera para new
+static inline void* Runtime_new( int bytes )
+{
+   if ( (unsigned) bytes > RUNTIME_MAX_SMALL - 4 )
+      return Runtime_alloc( bytes );
+   unsigned size = Runtime_blockSize( bytes );
+   char* block = Runtime_heapNext;
+   if ( (unsigned long) ( Runtime_heapLimit - block ) < size )
+      return Runtime_alloc( bytes );
+   Runtime_heapNext = block + size;
+   *(int*) block = size;
+   return block + 4;
+}
+
+#endif
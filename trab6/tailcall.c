@@ -0,0 +1,108 @@
+/**
+ * @file    tailcall.c
+ * @author  lhpelosi
+ */
+
+#include "tailcall.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static Instr* TailCall_findReturn( Instr* call );
+static int TailCall_isRet( Addr addr );
+
+
+
+int TailCall_eliminate( Function* function )
+{
+   Instr* entry = NULL;
+   Instr** paramStart = NULL;
+   int nParams = 0;
+   int nEliminated = 0;
+
+   // Procura params, call da propria funcao e retorno do seu resultado
+   for ( Instr** link = &(function->code) ; *link ; )
+   {
+      Instr* instr = *link;
+      if ( instr->op == OP_PARAM )
+      {
+         if ( nParams == 0 ) paramStart = link;
+         nParams++;
+         link = &(instr->next);
+         continue;
+      }
+
+      Instr* ret = NULL;
+      if ( instr->op == OP_CALL && strcmp( instr->x.str, function->name ) == 0 &&
+           instr->y.num == nParams && nParams == function->nArgs )
+         ret = TailCall_findReturn( instr );
+      if ( ret == NULL )
+      {
+         nParams = 0;
+         link = &(instr->next);
+         continue;
+      }
+
+      // Rotulo de entrada, antes de todo o corpo
+      Instr** start = ( nParams > 0 ) ? paramStart : link;
+      if ( entry == NULL )
+      {
+         entry = Instr_new( OP_LABEL, Addr_newLabel() );
+         entry->next = function->code;
+         function->code = entry;
+         if ( start == &(function->code) ) start = &(entry->next);
+      }
+
+      // Os valores sao lidos antes de qualquer argumento ser sobrescrito;
+      // o ultimo param empilhado eh o primeiro argumento
+      Instr* code = NULL;
+      Addr* values = (Addr*) malloc( (nParams+1) * sizeof(Addr) );
+      Instr* param = *start;
+      for ( int arg = nParams-1 ; arg >= 0 ; arg--, param = param->next )
+      {
+         values[arg] = Function_newTemp( function );
+         code = Instr_link( code, Instr_new( OP_SET, values[arg], param->x ) );
+      }
+      Variable* v = function->locals;
+      for ( int arg = 0 ; arg < nParams ; arg++, v = v->next )
+      {
+         Addr local;
+         local.type = AD_LOCAL;
+         local.num = arg;
+         local.str = (char*) v->name;
+         code = Instr_link( code, Instr_new( OP_SET, local, values[arg] ) );
+      }
+      free( values );
+
+      Instr* jump = Instr_new( OP_GOTO, entry->x );
+      jump->next = ret->next;
+      code = Instr_link( code, jump );
+      *start = code;
+      link = &(jump->next);
+      nParams = 0;
+      nEliminated++;
+   }
+   return nEliminated;
+}
+
+
+
+static Instr* TailCall_findReturn( Instr* call )
+{
+   // call; ret | call; ret $ret | call; x = $ret; ret x
+   Instr* next = call->next;
+   if ( next == NULL ) return NULL;
+   if ( next->op == OP_RET ) return next;
+   if ( next->op == OP_RET_VAL && TailCall_isRet( next->x ) ) return next;
+   if ( next->op == OP_SET && TailCall_isRet( next->y ) && next->next &&
+        next->next->op == OP_RET_VAL && Addr_eq( next->next->x, next->x ) )
+      return next->next;
+   return NULL;
+}
+
+
+
+static int TailCall_isRet( Addr addr )
+{
+   return addr.type == AD_TEMP && strcmp( addr.str, "$ret" ) == 0;
+}
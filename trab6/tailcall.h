@@ -0,0 +1,13 @@
+/**
+ * @file    tailcall.h
+ * @author  lhpelosi
+ */
+
+#ifndef TAILCALL_H
+#define TAILCALL_H
+
+#include "ir.h"
+
+int TailCall_eliminate( Function* function );
+
+#endif
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Compara a saida de um teste compilado sem otimizacoes com a de uma
+# configuracao otimizada: compila com -O0 e com -O seguido das opcoes,
+# monta e liga como bench/run.sh, roda os dois programas e falha se a
+# saida ou o codigo de retorno diferirem, ou se algum nao compilar.
+#
+# Uso: tests/run.sh backend teste.m0.ir [opcoes ...]
+#
+#   tests/run.sh ./backend tests/loops.m0.ir
+#   tests/run.sh ./backend tests/loops.m0.ir -O1 -fdisable-pass=licm
+
+if [ $# -lt 2 ]; then
+   echo "Uso: $0 backend teste.m0.ir [opcoes ...]" >&2
+   exit 2
+fi
+BACKEND=$1
+TEST_FILE=$2
+shift 2
+
+HERE=$(cd $(dirname $0) && pwd)
+CC32=${CC32:-"gcc -m32 -O2"}
+TIMEOUT=${TIMEOUT:-10}
+NAME=$(basename $TEST_FILE .m0.ir)
+DIR=$(mktemp -d)
+trap "rm -rf $DIR" EXIT
+
+# Compila em $DIR/config e escreve a saida do programa em $DIR/config/saida
+compile_and_run()
+{
+   config=$DIR/$1
+   shift
+   mkdir -p $config
+   cp $TEST_FILE $config/
+   $BACKEND "$@" $config/$NAME.m0.ir || return 1
+   $CC32 -o $config/$NAME $config/$NAME.s $HERE/../bench/io.c $HERE/../runtime.c || return 1
+   # Arquivos escritos pelo programa, como perfis, ficam no diretorio temporario
+   ( cd $config && timeout $TIMEOUT ./$NAME; echo "retorno $?" ) > $config/saida
+}
+
+if ! compile_and_run referencia -O0; then
+   echo "ERRO: $NAME nao compila com -O0" >&2
+   exit 1
+fi
+if ! compile_and_run otimizado -O "$@"; then
+   echo "ERRO: $NAME nao compila com -O${*:+ $*}" >&2
+   exit 1
+fi
+if ! cmp -s $DIR/referencia/saida $DIR/otimizado/saida; then
+   echo "ERRO: saida de $NAME com -O${*:+ $*} difere da de -O0" >&2
+   diff $DIR/referencia/saida $DIR/otimizado/saida | head -20 >&2
+   exit 1
+fi
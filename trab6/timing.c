@@ -0,0 +1,243 @@
+/**
+ * @file    timing.c
+ * @author  lhpelosi
+ */
+
+#include "timing.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define TIMING_MAX_DEPTH 16
+
+typedef struct TimingRecord_ {
+   Function* function; // NULL no total do programa
+   const char* name;
+   double time[ TIMING_N_PHASES ];
+   long long counters[ TIMING_N_COUNTERS ];
+} TimingRecord;
+
+int Timing_enabled = 0;
+
+static const char* Timing_phaseNames[ TIMING_N_PHASES ] = {
+   "yyparse", "Addr_resolve", "perfil", "inline", "tailcall", "copy", "licm",
+   "induction", "unroll", "escape", "layout", "Block_generateBlocks",
+   "Block_computeNextUsage", "emissao"
+};
+static const char* Timing_counterNames[ TIMING_N_COUNTERS ] = {
+   "instrucoes", "blocos", "locais", "temporarias", "bytes"
+};
+
+static double Timing_begin; // Instante de Timing_enable
+static double Timing_mark; // Inicio do trecho ainda nao contado da fase atual
+static TimingPhase Timing_stack[ TIMING_MAX_DEPTH ];
+static int Timing_depth;
+static TimingRecord Timing_total;
+static TimingRecord* Timing_functions;
+static int Timing_nFunctions;
+static int Timing_capacity;
+static int Timing_current = -1; // Funcao que recebe os tempos e contagens, -1 nenhuma
+static int Timing_last = -1; // Ultima funcao escolhida, pois as passadas seguem a mesma ordem
+static size_t Timing_peakHeap;
+
+static double Timing_now();
+static void Timing_charge( double now );
+static void Timing_sampleHeap();
+static double Timing_recordTime( TimingRecord* record );
+static void Timing_writeTable( FILE* output );
+static void Timing_writeJson( FILE* output );
+static void Timing_writeJsonRecord( TimingRecord* record, FILE* output );
+
+
+
+void Timing_enable()
+{
+   Timing_enabled = 1;
+   Timing_begin = Timing_now();
+}
+
+
+
+void Timing_start( TimingPhase phase )
+{
+   if ( !Timing_enabled || Timing_depth == TIMING_MAX_DEPTH ) return;
+   double now = Timing_now();
+   if ( Timing_depth > 0 )
+      Timing_charge( now );
+   Timing_stack[ Timing_depth++ ] = phase;
+   Timing_mark = now;
+}
+
+
+
+void Timing_stop( TimingPhase phase )
+{
+   if ( !Timing_enabled || Timing_depth == 0 || Timing_stack[ Timing_depth-1 ] != phase ) return;
+   double now = Timing_now();
+   Timing_charge( now );
+   Timing_depth--;
+   Timing_mark = now;
+   // Fora das fases aninhadas, que sao curtas e frequentes
+   if ( Timing_depth == 0 )
+      Timing_sampleHeap();
+}
+
+
+
+void Timing_function( Function* function )
+{
+   if ( !Timing_enabled ) return;
+   Timing_current = -1;
+   if ( function == NULL ) return;
+   for ( int k = 1 ; k <= Timing_nFunctions ; k++ )
+   {
+      int i = ( Timing_last + k ) % Timing_nFunctions;
+      if ( Timing_functions[i].function == function )
+      {
+         Timing_current = Timing_last = i;
+         return;
+      }
+   }
+
+   if ( Timing_nFunctions == Timing_capacity )
+   {
+      Timing_capacity = Timing_capacity ? 2 * Timing_capacity : 64;
+      Timing_functions = (TimingRecord*) realloc( Timing_functions, Timing_capacity * sizeof(TimingRecord) );
+   }
+   memset( &(Timing_functions[ Timing_nFunctions ]), 0, sizeof(TimingRecord) );
+   Timing_functions[ Timing_nFunctions ].function = function;
+   Timing_functions[ Timing_nFunctions ].name = function->name;
+   Timing_current = Timing_last = Timing_nFunctions++;
+}
+
+
+
+void Timing_count( TimingCounter counter, long long n )
+{
+   if ( !Timing_enabled ) return;
+   Timing_total.counters[ counter ] += n;
+   if ( Timing_current >= 0 )
+      Timing_functions[ Timing_current ].counters[ counter ] += n;
+}
+
+
+
+void Timing_report( FILE* output, int json )
+{
+   if ( !Timing_enabled ) return;
+   Timing_sampleHeap();
+   if ( json )
+      Timing_writeJson( output );
+   else
+      Timing_writeTable( output );
+}
+
+
+
+static double Timing_now()
+{
+   struct timespec t;
+   clock_gettime( CLOCK_MONOTONIC, &t );
+   return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+
+
+static void Timing_charge( double now )
+{
+   TimingPhase phase = Timing_stack[ Timing_depth-1 ];
+   Timing_total.time[ phase ] += now - Timing_mark;
+   if ( Timing_current >= 0 )
+      Timing_functions[ Timing_current ].time[ phase ] += now - Timing_mark;
+}
+
+
+
+static void Timing_sampleHeap()
+{
+   struct mallinfo2 info = mallinfo2();
+   size_t inUse = info.uordblks + info.hblkhd;
+   if ( inUse > Timing_peakHeap )
+      Timing_peakHeap = inUse;
+}
+
+
+
+static double Timing_recordTime( TimingRecord* record )
+{
+   double time = 0;
+   for ( int p = 0 ; p < TIMING_N_PHASES ; p++ )
+      time += record->time[p];
+   return time;
+}
+
+
+
+static void Timing_writeTable( FILE* output )
+{
+   double wall = Timing_now() - Timing_begin;
+   struct rusage usage;
+   getrusage( RUSAGE_SELF, &usage );
+
+   fprintf( output, "%-24s %12s %7s\n", "Fase", "tempo (ms)", "%" );
+   for ( int p = 0 ; p < TIMING_N_PHASES ; p++ )
+      fprintf( output, "%-24s %12.3f %7.1f\n", Timing_phaseNames[p], 1e3 * Timing_total.time[p],
+                                              wall > 0 ? 100 * Timing_total.time[p] / wall : 0.0 );
+   fprintf( output, "%-24s %12.3f\n\n", "total", 1e3 * wall );
+
+   fprintf( output, "%-24s", "Funcao" );
+   for ( int c = 0 ; c < TIMING_N_COUNTERS ; c++ )
+      fprintf( output, " %12s", Timing_counterNames[c] );
+   fprintf( output, " %12s\n", "tempo (ms)" );
+   for ( int i = 0 ; i <= Timing_nFunctions ; i++ )
+   {
+      TimingRecord* record = ( i < Timing_nFunctions ) ? &(Timing_functions[i]) : &Timing_total;
+      fprintf( output, "%-24s", ( i < Timing_nFunctions ) ? record->name : "total" );
+      for ( int c = 0 ; c < TIMING_N_COUNTERS ; c++ )
+         fprintf( output, " %12lld", record->counters[c] );
+      fprintf( output, " %12.3f\n", 1e3 * Timing_recordTime( record ) );
+   }
+   fprintf( output, "\nPico do heap: %zu bytes\n"
+                    "Memoria residente maxima: %ld KB\n",
+                    Timing_peakHeap,
+                    usage.ru_maxrss );
+}
+
+
+
+static void Timing_writeJson( FILE* output )
+{
+   double wall = Timing_now() - Timing_begin;
+   struct rusage usage;
+   getrusage( RUSAGE_SELF, &usage );
+
+   fprintf( output, "{\n  \"total_ms\": %.3f,\n  \"peak_heap_bytes\": %zu,\n  \"max_rss_kb\": %ld,\n  \"program\": ",
+                    1e3 * wall, Timing_peakHeap, usage.ru_maxrss );
+   Timing_writeJsonRecord( &Timing_total, output );
+   fprintf( output, ",\n  \"functions\": [" );
+   for ( int i = 0 ; i < Timing_nFunctions ; i++ )
+   {
+      fprintf( output, "%s\n    ", i > 0 ? "," : "" );
+      Timing_writeJsonRecord( &(Timing_functions[i]), output );
+   }
+   fprintf( output, "\n  ]\n}\n" );
+}
+
+
+
+static void Timing_writeJsonRecord( TimingRecord* record, FILE* output )
+{
+   fprintf( output, "{" );
+   if ( record->name )
+      fprintf( output, "\"name\": \"%s\", ", record->name );
+   fprintf( output, "\"ms\": %.3f, \"phases_ms\": {", 1e3 * Timing_recordTime( record ) );
+   for ( int p = 0 ; p < TIMING_N_PHASES ; p++ )
+      fprintf( output, "%s\"%s\": %.3f", p > 0 ? ", " : "", Timing_phaseNames[p], 1e3 * record->time[p] );
+   fprintf( output, "}, \"counters\": {" );
+   for ( int c = 0 ; c < TIMING_N_COUNTERS ; c++ )
+      fprintf( output, "%s\"%s\": %lld", c > 0 ? ", " : "", Timing_counterNames[c], record->counters[c] );
+   fprintf( output, "}}" );
+}
@@ -0,0 +1,50 @@
+/**
+ * @file    timing.h
+ * @author  lhpelosi
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include "ir.h"
+
+// Fases medidas; o tempo de uma fase aninhada em outra (Addr_resolve
+// dentro do yyparse) so conta para a mais interna
+typedef enum TimingPhase_ {
+   TIMING_PARSE,
+   TIMING_RESOLVE,
+   TIMING_PROFILE,
+   TIMING_INLINE,
+   TIMING_TAILCALL,
+   TIMING_COPY,
+   TIMING_LICM,
+   TIMING_INDUCTION,
+   TIMING_UNROLL,
+   TIMING_ESCAPE,
+   TIMING_LAYOUT,
+   TIMING_BLOCKS,
+   TIMING_NEXT_USE,
+   TIMING_EMIT,
+   TIMING_N_PHASES
+} TimingPhase;
+
+typedef enum TimingCounter_ {
+   TIMING_INSTRS,
+   TIMING_BLOCK_COUNT,
+   TIMING_LOCALS,
+   TIMING_TEMPS,
+   TIMING_BYTES,
+   TIMING_N_COUNTERS
+} TimingCounter;
+
+extern int Timing_enabled;
+
+void Timing_enable();
+void Timing_start( TimingPhase phase );
+void Timing_stop( TimingPhase phase );
+void Timing_function( Function* function );
+void Timing_count( TimingCounter counter, long long n );
+void Timing_report( FILE* output, int json );
+
+#endif
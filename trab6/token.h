@@ -15,6 +15,7 @@ typedef struct Token_ {
    Variable* vars;
    Function* fun;
    Instr* ins;
+   Instr* last; /* Last instruction of ins, kept by commands */
    Addr addr;
    Opcode op;
 } Token;
@@ -0,0 +1,269 @@
+/**
+ * @file    unroll.c
+ * @author  lhpelosi
+ */
+
+#include "unroll.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loop.h"
+
+static int Unroll_loop( Cfg* cfg, Loop* loop, void* data );
+static int Unroll_isInnermost( Loop* loop, Cfg* cfg );
+static Instr* Unroll_findStep( LoopInfo* info, CfgBlock* latch, Addr counter, int* step );
+static Instr* Unroll_cloneBody( Instr* first, Instr* end );
+static Opcode Unroll_swapComparison( Opcode op );
+static int Unroll_fitsInt( long long value );
+
+
+
+int Unroll_loops( Function* function, UnrollOptions* options )
+{
+   if ( options->factor < 2 ) return 0;
+   return Loop_forEach( function, Unroll_loop, options, 0 );
+}
+
+
+
+static int Unroll_loop( Cfg* cfg, Loop* loop, void* data )
+{
+   UnrollOptions* options = (UnrollOptions*) data;
+   CfgBlock* header = loop->header;
+   if ( header->index + loop->nBlocks > cfg->nBlocks ) return 0;
+   CfgBlock* latch = cfg->blocks[ header->index + loop->nBlocks - 1 ];
+
+   // Testes de forma, do mais barato ao mais caro, antes de qualquer analise.
+   // Cabecalho na forma: rotulo, comparacao e ifFalse para a saida
+   if ( header->nInstr != 3 ) return 0;
+   Instr* test = header->first->next;
+   Instr* branch = test->next;
+   if ( test->op < OP_LT || test->op > OP_GE ) return 0;
+   if ( branch->op != OP_IF_FALSE || !Addr_eq( branch->x, test->x ) ) return 0;
+
+   // Corpo contiguo, terminado por um goto para o cabecalho, e unica saida no cabecalho
+   if ( latch->last->op != OP_GOTO || strcmp( latch->last->x.str, header->first->x.str ) != 0 ) return 0;
+   for ( int i = header->index ; i <= latch->index ; i++ )
+      if ( !Loop_contains( loop, cfg->blocks[i] ) ) return 0;
+   if ( !Unroll_isInnermost( loop, cfg ) ) return 0;
+   CfgBlock* exit = Cfg_findLabel( cfg, branch->y.str );
+   if ( exit == NULL || Loop_contains( loop, exit ) ) return 0;
+   for ( int i = header->index+1 ; i <= latch->index ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      if ( block->last->op == OP_RET || block->last->op == OP_RET_VAL ) return 0;
+      for ( int s = 0 ; s < block->nSucc ; s++ )
+         if ( !Loop_contains( loop, block->succ[s] ) ||
+              ( block->succ[s] == header && block != latch ) )
+            return 0;
+   }
+
+   // Contador i comparado a um limite invariante, com passo no sentido da comparacao
+   LoopInfo* info = Loop_analyze( cfg, loop );
+   Opcode op = test->op;
+   Addr counter = test->y;
+   Addr bound = test->z;
+   if ( Cfg_varIndex( cfg, counter ) < 0 || !Loop_isInvariant( info, bound ) )
+   {
+      op = Unroll_swapComparison( op );
+      counter = test->z;
+      bound = test->y;
+   }
+   int step = 0;
+   Instr* stepInstr = NULL;
+   if ( Cfg_varIndex( cfg, counter ) >= 0 && Loop_isInvariant( info, bound ) )
+      stepInstr = Unroll_findStep( info, latch, counter, &step );
+   Loop_deleteInfo( info );
+   if ( stepInstr == NULL ) return 0;
+   if ( ( op == OP_LT || op == OP_LE ) && step <= 0 ) return 0;
+   if ( ( op == OP_GT || op == OP_GE ) && step >= 0 ) return 0;
+
+   // Fator limitado pelo orcamento de tamanho
+   Instr* bodyFirst = branch->next;
+   int bodySize = 0;
+   for ( Instr* instr = bodyFirst ; instr != latch->last ; instr = instr->next )
+      bodySize++;
+   int factor = options->factor;
+   if ( bodySize > 0 && factor * bodySize > options->budget ) factor = options->budget / bodySize;
+   if ( factor < 2 ) return 0;
+
+   // i + (fator-1)*passo op limite, reescrito como i op' limite - d para nao
+   // calcular um valor do contador que o laco original nunca atinge
+   long long delta = (long long) ( factor-1 ) * step;
+   if ( op == OP_LE ) { op = OP_LT; delta--; }
+   if ( op == OP_GE ) { op = OP_GT; delta++; }
+   if ( !Unroll_fitsInt( delta ) ) return 0;
+   Addr limit = bound;
+   if ( bound.type == AD_NUMBER )
+   {
+      // Limite fora de 32 bits: o laco desenrolado nunca executaria
+      if ( !Unroll_fitsInt( bound.num - delta ) ) return 0;
+      limit = Addr_litNum( (int) ( bound.num - delta ) );
+   }
+
+   // Laco desenrolado, seguido do original que trata as iteracoes restantes:
+   // [P: $s = limite transborda ; if $s goto H ; $b = limite - d]
+   // U: $c = i op' $b ; ifFalse $c goto H ; corpo x fator ; goto U
+   Instr* unrolledLabel = Instr_new( OP_LABEL, Addr_newLabel() );
+   Instr* entryLabel = unrolledLabel;
+   Instr* code = NULL;
+   if ( bound.type != AD_NUMBER && delta != 0 )
+   {
+      // Com passo positivo, limite - d transborda se limite < INT_MIN + d;
+      // com passo negativo, se limite > INT_MAX + d
+      Addr wraps = Function_newTemp( cfg->function );
+      limit = Function_newTemp( cfg->function );
+      entryLabel = Instr_new( OP_LABEL, Addr_newLabel() );
+      code = entryLabel;
+      if ( op == OP_LT )
+         code = Instr_link( code, Instr_new( OP_LT, wraps, bound, Addr_litNum( (int) ( INT_MIN + delta ) ) ) );
+      else
+         code = Instr_link( code, Instr_new( OP_GT, wraps, bound, Addr_litNum( (int) ( INT_MAX + delta ) ) ) );
+      code = Instr_link( code, Instr_new( OP_IF, wraps, header->first->x ) );
+      code = Instr_link( code, Instr_new( OP_SUB, limit, bound, Addr_litNum( (int) delta ) ) );
+   }
+   Addr cond = Function_newTemp( cfg->function );
+   code = Instr_link( code, unrolledLabel );
+   code = Instr_link( code, Instr_new( op, cond, counter, limit ) );
+   code = Instr_link( code, Instr_new( OP_IF_FALSE, cond, header->first->x ) );
+   for ( int c = 0 ; c < factor ; c++ )
+      code = Instr_link( code, Unroll_cloneBody( bodyFirst, latch->last ) );
+   code = Instr_link( code, Instr_new( OP_GOTO, unrolledLabel->x ) );
+
+   // Entradas no laco passam pelo desenrolado
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      if ( Loop_contains( loop, cfg->blocks[i] ) ) continue;
+      Addr* target = Instr_jumpTarget( cfg->blocks[i]->last );
+      if ( target && strcmp( target->str, header->first->x.str ) == 0 )
+         *target = entryLabel->x;
+   }
+   Instr* prev = NULL;
+   for ( Instr* instr = cfg->function->code ; instr != header->first ; instr = instr->next )
+      prev = instr;
+   Instr_link( code, header->first );
+   if ( prev )
+      prev->next = code;
+   else
+      cfg->function->code = code;
+
+   if ( options->stats )
+      fprintf( options->stats, "Desenrolamento: funcao %s, laco %s, fator %d, corpo de %d instrucoes\n",
+                               cfg->function->name, header->first->x.str, factor, bodySize );
+   return 1;
+}
+
+
+
+static int Unroll_isInnermost( Loop* loop, Cfg* cfg )
+{
+   // Nenhuma aresta de retorno para outro cabecalho dentro do laco,
+   // cujos blocos ja se sabe que sao contiguos
+   for ( int i = loop->header->index ; i < loop->header->index + loop->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      for ( int s = 0 ; s < block->nSucc ; s++ )
+         if ( block->succ[s] != loop->header && Cfg_dominates( block->succ[s], block ) )
+            return 0;
+   }
+   return 1;
+}
+
+
+
+static Instr* Unroll_findStep( LoopInfo* info, CfgBlock* latch, Addr counter, int* step )
+{
+   // Unica definicao do contador, i = i + c, executada em toda iteracao
+   Cfg* cfg = info->cfg;
+   int var = Cfg_varIndex( cfg, counter );
+   if ( info->defCount[ var ] != 1 ) return NULL;
+
+   for ( int i = 0 ; i < cfg->nBlocks ; i++ )
+   {
+      CfgBlock* block = cfg->blocks[i];
+      if ( !Loop_contains( info->loop, block ) ) continue;
+      Instr* instr = block->first;
+      for ( int iInstr = 0 ; iInstr < block->nInstr ; iInstr++, instr = instr->next )
+      {
+         if ( Cfg_getDef( cfg, instr ) != var ) continue;
+         if ( !Cfg_dominates( block, latch ) ) return NULL;
+         if ( instr->op == OP_ADD && Addr_eq( instr->y, instr->x ) && instr->z.type == AD_NUMBER )
+            *step = instr->z.num;
+         else if ( instr->op == OP_ADD && Addr_eq( instr->z, instr->x ) && instr->y.type == AD_NUMBER )
+            *step = instr->y.num;
+         else if ( instr->op == OP_SUB && Addr_eq( instr->y, instr->x ) && instr->z.type == AD_NUMBER )
+            *step = -instr->z.num;
+         else
+            return NULL;
+         return instr;
+      }
+   }
+   return NULL;
+}
+
+
+
+static Instr* Unroll_cloneBody( Instr* first, Instr* end )
+{
+   // Copia as instrucoes [first, end), renomeando os rotulos internos
+   int nLabels = 0;
+   Addr* oldLabels = NULL;
+   Addr* newLabels = NULL;
+   Instr* copy = NULL;
+   Instr* copyLast = NULL;
+
+   for ( Instr* instr = first ; instr != end ; instr = instr->next )
+   {
+      if ( instr->op != OP_LABEL ) continue;
+      oldLabels = (Addr*) realloc( oldLabels, (nLabels+1) * sizeof(Addr) );
+      newLabels = (Addr*) realloc( newLabels, (nLabels+1) * sizeof(Addr) );
+      oldLabels[ nLabels ] = instr->x;
+      newLabels[ nLabels ] = Addr_newLabel();
+      nLabels++;
+   }
+
+   for ( Instr* instr = first ; instr != end ; instr = instr->next )
+   {
+      Instr* clone = Instr_clone( instr );
+      Addr* label = ( clone->op == OP_LABEL ) ? &(clone->x) : Instr_jumpTarget( clone );
+      for ( int l = 0 ; label && l < nLabels ; l++ )
+         if ( strcmp( label->str, oldLabels[l].str ) == 0 )
+         {
+            *label = newLabels[l];
+            break;
+         }
+      if ( copyLast )
+         copyLast->next = clone;
+      else
+         copy = clone;
+      copyLast = clone;
+   }
+
+   free( oldLabels );
+   free( newLabels );
+   return copy;
+}
+
+
+
+static Opcode Unroll_swapComparison( Opcode op )
+{
+   // a op b equivale a b op' a
+   switch ( op )
+   {
+      case OP_LT: return OP_GT;
+      case OP_GT: return OP_LT;
+      case OP_LE: return OP_GE;
+      case OP_GE: return OP_LE;
+      default: return op;
+   }
+}
+
+
+
+static int Unroll_fitsInt( long long value )
+{
+   return value >= INT_MIN && value <= INT_MAX;
+}
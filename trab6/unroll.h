@@ -0,0 +1,20 @@
+/**
+ * @file    unroll.h
+ * @author  lhpelosi
+ */
+
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include <stdio.h>
+#include "ir.h"
+
+typedef struct UnrollOptions_ {
+   int factor; // Numero de copias do corpo por iteracao
+   int budget; // Maximo de instrucoes no corpo desenrolado
+   FILE* stats; // Relatorio dos lacos desenrolados, NULL para nenhum
+} UnrollOptions;
+
+int Unroll_loops( Function* function, UnrollOptions* options );
+
+#endif